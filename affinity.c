@@ -0,0 +1,342 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     affinity.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Thread placement (CPU affinity, scheduling) implementation
+ */
+
+#include "affinity.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define AFFINITY_CPULIST_LENGTH 256
+
+char * affinityRoles[] = {"listen", "send", "switch", "maintain"};
+
+/********************************************************************/
+
+void initSwitchAffinity(struct switch_affinity * affinity);
+int setSwitchAffinityPlacement(struct switch_affinity * affinity, const char * option);
+int setSwitchAffinityPriority(struct switch_affinity * affinity, const char * option);
+int lockSwitchMemory(struct switch_affinity * affinity);
+void applySwitchAffinity(struct switch_affinity * affinity, enum e_affinityRole role, const char * ifName, pthread_t thread);
+void printSwitchThreadPlacement(const char * name, pthread_t thread);
+void printSwitchAffinity(struct switch_affinity * affinity);
+int getAffinityRole(const char * option, const char ** value);
+int parseCpuList(const char * list, cpu_set_t * cpus);
+void formatCpuList(cpu_set_t * cpus, char * output, const unsigned int length);
+int getIfNumaCpus(const char * ifName, cpu_set_t * cpus);
+
+/*******************************************************************/
+
+void initSwitchAffinity(struct switch_affinity * affinity) {
+
+	memset(affinity, 0, sizeof(struct switch_affinity));
+	for (int i = 0; i < E_AFFINITY_ROLES; i++)
+		affinity->roles[i].policy = E_AFFINITY_NONE;
+	pthread_mutex_init(&affinity->mutex, NULL);
+}
+
+/**
+ * Splits "<role>:<value>" option, returns role or -1.
+ */
+int getAffinityRole(const char * option, const char ** value) {
+
+	const char * colon = strchr(option, ':');
+
+	if (colon == NULL)
+		return -1;
+
+	for (int i = 0; i < E_AFFINITY_ROLES; i++) {
+		if (strlen(affinityRoles[i]) == colon - option && strncmp(option, affinityRoles[i], colon - option) == 0) {
+			*value = colon + 1;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Parses kernel style CPU list ("0-3,8,10-11"), returns count of CPUs.
+ */
+int parseCpuList(const char * list, cpu_set_t * cpus) {
+
+	char buffer[AFFINITY_CPULIST_LENGTH];
+	char * token;
+	char * savePtr;
+	char * end;
+	long from, to;
+
+	CPU_ZERO(cpus);
+	strncpy(buffer, list, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = '\0';
+
+	for (token = strtok_r(buffer, ",\n", &savePtr); token != NULL; token = strtok_r(NULL, ",\n", &savePtr)) {
+		from = strtol(token, &end, 10);
+		to = from;
+		if (*end == '-')
+			to = strtol(end + 1, &end, 10);
+		if (*end != '\0' || from < 0 || to >= CPU_SETSIZE || from > to) {
+			error_print("Invalid CPU range: %s\n", token);
+			return 0;
+		}
+		for (long cpu = from; cpu <= to; cpu++)
+			CPU_SET(cpu, cpus);
+	}
+
+	return CPU_COUNT(cpus);
+}
+
+void formatCpuList(cpu_set_t * cpus, char * output, const unsigned int length) {
+
+	unsigned int written = 0;
+
+	output[0] = '\0';
+	for (int cpu = 0; cpu < CPU_SETSIZE && written < length; cpu++) {
+		if (!CPU_ISSET(cpu, cpus))
+			continue;
+		int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus))
+			last++;
+		if (last == cpu)
+			written += snprintf(output + written, length - written, "%s%d", written ? "," : "", cpu);
+		else
+			written += snprintf(output + written, length - written, "%s%d-%d", written ? "," : "", cpu, last);
+		cpu = last;
+	}
+}
+
+/**
+ * CPUs local to NIC of the interface, 0 if unknown (virtual device, no NUMA).
+ */
+int getIfNumaCpus(const char * ifName, cpu_set_t * cpus) {
+
+	char path[256];
+	char list[AFFINITY_CPULIST_LENGTH];
+	FILE * file;
+	int node = -1;
+
+	if (ifName == NULL)
+		return 0;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifName);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return 0;
+	if (fscanf(file, "%d", &node) != 1)
+		node = -1;
+	fclose(file);
+
+	if (node < 0)
+		return 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return 0;
+	if (fgets(list, sizeof(list), file) == NULL)
+		list[0] = '\0';
+	fclose(file);
+
+	return parseCpuList(list, cpus);
+}
+
+/**
+ * Option "<role>:numa", "<role>:<cpu list>" or "<role>:none".
+ */
+int setSwitchAffinityPlacement(struct switch_affinity * affinity, const char * option) {
+
+	const char * value;
+	int role = getAffinityRole(option, &value);
+
+	if (role < 0) {
+		error_print("Invalid thread role: %s\n", option);
+		return 0;
+	}
+
+	if (strcmp(value, "none") == 0) {
+		affinity->roles[role].policy = E_AFFINITY_NONE;
+	} else if (strcmp(value, "numa") == 0) {
+		affinity->roles[role].policy = E_AFFINITY_NUMA;
+	} else {
+		if (parseCpuList(value, &affinity->roles[role].cores) == 0)
+			return 0;
+		affinity->roles[role].policy = E_AFFINITY_CORES;
+		affinity->roles[role].nextCore = 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Option "<role>:<SCHED_FIFO priority>", 0 restores default scheduling.
+ */
+int setSwitchAffinityPriority(struct switch_affinity * affinity, const char * option) {
+
+	const char * value;
+	char * end;
+	int role = getAffinityRole(option, &value);
+	long priority;
+
+	if (role < 0) {
+		error_print("Invalid thread role: %s\n", option);
+		return 0;
+	}
+
+	priority = strtol(value, &end, 10);
+	if (*end != '\0' || (priority != 0 && (priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO)))) {
+		error_print("Invalid SCHED_FIFO priority: %s\n", value);
+		return 0;
+	}
+
+	affinity->roles[role].priority = priority;
+
+	return 1;
+}
+
+/**
+ * Keeps buffers and stacks resident, page faults on data path stall frames.
+ */
+int lockSwitchMemory(struct switch_affinity * affinity) {
+
+	if (affinity->lockMemory == 0 || affinity->memoryLocked == 1)
+		return 1;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		error_print("%s\n", "Unable to lock memory (mlockall)");
+		return 0;
+	}
+
+	affinity->memoryLocked = 1;
+	return 1;
+}
+
+/**
+ * Places just created thread. Dedicated cores are handed out round robin,
+ * one per thread, as isolated cores are not load balanced by the kernel.
+ * Threads not bound to a port use NUMA node of the first one.
+ */
+void applySwitchAffinity(struct switch_affinity * affinity, enum e_affinityRole role, const char * ifName, pthread_t thread) {
+
+	struct switch_affinity_role * placement;
+	cpu_set_t cpus;
+	int placed = 0;
+
+	if (affinity == NULL || role >= E_AFFINITY_ROLES)
+		return;
+
+	placement = affinity->roles + role;
+	CPU_ZERO(&cpus);
+
+	pthread_mutex_lock(&affinity->mutex);
+	switch (placement->policy) {
+		case E_AFFINITY_NUMA:
+			placed = getIfNumaCpus(ifName, &cpus);
+			if (placed == 0)
+				debug_print("No NUMA node for %s, thread left unpinned\n", ifName == NULL ? "-" : ifName);
+			break;
+		case E_AFFINITY_CORES: {
+			int count = CPU_COUNT(&placement->cores);
+			int n = placement->nextCore++ % count;
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+				if (CPU_ISSET(cpu, &placement->cores) && n-- == 0) {
+					CPU_SET(cpu, &cpus);
+					placed = 1;
+					break;
+				}
+			}
+			break;
+		}
+		default:
+			break;
+	}
+	pthread_mutex_unlock(&affinity->mutex);
+
+	if (placed > 0 && pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus) != 0)
+		error_print("Unable to set CPU affinity of %s thread\n", affinityRoles[role]);
+
+	if (placement->priority > 0) {
+		struct sched_param param;
+		param.sched_priority = placement->priority;
+		if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0)
+			error_print("Unable to set SCHED_FIFO priority of %s thread\n", affinityRoles[role]);
+	}
+}
+
+/**
+ * Placement in effect, as reported by the kernel.
+ */
+void printSwitchThreadPlacement(const char * name, pthread_t thread) {
+
+	cpu_set_t cpus;
+	char list[AFFINITY_CPULIST_LENGTH];
+	struct sched_param param;
+	int policy;
+
+	if (pthread_getaffinity_np(thread, sizeof(cpu_set_t), &cpus) != 0)
+		strcpy(list, "?");
+	else
+		formatCpuList(&cpus, list, sizeof(list));
+
+	if (pthread_getschedparam(thread, &policy, &param) != 0)
+		policy = -1;
+
+	user_print("  %-20s CPUs %-16s %s", name, list,
+				policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER");
+	if (policy == SCHED_FIFO || policy == SCHED_RR)
+		user_print(" %d", param.sched_priority);
+	user_print("%s\n", "");
+}
+
+void printSwitchAffinity(struct switch_affinity * affinity) {
+
+	char list[AFFINITY_CPULIST_LENGTH];
+
+	user_print("Memory locked: %s\n", affinity->memoryLocked ? "yes" : "no");
+	for (int i = 0; i < E_AFFINITY_ROLES; i++) {
+		struct switch_affinity_role * placement = affinity->roles + i;
+		user_print("Placement of %s threads: ", affinityRoles[i]);
+		switch (placement->policy) {
+			case E_AFFINITY_NUMA:
+				user_print("%s", "NIC NUMA node");
+				break;
+			case E_AFFINITY_CORES:
+				formatCpuList(&placement->cores, list, sizeof(list));
+				user_print("dedicated cores %s", list);
+				break;
+			default:
+				user_print("%s", "any CPU");
+				break;
+		}
+		if (placement->priority > 0)
+			user_print(", SCHED_FIFO %d", placement->priority);
+		user_print("%s\n", "");
+	}
+}
+
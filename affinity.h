@@ -0,0 +1,66 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     affinity.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Thread placement (CPU affinity, scheduling) implementation
+ */
+
+#ifndef _AFFINITY_
+#define _AFFINITY_
+
+#include <sched.h>
+#include <pthread.h>
+
+enum e_affinityRole {E_AFFINITY_ROLE_LISTEN = 0,
+				E_AFFINITY_ROLE_SEND,
+				E_AFFINITY_ROLE_SWITCH,
+				E_AFFINITY_ROLE_MAINTAIN,
+				E_AFFINITY_ROLES};
+
+enum e_affinityPolicy {E_AFFINITY_NONE = 0, // Leave it to the kernel
+				E_AFFINITY_NUMA, // CPUs of port's NIC NUMA node
+				E_AFFINITY_CORES}; // Dedicated cores, one per thread
+
+struct switch_affinity_role { // Placement of one thread role
+	enum e_affinityPolicy policy;
+	cpu_set_t cores; // E_AFFINITY_CORES
+	unsigned int nextCore; // Round robin over cores
+	int priority; // SCHED_FIFO priority, 0 - default scheduling
+};
+
+struct switch_affinity { // Placement of all switch threads
+	struct switch_affinity_role roles[E_AFFINITY_ROLES];
+	unsigned int lockMemory:1; // mlockall
+	unsigned int memoryLocked:1;
+	pthread_mutex_t mutex;
+};
+
+void initSwitchAffinity(struct switch_affinity * affinity);
+int setSwitchAffinityPlacement(struct switch_affinity * affinity, const char * option);
+int setSwitchAffinityPriority(struct switch_affinity * affinity, const char * option);
+int lockSwitchMemory(struct switch_affinity * affinity);
+void applySwitchAffinity(struct switch_affinity * affinity, enum e_affinityRole role, const char * ifName, pthread_t thread);
+void printSwitchThreadPlacement(const char * name, pthread_t thread);
+void printSwitchAffinity(struct switch_affinity * affinity);
+
+#endif
+
@@ -0,0 +1,124 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     flowcache.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Forwarding decision cache
+ */
+
+#include "flowcache.h"
+#include "mactable.h"
+#include "switchclock.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/********************************************************************/
+
+struct switch_flowcache * initFlowCache();
+void destroyFlowCache(struct switch_flowcache * cache);
+struct switch_if * getFlowCacheRecord(struct switch_flowcache * cache, struct switch_mactable * table, struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf);
+void insertFlowCacheRecord(struct switch_flowcache * cache, const unsigned long generation, struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf, struct switch_if * outIf);
+unsigned int flowCacheHashFunction(struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf);
+
+/*******************************************************************/
+
+struct switch_flowcache * initFlowCache() {
+
+	struct switch_flowcache * cache = (struct switch_flowcache *) malloc(sizeof(struct switch_flowcache));
+	if (cache == NULL) {
+		debug_print("%s\n", "Error initializing flow cache");
+		return NULL;
+	}
+
+	memset(cache, 0, sizeof(struct switch_flowcache));
+
+	return cache;
+}
+
+void destroyFlowCache(struct switch_flowcache * cache) {
+
+	if (cache == NULL)
+		return;
+
+	free((void *) cache);
+}
+
+unsigned int flowCacheHashFunction(struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf) {
+
+	unsigned int hash;
+
+	// NIC specific (last) bytes of both addresses differ most
+	hash = (frameHdr->ether_shost[3] << 16) | (frameHdr->ether_shost[4] << 8) | frameHdr->ether_shost[5];
+	hash ^= (frameHdr->ether_dhost[3] << 20) | (frameHdr->ether_dhost[4] << 12) | (frameHdr->ether_dhost[5] << 4);
+	hash ^= (vlan << 8) ^ inIf->index;
+	hash *= 0x9e3779b1; // Fibonacci hashing
+
+	return hash >> 16; // Top bits mix best
+}
+
+/**
+ * Returns cached out port of the flow, NULL on miss. Entry is valid only if
+ * MAC table has not changed (moves, deletions, aging) since it was cached and
+ * source was learned recently, otherwise it has to go through the MAC table.
+ */
+struct switch_if * getFlowCacheRecord(struct switch_flowcache * cache, struct switch_mactable * table, struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf) {
+
+	struct switch_flowcache_entry * entry;
+
+	if (cache == NULL || table == NULL)
+		return NULL;
+
+	entry = cache->entries + (flowCacheHashFunction(frameHdr, vlan, inIf) & (FLOWCACHE_SIZE - 1));
+	if (entry->inIf == inIf && entry->vlan == vlan
+			&& memcmp(entry->dstAddress, frameHdr->ether_dhost, ETHER_ADDR_LEN) == 0
+			&& memcmp(entry->srcAddress, frameHdr->ether_shost, ETHER_ADDR_LEN) == 0
+			&& entry->generation == getMACTableGeneration(table)
+			&& getSwitchClockSeconds() - entry->refreshed < FLOWCACHE_REFRESH) {
+		__atomic_store_n(&cache->hits, cache->hits + 1, __ATOMIC_RELAXED); // Read by CLI
+		return entry->outIf;
+	}
+
+	__atomic_store_n(&cache->misses, cache->misses + 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/**
+ * Generation has to be read before the MAC table lookups, out port was
+ * resolved by.
+ */
+void insertFlowCacheRecord(struct switch_flowcache * cache, const unsigned long generation, struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf, struct switch_if * outIf) {
+
+	struct switch_flowcache_entry * entry;
+
+	if (cache == NULL || outIf == NULL)
+		return;
+
+	entry = cache->entries + (flowCacheHashFunction(frameHdr, vlan, inIf) & (FLOWCACHE_SIZE - 1));
+	memcpy(entry->srcAddress, frameHdr->ether_shost, ETHER_ADDR_LEN);
+	memcpy(entry->dstAddress, frameHdr->ether_dhost, ETHER_ADDR_LEN);
+	entry->vlan = vlan;
+	entry->inIf = inIf;
+	entry->outIf = outIf;
+	entry->generation = generation;
+	entry->refreshed = getSwitchClockSeconds();
+}
@@ -0,0 +1,61 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     flowcache.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Forwarding decision cache
+ */
+
+#ifndef _FLOWCACHE_
+#define _FLOWCACHE_
+
+#include "switchcore.h"
+#include "mactable.h"
+
+#include <stdint.h>
+#include <net/ethernet.h>
+
+#define FLOWCACHE_SIZE 256 // Power of 2
+#define FLOWCACHE_REFRESH 1 // Seconds, source is relearned after
+
+struct switch_flowcache_entry { // (src, dst, VLAN, in port) -> out port
+	u_char srcAddress[ETHER_ADDR_LEN];
+	u_char dstAddress[ETHER_ADDR_LEN];
+	unsigned int vlan;
+	struct switch_if * inIf;
+	struct switch_if * outIf;
+	unsigned long generation; // MAC table generation entry is valid for
+	uint32_t refreshed; // Switch clock seconds
+};
+
+struct switch_flowcache { // Direct mapped cache, owned by one switching thread
+	struct switch_flowcache_entry entries[FLOWCACHE_SIZE];
+	unsigned long hits; // Written by owner only, read by others
+	unsigned long misses;
+};
+
+struct switch_flowcache * initFlowCache();
+void destroyFlowCache(struct switch_flowcache * cache);
+struct switch_if * getFlowCacheRecord(struct switch_flowcache * cache, struct switch_mactable * table, struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf);
+void insertFlowCacheRecord(struct switch_flowcache * cache, const unsigned long generation, struct ether_header * frameHdr, const unsigned int vlan, struct switch_if * inIf, struct switch_if * outIf);
+
+#endif
+
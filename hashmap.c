@@ -26,14 +26,13 @@
 
 #include "hashmap.h"
 #include "utils.h"
-#include "mactable.h"
 
 #include <stdlib.h>
 #include <pcap.h>
 
 /**********************************************************/
 
-struct hashMap * hashMapInit (const unsigned int mapSize, unsigned int(*hashFunction)(void *), int(*keyEqual)(void *, void *));
+struct hashMap * hashMapInit (const unsigned int mapSize, unsigned int(*hashFunction)(void *), int(*keyEqual)(void *, void *), void(*valueDestroy)(void *));
 void hashMapDestroy(struct hashMap * map);
 int hashMapInsertValue(struct hashMap * map, void * key, void * value);
 void hashMapDeleteValue(struct hashMap * map, void * key);
@@ -43,7 +42,7 @@ void hashMapDestroyList(struct hashMap_item_list * list);
 
 /*********************************************************/
 
-struct hashMap * hashMapInit (const unsigned int mapSize, unsigned int(*hashFunction)(void *), int(*keyEqual)(void *, void *)) {
+struct hashMap * hashMapInit (const unsigned int mapSize, unsigned int(*hashFunction)(void *), int(*keyEqual)(void *, void *), void(*valueDestroy)(void *)) {
 
 	debug_print("%s\n", "START");
 
@@ -63,6 +62,7 @@ struct hashMap * hashMapInit (const unsigned int mapSize, unsigned int(*hashFunc
 	map->mapSize = mapSize;
 	map->hashFunction = hashFunction;
 	map->keyEqual = keyEqual;
+	map->valueDestroy = valueDestroy;
 
 	// Items initalizing
 	map->data = (struct hashMap_item *) malloc(sizeof(struct hashMap_item) * map->mapSize);
@@ -106,6 +106,10 @@ void hashMapDestroy(struct hashMap * map) {
 	pthread_mutex_destroy(&map->mutex);
 
 	for (int i = 0; i < map->mapSize; i++) {
+		/* Free first line value */
+		if ((map->data + i)->occupied == 1 && map->valueDestroy != NULL)
+			map->valueDestroy((map->data + i)->value);
+
 		/* Free linear list */
 		struct hashMap_item * curr = (map->data + i)->next;
 		struct hashMap_item * prev = NULL;
@@ -113,7 +117,8 @@ void hashMapDestroy(struct hashMap * map) {
 			prev = curr;
 			curr = curr->next;
 			if (prev != NULL) {
-				deleteMACTableItem((struct switch_mactable_item *) prev->value);
+				if (map->valueDestroy != NULL)
+					map->valueDestroy(prev->value);
 				free(prev);
 			}
 		}
@@ -148,7 +153,7 @@ int hashMapInsertValue(struct hashMap * map, void * key, void * value) {
 	// 1. Check first line items
 	if ((map->data + hashValue)->occupied == 0) {
 	    (map->data + hashValue)->value = value;
-		memcpy((map->data + hashValue)->key, key, sizeof(u_char) * 6);
+		memcpy((map->data + hashValue)->key, key, sizeof(u_char) * HASHMAP_KEY_SIZE);
 		(map->data + hashValue)->occupied = 1;
 		map->itemCount++;
 		pthread_mutex_unlock(&map->mutex);
@@ -164,7 +169,7 @@ int hashMapInsertValue(struct hashMap * map, void * key, void * value) {
 		return -1;
 	}
 	item->value = value;
-	memcpy(item->key,key, sizeof(u_char) * 6);
+	memcpy(item->key,key, sizeof(u_char) * HASHMAP_KEY_SIZE);
 	item->occupied = 1;
 	item->next = NULL;
 
@@ -201,7 +206,7 @@ void hashMapDeleteValue(struct hashMap * map, void * key) {
 
 	item = map->data + hashValue;
 	while (item != NULL) {
-		if (map->keyEqual(item->key, key) == 1)
+		if (item->occupied == 1 && map->keyEqual(item->key, key) == 1)
 			break;
 		item = item->next;
 	}
@@ -225,7 +230,7 @@ void hashMapDeleteValue(struct hashMap * map, void * key) {
 			pthread_mutex_unlock(&map->mutex);
 			return;
 		}
-		itm->next = NULL;
+		itm->next = item->next;
 		//deleteMACTableItem((struct switch_mactable_item *) item->value);
 		free((void *) item);
 	}
@@ -282,6 +287,7 @@ struct hashMap_item_list * hashMap2List(struct hashMap * map) {
 	itemList = (struct hashMap_item_list *) malloc(sizeof(struct hashMap_item_list) * map->itemCount);
 	if (itemList == NULL) {
 		debug_print("%s\n", "Error initalizing itemList");
+		pthread_mutex_unlock(&map->mutex);
 		return NULL;
 	}
 
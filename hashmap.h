@@ -30,9 +30,11 @@
 #include <pthread.h>
 #include <pcap.h>
 
+#define HASHMAP_KEY_SIZE 8
+
 struct hashMap_item {
 	void * value;
-	u_char key[6];
+	u_char key[HASHMAP_KEY_SIZE];
 	unsigned int occupied;
 	struct hashMap_item * next;
 	struct hashMap_item * last;
@@ -44,6 +46,7 @@ struct hashMap {
 	unsigned int itemCount;
 	unsigned int (*hashFunction)(void *);
 	int (*keyEqual) (void *, void *);
+	void (*valueDestroy) (void *);
 	pthread_mutex_t mutex;
 };
 
@@ -51,7 +54,7 @@ struct hashMap_item_list {
 	void * value;
 };
 
-struct hashMap * hashMapInit (const unsigned int mapSize, unsigned int(*hashFunction)(void *), int(*keyEqual)(void *, void *));
+struct hashMap * hashMapInit (const unsigned int mapSize, unsigned int(*hashFunction)(void *), int(*keyEqual)(void *, void *), void(*valueDestroy)(void *));
 void hashMapDestroy(struct hashMap * map);
 int hashMapInsertValue(struct hashMap * map, void * key, void * value);
 void hashMapDeleteValue(struct hashMap * map, void * key);
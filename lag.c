@@ -0,0 +1,369 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     lag.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Static link aggregation implementation
+ */
+
+#include "lag.h"
+#include "switchcore.h"
+#include "mactable.h"
+#include "vlan.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+/********************************************************************/
+
+int addSwitchLagMember(struct switch_dev * dev, const unsigned int id, struct switch_if * iface);
+int removeSwitchLagMember(struct switch_dev * dev, struct switch_if * iface);
+void destroySwitchLags(struct switch_dev * dev);
+struct switch_if * getSwitchLagPort(struct switch_if * iface);
+struct switch_if * selectSwitchLagMember(struct switch_if * port, const unsigned int hash);
+unsigned int getLagFrameHash(const u_char * frame, const unsigned int length);
+void updateSwitchLagActive(struct switch_lag * lag);
+void maintainSwitchLags(struct switch_dev * dev);
+void printSwitchLags(struct switch_dev * dev);
+struct switch_lag * getSwitchLag(struct switch_dev * dev, const unsigned int id);
+void flushSwitchLagPorts(struct switch_dev * dev, struct switch_if * oldPort, struct switch_if * newPort, struct switch_if * iface);
+int readSwitchIfCarrier(struct switch_if * iface);
+unsigned int lagHashBytes(unsigned int hash, const u_char * data, const unsigned int length);
+
+/*******************************************************************/
+
+struct switch_lag * getSwitchLag(struct switch_dev * dev, const unsigned int id) {
+
+	struct switch_lag * lag;
+
+	for (lag = dev->lags; lag != NULL; lag = lag->next) {
+		if (lag->id == id)
+			return lag;
+	}
+
+	// Not found, create new one
+	lag = (struct switch_lag *) malloc(sizeof(struct switch_lag));
+	if (lag == NULL) {
+		debug_print("%s\n", "Error initializing LAG");
+		return NULL;
+	}
+
+	lag->id = id;
+	lag->membersCount = 0;
+	lag->activeCount = 0;
+	pthread_mutex_init(&lag->mutex, NULL);
+	lag->next = dev->lags;
+	dev->lags = lag;
+
+	return lag;
+}
+
+/**
+ * MAC records of group are learned against its first member, so logical
+ * ports before & after membership change and the moved interface itself
+ * are flushed. Called once membership has changed, records learned in the
+ * meantime go too. Each flush bumps generation, dropping flow cache entries.
+ */
+void flushSwitchLagPorts(struct switch_dev * dev, struct switch_if * oldPort, struct switch_if * newPort, struct switch_if * iface) {
+
+	if (oldPort != NULL)
+		flushMACTablePort(dev->mac_table, oldPort);
+	if (newPort != NULL && newPort != oldPort)
+		flushMACTablePort(dev->mac_table, newPort);
+	if (iface != oldPort && iface != newPort)
+		flushMACTablePort(dev->mac_table, iface);
+}
+
+int addSwitchLagMember(struct switch_dev * dev, const unsigned int id, struct switch_if * iface) {
+
+	struct switch_lag * lag;
+	struct switch_if * oldPort, * newPort;
+
+	if (dev == NULL || iface == NULL)
+		return 0;
+
+	if (iface->lag != NULL) {
+		error_print("Interface %s is already member of LAG %u\n", iface->name, iface->lag->id);
+		return 0;
+	}
+
+	lag = getSwitchLag(dev, id);
+	if (lag == NULL)
+		return 0;
+
+	if (lag->membersCount >= LAG_MAX_MEMBERS) {
+		error_print("LAG %u is full\n", id);
+		return 0;
+	}
+
+	pthread_mutex_lock(&lag->mutex);
+	oldPort = lag->membersCount > 0 ? lag->members[0] : NULL;
+	lag->members[lag->membersCount++] = iface;
+	iface->lag = lag;
+	newPort = lag->members[0];
+	pthread_mutex_unlock(&lag->mutex);
+
+	flushSwitchLagPorts(dev, oldPort, newPort, iface);
+	updateSwitchLagActive(lag);
+
+	return 1;
+}
+
+/**
+ * Empty groups are kept until switch shutdown, data path may still hold
+ * a reference.
+ */
+int removeSwitchLagMember(struct switch_dev * dev, struct switch_if * iface) {
+
+	struct switch_lag * lag;
+	struct switch_if * oldPort, * newPort;
+
+	if (dev == NULL || iface == NULL || iface->lag == NULL)
+		return 0;
+
+	lag = iface->lag;
+
+	pthread_mutex_lock(&lag->mutex);
+	oldPort = lag->members[0];
+	for (int i = 0; i < lag->membersCount; i++) {
+		if (lag->members[i] == iface) {
+			memmove(lag->members + i, lag->members + i + 1, sizeof(struct switch_if *) * (lag->membersCount - i - 1));
+			lag->membersCount--;
+			break;
+		}
+	}
+	iface->lag = NULL;
+	newPort = lag->membersCount > 0 ? lag->members[0] : NULL;
+	pthread_mutex_unlock(&lag->mutex);
+
+	flushSwitchLagPorts(dev, oldPort, newPort, iface);
+	updateSwitchLagActive(lag);
+
+	return 1;
+}
+
+void destroySwitchLags(struct switch_dev * dev) {
+
+	struct switch_lag * lag;
+
+	if (dev == NULL)
+		return;
+
+	while (dev->lags != NULL) {
+		lag = dev->lags;
+		dev->lags = lag->next;
+		pthread_mutex_destroy(&lag->mutex);
+		free((void *) lag);
+	}
+}
+
+/**
+ * Logical port, frames of the interface are learned against.
+ */
+struct switch_if * getSwitchLagPort(struct switch_if * iface) {
+
+	struct switch_lag * lag = iface->lag;
+
+	if (lag == NULL || lag->membersCount == 0)
+		return iface;
+
+	return lag->members[0];
+}
+
+/**
+ * Picks egress member of logical port by frame hash, NULL if no member
+ * is up.
+ */
+struct switch_if * selectSwitchLagMember(struct switch_if * port, const unsigned int hash) {
+
+	struct switch_lag * lag = port->lag;
+	unsigned int activeCount;
+
+	if (lag == NULL)
+		return port;
+
+	activeCount = __atomic_load_n(&lag->activeCount, __ATOMIC_ACQUIRE);
+	if (activeCount == 0)
+		return NULL;
+
+	return lag->active[hash % activeCount];
+}
+
+/**
+ * Recomputes members used for distribution. Called whenever member is
+ * opened / closed or its link goes up / down.
+ */
+void updateSwitchLagActive(struct switch_lag * lag) {
+
+	struct switch_if * active[LAG_MAX_MEMBERS];
+	unsigned int activeCount = 0;
+
+	if (lag == NULL)
+		return;
+
+	pthread_mutex_lock(&lag->mutex);
+	for (int i = 0; i < lag->membersCount; i++) {
+		if (isSwitchIfOpened(lag->members[i]) == 1 && lag->members[i]->linkUp == 1)
+			active[activeCount++] = lag->members[i];
+	}
+
+	// Shrink count before members move, so readers see only valid members
+	if (activeCount < lag->activeCount)
+		__atomic_store_n(&lag->activeCount, activeCount, __ATOMIC_RELEASE);
+	memcpy(lag->active, active, sizeof(struct switch_if *) * activeCount);
+	__atomic_store_n(&lag->activeCount, activeCount, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&lag->mutex);
+
+	debug_print("LAG %u: %u of %u members active\n", lag->id, activeCount, lag->membersCount);
+}
+
+unsigned int lagHashBytes(unsigned int hash, const u_char * data, const unsigned int length) {
+
+	// FNV-1a
+	for (int i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+/**
+ * L2/L3/L4 hash of frame, frames of one flow always hash the same.
+ */
+unsigned int getLagFrameHash(const u_char * frame, const unsigned int length) {
+
+	unsigned int hash = 2166136261U;
+	unsigned int headerLength;
+	unsigned int protocol = 0;
+	const u_char * packet;
+	unsigned int l4Offset = 0;
+
+	if (frame == NULL || length < ETHER_HDR_LEN)
+		return 0;
+
+	// L2, MAC addresses
+	hash = lagHashBytes(hash, frame, 2 * ETHER_ADDR_LEN);
+
+	// L3, IP addresses
+	packet = frame;
+	switch (getFrameEtherType(frame, length, &headerLength)) {
+		case ETHERTYPE_IP:
+			packet += headerLength;
+			if (length < headerLength + 20)
+				break;
+			hash = lagHashBytes(hash, packet + 12, 8);
+			// Fragments carry no L4 header
+			if ((((packet[6] & 0x1f) << 8) | packet[7]) == 0 && (packet[6] & 0x20) == 0) {
+				protocol = packet[9];
+				l4Offset = headerLength + (packet[0] & 0x0f) * 4;
+			}
+			break;
+		case ETHERTYPE_IPV6:
+			packet += headerLength;
+			if (length < headerLength + 40)
+				break;
+			hash = lagHashBytes(hash, packet + 8, 32);
+			protocol = packet[6];
+			l4Offset = headerLength + 40;
+			break;
+		default:
+			break;
+	}
+
+	// L4, TCP / UDP ports
+	if ((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) && length >= l4Offset + 4)
+		hash = lagHashBytes(hash, frame + l4Offset, 4);
+
+	// Final avalanche
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+
+	return hash;
+}
+
+int readSwitchIfCarrier(struct switch_if * iface) {
+
+	char path[256];
+	FILE * file;
+	int carrier = 1;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/carrier", iface->name);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return 1; // Unknown, take as up
+
+	if (fscanf(file, "%d", &carrier) != 1)
+		carrier = 1;
+	fclose(file);
+
+	return carrier > 0 ? 1 : 0;
+}
+
+/**
+ * Polls link state of LAG members, called from maintain thread.
+ */
+void maintainSwitchLags(struct switch_dev * dev) {
+
+	if (dev == NULL)
+		return;
+
+	for (struct switch_lag * lag = dev->lags; lag != NULL; lag = lag->next) {
+		int changed = 0;
+		for (int i = 0; i < lag->membersCount; i++) {
+			struct switch_if * member = lag->members[i];
+			int linkUp = readSwitchIfCarrier(member);
+			if (member->linkUp != linkUp) {
+				debug_print("Interface %s link %s\n", member->name, linkUp ? "up" : "down");
+				member->linkUp = linkUp;
+				changed = 1;
+			}
+		}
+		if (changed)
+			updateSwitchLagActive(lag);
+	}
+}
+
+void printSwitchLags(struct switch_dev * dev) {
+
+	user_print("\nLAG\tMembers (* active)%s","\n");
+	for (struct switch_lag * lag = dev->lags; lag != NULL; lag = lag->next) {
+		if (lag->membersCount == 0)
+			continue;
+		user_print("%u\t", lag->id);
+		for (int i = 0; i < lag->membersCount; i++) {
+			int active = 0;
+			for (int j = 0; j < lag->activeCount; j++) {
+				if (lag->active[j] == lag->members[i])
+					active = 1;
+			}
+			user_print(" %s%s", lag->members[i]->name, active ? "*" : "");
+		}
+		user_print("%s\n", "");
+	}
+	user_print("%s\n", "");
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     lag.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Static link aggregation implementation
+ */
+
+#ifndef _LAG_
+#define _LAG_
+
+#include <pcap.h>
+#include <pthread.h>
+
+#define LAG_MAX_MEMBERS 8
+
+struct switch_if;
+struct switch_dev;
+
+struct switch_lag { // Link aggregation group
+	unsigned int id;
+	struct switch_if * members[LAG_MAX_MEMBERS];
+	unsigned int membersCount;
+	struct switch_if * active[LAG_MAX_MEMBERS]; // Opened members with link up
+	unsigned int activeCount;
+	pthread_mutex_t mutex;
+	struct switch_lag * next;
+};
+
+int addSwitchLagMember(struct switch_dev * dev, const unsigned int id, struct switch_if * iface);
+int removeSwitchLagMember(struct switch_dev * dev, struct switch_if * iface);
+void destroySwitchLags(struct switch_dev * dev);
+struct switch_if * getSwitchLagPort(struct switch_if * iface);
+struct switch_if * selectSwitchLagMember(struct switch_if * port, const unsigned int hash);
+unsigned int getLagFrameHash(const u_char * frame, const unsigned int length);
+void updateSwitchLagActive(struct switch_lag * lag);
+void maintainSwitchLags(struct switch_dev * dev);
+void printSwitchLags(struct switch_dev * dev);
+
+#endif
+
@@ -0,0 +1,178 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     machash.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * MAC address hashing
+ */
+
+#include "machash.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <nmmintrin.h>
+	#define MACHASH_CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	#include <arm_acle.h>
+	#define MACHASH_CRC32C_ARM 1
+#endif
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+uint64_t macHashSeed[2]; // Per process random key
+unsigned int (*macHashFunction)(const uint64_t key);
+const char * macHashName;
+
+/********************************************************************/
+
+int initMACHash(enum e_macHash type);
+unsigned int getMACHash(const uint64_t key);
+const char * getMACHashName();
+void seedMACHash();
+int hasCRC32C();
+unsigned int crc32cMACHash(const uint64_t key);
+unsigned int sipMACHash(const uint64_t key);
+
+/*******************************************************************/
+
+/**
+ * Seed makes bucket layout differ between runs. CRC32C is linear, two
+ * keys colliding under one seed collide under any, so crafted addresses
+ * would collide whatever the seed. Keyed SipHash is the default, CRC32C
+ * is faster but has to be asked for, on trusted segments only.
+ */
+int initMACHash(enum e_macHash type) {
+
+	seedMACHash();
+
+	if (type == E_MACHASH_AUTO)
+		type = E_MACHASH_SIPHASH;
+
+	if (type == E_MACHASH_CRC32C && hasCRC32C() == 0) {
+		error_print("%s\n", "CPU has no CRC32C instruction");
+		return 0;
+	}
+
+	if (type == E_MACHASH_CRC32C) {
+		macHashFunction = crc32cMACHash;
+		macHashName = "CRC32C";
+	} else {
+		macHashFunction = sipMACHash;
+		macHashName = "SipHash-1-3";
+	}
+
+	return 1;
+}
+
+unsigned int getMACHash(const uint64_t key) {
+	return macHashFunction(key);
+}
+
+const char * getMACHashName() {
+	return macHashName;
+}
+
+void seedMACHash() {
+
+	FILE * random = fopen("/dev/urandom", "r");
+
+	if (random == NULL || fread(macHashSeed, sizeof(macHashSeed), 1, random) != 1) {
+		// Weak, but still differs per process
+		macHashSeed[0] = (uint64_t) time(NULL) * 0x9e3779b97f4a7c15ULL;
+		macHashSeed[1] = (uint64_t) getpid() * 0xc2b2ae3d27d4eb4fULL ^ (uint64_t) clock();
+	}
+
+	if (random != NULL)
+		fclose(random);
+}
+
+int hasCRC32C() {
+#if defined(MACHASH_CRC32C_X86)
+	return __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#elif defined(MACHASH_CRC32C_ARM)
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+#if defined(MACHASH_CRC32C_X86)
+__attribute__((target("sse4.2")))
+unsigned int crc32cMACHash(const uint64_t key) {
+#if defined(__x86_64__)
+	return (unsigned int) _mm_crc32_u64(macHashSeed[0], key ^ macHashSeed[1]);
+#else
+	return _mm_crc32_u32(_mm_crc32_u32((unsigned int) macHashSeed[0], (unsigned int) (key ^ macHashSeed[1])),
+						(unsigned int) ((key ^ macHashSeed[1]) >> 32));
+#endif
+}
+#elif defined(MACHASH_CRC32C_ARM)
+unsigned int crc32cMACHash(const uint64_t key) {
+	return __crc32cd((uint32_t) macHashSeed[0], key ^ macHashSeed[1]);
+}
+#else
+unsigned int crc32cMACHash(const uint64_t key) {
+	return sipMACHash(key); // Never selected
+}
+#endif
+
+/**
+ * SipHash-1-3 of one 8 byte block, keyed by process seed.
+ */
+unsigned int sipMACHash(const uint64_t key) {
+
+	uint64_t v0 = macHashSeed[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = macHashSeed[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = macHashSeed[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = macHashSeed[1] ^ 0x7465646279746573ULL;
+	uint64_t last = (uint64_t) 8 << 56; // Message length
+
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+	v3 ^= key;
+	SIPROUND;
+	v0 ^= key;
+
+	v3 ^= last;
+	SIPROUND;
+	v0 ^= last;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+#undef SIPROUND
+
+	return (unsigned int) (v0 ^ v1 ^ v2 ^ v3);
+}
+
@@ -0,0 +1,41 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     machash.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * MAC address hashing
+ */
+
+#ifndef _MACHASH_
+#define _MACHASH_
+
+#include <stdint.h>
+
+enum e_macHash {E_MACHASH_AUTO = 0, // SipHash, CRC32C only on request
+				E_MACHASH_CRC32C,
+				E_MACHASH_SIPHASH};
+
+int initMACHash(enum e_macHash type);
+unsigned int getMACHash(const uint64_t key);
+const char * getMACHashName();
+
+#endif
+
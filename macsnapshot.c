@@ -0,0 +1,230 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     macsnapshot.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * MAC table snapshots for warm restart
+ */
+
+#include "macsnapshot.h"
+#include "mactable.h"
+#include "switchclock.h"
+#include "switchcore.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/********************************************************************/
+
+int saveMACSnapshot(struct switch_dev * device, const char * fileName);
+int loadMACSnapshot(struct switch_dev * device, const char * fileName);
+int writeMACSnapshot(FILE * file, struct switch_dev * device, struct switch_mactable_slot * slots, const unsigned int count);
+
+/*******************************************************************/
+
+int writeMACSnapshot(FILE * file, struct switch_dev * device, struct switch_mactable_slot * slots, const unsigned int count) {
+
+	struct switch_macsnapshot_header header;
+	char portName[MACSNAPSHOT_IFNAME];
+	uint32_t currTime = getSwitchClockSeconds();
+	unsigned int ports = 0;
+
+	// Port names by index, gaps stay empty
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		if (iface->index < SWITCH_MAX_IFS && iface->index + 1 > ports)
+			ports = iface->index + 1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MACSNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = MACSNAPSHOT_VERSION;
+	header.ports = ports;
+	header.entries = count;
+	header.timeOutLimit = device->config.macTableTimeout;
+	header.savedAt = (uint64_t) time(NULL);
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		return 0;
+
+	for (unsigned int i = 0; i < ports; i++) {
+		memset(portName, 0, sizeof(portName));
+		for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+			if (iface->index == i)
+				strncpy(portName, iface->name, sizeof(portName) - 1);
+		}
+		if (fwrite(portName, sizeof(portName), 1, file) != 1)
+			return 0;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		struct switch_macsnapshot_entry entry;
+		memset(&entry, 0, sizeof(entry));
+		memcpy(entry.macAddress, slots[i].macAddress, ETHER_ADDR_LEN);
+		entry.vlan = slots[i].vlan;
+		entry.age = currTime - slots[i].lastSeen;
+		entry.port = slots[i].port;
+		entry.flags = slots[i].flags;
+		if (fwrite(&entry, sizeof(entry), 1, file) != 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Written to temporary file renamed over the old one, so crash while saving
+ * never leaves truncated snapshot behind.
+ */
+int saveMACSnapshot(struct switch_dev * device, const char * fileName) {
+
+	struct switch_mactable_slot * slots;
+	unsigned int count;
+	char * tmpName;
+	FILE * file;
+	int ok;
+
+	if (device == NULL || device->mac_table == NULL || fileName == NULL)
+		return 0;
+
+	// Some room for entries learned meanwhile
+	count = getMACTableCount(device->mac_table) + 64;
+	slots = (struct switch_mactable_slot *) malloc(sizeof(struct switch_mactable_slot) * count);
+	tmpName = (char *) malloc(strlen(fileName) + 5);
+	if (slots == NULL || tmpName == NULL) {
+		debug_print("%s\n", "Unable to alloc MAC snapshot");
+		free((void *) slots);
+		free((void *) tmpName);
+		return 0;
+	}
+	count = getMACTableEntries(device->mac_table, slots, count);
+
+	sprintf(tmpName, "%s.tmp", fileName);
+	file = fopen(tmpName, "wb");
+	if (file == NULL) {
+		error_print("Unable to open MAC snapshot %s\n", tmpName);
+		free((void *) slots);
+		free((void *) tmpName);
+		return 0;
+	}
+
+	ok = writeMACSnapshot(file, device, slots, count);
+	ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+	ok = fclose(file) == 0 && ok;
+	if (ok == 1 && rename(tmpName, fileName) != 0)
+		ok = 0;
+	if (ok == 0) {
+		error_print("Unable to write MAC snapshot %s\n", fileName);
+		unlink(tmpName);
+	} else {
+		debug_print("MAC snapshot saved, %u entries\n", count);
+	}
+
+	free((void *) slots);
+	free((void *) tmpName);
+
+	return ok;
+}
+
+/**
+ * Snapshot is mapped read only, entries go straight from the mapping into
+ * table. Ports are matched by name, so entries of ports gone or renumbered
+ * since are skipped or moved. Dynamic entries age by time the switch was down.
+ */
+int loadMACSnapshot(struct switch_dev * device, const char * fileName) {
+
+	struct switch_macsnapshot_header * header;
+	struct switch_macsnapshot_entry * entries;
+	struct switch_if * ports[SWITCH_MAX_IFS];
+	struct stat fileStat;
+	unsigned int loaded = 0;
+	uint64_t downTime = 0;
+	char * names;
+	void * data;
+	int fd;
+
+	if (device == NULL || device->mac_table == NULL || fileName == NULL)
+		return 0;
+
+	fd = open(fileName, O_RDONLY);
+	if (fd < 0) {
+		debug_print("No MAC snapshot %s\n", fileName);
+		return 0;
+	}
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t) sizeof(struct switch_macsnapshot_header)) {
+		error_print("Invalid MAC snapshot %s\n", fileName);
+		close(fd);
+		return 0;
+	}
+	data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		error_print("Unable to map MAC snapshot %s\n", fileName);
+		return 0;
+	}
+
+	header = (struct switch_macsnapshot_header *) data;
+	if (memcmp(header->magic, MACSNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+					|| header->version != MACSNAPSHOT_VERSION
+					|| header->ports > SWITCH_MAX_IFS
+					|| (uint64_t) fileStat.st_size != sizeof(struct switch_macsnapshot_header)
+						+ (uint64_t) header->ports * MACSNAPSHOT_IFNAME
+						+ (uint64_t) header->entries * sizeof(struct switch_macsnapshot_entry)) {
+		error_print("Invalid MAC snapshot %s\n", fileName);
+		munmap(data, fileStat.st_size);
+		return 0;
+	}
+
+	// Re-resolve port names
+	names = (char *) data + sizeof(struct switch_macsnapshot_header);
+	for (unsigned int i = 0; i < header->ports; i++) {
+		char name[MACSNAPSHOT_IFNAME];
+		memcpy(name, names + i * MACSNAPSHOT_IFNAME, MACSNAPSHOT_IFNAME);
+		name[MACSNAPSHOT_IFNAME - 1] = '\0';
+		ports[i] = name[0] == '\0' ? NULL : getSwitchIfByName(device, name);
+	}
+
+	if ((uint64_t) time(NULL) > header->savedAt)
+		downTime = (uint64_t) time(NULL) - header->savedAt;
+
+	entries = (struct switch_macsnapshot_entry *) (names + header->ports * MACSNAPSHOT_IFNAME);
+	for (unsigned int i = 0; i < header->entries; i++) {
+		struct switch_macsnapshot_entry * entry = entries + i;
+		uint64_t age = entry->age + downTime;
+		if (entry->port >= header->ports || ports[entry->port] == NULL)
+			continue;
+		if ((entry->flags & MACTABLE_FLAG_STATIC) != 0)
+			loaded += addMACTableStatic(device->mac_table, entry->macAddress, entry->vlan, ports[entry->port]);
+		else if (age <= device->config.macTableTimeout)
+			loaded += restoreMACTableRecord(device->mac_table, entry->macAddress, entry->vlan, ports[entry->port], (uint32_t) age);
+	}
+
+	user_print("MAC snapshot loaded, %u of %u entries\n", loaded, header->entries);
+	munmap(data, fileStat.st_size);
+
+	return 1;
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     macsnapshot.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * MAC table snapshots for warm restart
+ */
+
+#ifndef _MACSNAPSHOT_
+#define _MACSNAPSHOT_
+
+#include "switchcore.h"
+
+#include <stdint.h>
+#include <net/ethernet.h>
+
+#define MACSNAPSHOT_MAGIC "SWMACTBL"
+#define MACSNAPSHOT_VERSION 1
+#define MACSNAPSHOT_IFNAME 16 // Port name, with terminating zero
+#define MACSNAPSHOT_INTERVAL 60 // Default seconds between snapshots
+
+struct switch_macsnapshot_header { // File header, 32 B, host byte order
+	char magic[8];
+	uint32_t version;
+	uint32_t ports; // Port names following header
+	uint32_t entries; // Entries following port names
+	uint32_t timeOutLimit; // Aging when saved
+	uint64_t savedAt; // Wall clock seconds
+};
+
+struct switch_macsnapshot_entry { // Snapshot entry, 16 B
+	u_char macAddress[ETHER_ADDR_LEN];
+	uint16_t vlan;
+	uint32_t age; // Seconds since last seen when saved
+	uint8_t port; // Index to port names
+	uint8_t flags; // MACTABLE_FLAG_*
+	uint8_t reserved[2];
+};
+
+int saveMACSnapshot(struct switch_dev * device, const char * fileName);
+int loadMACSnapshot(struct switch_dev * device, const char * fileName);
+
+#endif
+
@@ -25,54 +25,125 @@
  */
 
 #include "mactable.h"
+#include "machash.h"
+#include "switchclock.h"
+#include "switchtrace.h"
 #include "switchcore.h"
 #include "utils.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <pthread.h>
-#include <time.h>
 #include <net/ethernet.h>
 
 /********************************************************************/
 
-struct switch_mactable * initMACTable(const unsigned int timeOutLimit);
+struct switch_mactable * initMACTable(const unsigned int timeOutLimit, const unsigned int capacity);
 void destroyMACTable(struct switch_mactable * table);
-struct switch_if * getMACTableRecord(struct switch_mactable * table, void * macAddress);
-int insertMACTableRecord(struct switch_mactable * table, void * macAddress, struct switch_if * iface);
-void deleteMACTableRecord(struct switch_mactable * table, void * macAddress);
+struct switch_if * getMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan);
+void getMACTableRecords(struct switch_mactable * table, const uint64_t * keys, struct switch_mactable_result * results, const unsigned int count);
+void lookupMACTableBurst(struct switch_mactable * table, const uint64_t * keys, const unsigned int * hashes, struct switch_mactable_result * results, const unsigned int count);
+int insertMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface);
+void learnMACTableRecords(struct switch_mactable * table, struct switch_mactable_learn * learns, const unsigned int count);
+int learnMACTableRecord(struct switch_mactable * table, const uint64_t key, struct switch_if * iface);
+unsigned int getMACTableRefresh(struct switch_mactable * table);
+void deleteMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan);
+int addMACTableStatic(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface);
+int restoreMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface, const uint32_t age);
+unsigned int getMACTableCount(struct switch_mactable * table);
+unsigned int getMACTableEntries(struct switch_mactable * table, struct switch_mactable_slot * entries, const unsigned int max);
+unsigned int copyMACTableArray(struct switch_mactable_array * array, struct switch_mactable_slot * entries, unsigned int count, const unsigned int max);
+void flushMACTablePort(struct switch_mactable * table, struct switch_if * iface);
 void maintainMACTable(struct switch_mactable * table);
-struct switch_mactable_item * initMACTableItem(void * macAddress, struct switch_if * iface);
-unsigned int MACTableHashFunction(void * macAddress);
-int MACAddressEqual(void * addr1, void * addr2);
-void deleteMACTableItem(struct switch_mactable_item * item);
-void printMACTable(struct switch_mactable * table);
+void setMACTableTimeout(struct switch_mactable * table, const unsigned int timeOutLimit);
+void setMACTableLimit(struct switch_mactable * table, const unsigned int maxEntries);
+void setMACTablePortLimit(struct switch_mactable * table, struct switch_if * iface, const unsigned int limit);
+void setMACTableLimitAction(struct switch_mactable * table, enum e_macLimitAction action);
+struct switch_mactable_reader * registerMACTableReader(struct switch_mactable * table);
+void unregisterMACTableReader(struct switch_mactable * table, struct switch_mactable_reader * reader);
+void quiesceMACTableReader(struct switch_mactable * table, struct switch_mactable_reader * reader);
+unsigned long getMACTableGeneration(struct switch_mactable * table);
+void bumpMACTableGeneration(struct switch_mactable * table);
+void beginMACTableWrite(struct switch_mactable * table);
+void endMACTableWrite(struct switch_mactable * table);
+uint64_t getMACTableSlotKey(const struct switch_mactable_slot * slot);
+uint64_t getMACTableLookupKey(void * macAddress, const unsigned int vlan);
+unsigned int MACTableSlotHash(const uint64_t key);
+struct switch_mactable_array * initMACTableArray(const unsigned int capacity);
+void destroyMACTableArray(struct switch_mactable_array * array);
+void retireMACTableArray(struct switch_mactable * table, struct switch_mactable_array * array);
+void reclaimMACTableArrays(struct switch_mactable * table);
+int findMACTableSlot(struct switch_mactable_array * array, const uint64_t key);
+int findMACTableSlotHash(struct switch_mactable_array * array, const uint64_t key, const unsigned int hash);
+int canPlaceMACTableSlot(struct switch_mactable_array * array, const uint64_t key);
+int placeMACTableSlot(struct switch_mactable_array * array, struct switch_mactable_slot * entry);
+void removeMACTableSlot(struct switch_mactable_array * array, unsigned int index);
+void deleteMACTableSlot(struct switch_mactable * table, struct switch_mactable_array * array, unsigned int index);
+int addMACTableSlot(struct switch_mactable * table, struct switch_mactable_slot * entry);
+int findMACTableEntry(struct switch_mactable * table, const uint64_t key, struct switch_mactable_array ** array);
+int lookupMACTablePort(struct switch_mactable * table, const uint64_t key);
+int removeMACTablePort(struct switch_mactable * table, struct switch_mactable_array * array, const unsigned int port);
+int scheduleMACTableTimer(struct switch_mactable * table, const uint64_t key, const unsigned int tag, uint32_t expiry);
+int expireMACTableTimer(struct switch_mactable * table, struct switch_mactable_timer * timer, const uint32_t currTime);
+void rescheduleMACTableArray(struct switch_mactable * table, struct switch_mactable_array * array);
+void removeMACTableTimer(struct switch_mactable * table, struct switch_mactable_bucket * bucket, const unsigned int index);
+int evictMACTableEntry(struct switch_mactable * table, const int port);
+int checkMACTableLimit(struct switch_mactable * table, const unsigned int port);
+void startMACTableResize(struct switch_mactable * table, const unsigned int capacity);
+void migrateMACTable(struct switch_mactable * table, unsigned int steps);
+void checkMACTableResize(struct switch_mactable * table);
+void growMACTable(struct switch_mactable * table);
+void setMACTableKey(struct switch_mactable_key * key, void * macAddress, const unsigned int vlan);
+unsigned int MACTableHashFunction(void * key);
+int MACTableKeyEqual(void * key1, void * key2);
+void initMACTableCursor(struct switch_mactable_cursor * cursor, const struct switch_mactable_filter * filter);
+int matchMACTableFilter(const struct switch_mactable_filter * filter, const struct switch_mactable_slot * slot, const uint32_t currentTime);
+unsigned int getMACTableCursorEntries(struct switch_mactable * table, struct switch_mactable_cursor * cursor, struct switch_mactable_slot * entries, const unsigned int max);
+int getMACTableChunkEntries(struct switch_mactable_array * array, struct switch_mactable_cursor * cursor, struct switch_mactable_slot * entries, unsigned int * count, const unsigned int max, const uint32_t currentTime);
+void printMACTableEntry(struct switch_mactable * table, const struct switch_mactable_slot * slot, const uint32_t currentTime);
+void addMACTableHistogram(struct switch_mactable_array * array, unsigned long * histogram, unsigned int * maxDistance);
+void printMACTableStats(struct switch_mactable * table);
+int getMACTableLimitAction(const char * name, enum e_macLimitAction * action);
+const char * getMACTableLimitActionName(enum e_macLimitAction action);
+void printMACTableLimits(struct switch_mactable * table, struct switch_if * ifs);
 
 /*******************************************************************/
 
-struct switch_mactable * initMACTable(const unsigned int timeOutLimit) {
+struct switch_mactable * initMACTable(const unsigned int timeOutLimit, const unsigned int capacity) {
 
 	debug_print("%s\n", "START");
 
-	struct switch_mactable * table = (struct switch_mactable *) malloc(sizeof(struct switch_mactable));
-	if (table == NULL) {
+	// Readers are kept on own cache lines
+	struct switch_mactable * table = NULL;
+	if (posix_memalign((void **) &table, 64, sizeof(struct switch_mactable)) != 0) {
 		debug_print("%s\n", "Error initializing MAC Table");
 		return NULL;
 	}
 
+	memset(table, 0, sizeof(struct switch_mactable));
+
 	// Mutex
  	if (pthread_mutex_init(&table->mutex, NULL) != 0) {
 		debug_print("%s\n", "Error initializing mutex");
-		destroyMACTable(table);
+		free((void *) table);
 		return NULL;
 	}
 
 	table->timeOutLimit = timeOutLimit;
+	table->generation = 0;
+	table->wheelTime = getSwitchClockSeconds();
+
+	// Capacity is rounded up to power of 2
+	table->minCapacity = MACTABLE_MIN_CAPACITY;
+	while (table->minCapacity < capacity && table->minCapacity < (1U << 31))
+		table->minCapacity <<= 1;
 
-	// Init hashmap
-	table->map = hashMapInit(MACTABLE_HASHMAP_SIZE, MACTableHashFunction, MACAddressEqual);
-	if (table->map == NULL) {
-		debug_print("%s\n", "Error initializing hashmap");
+	table->current = initMACTableArray(table->minCapacity);
+	if (table->current == NULL) {
+		debug_print("%s\n", "Error initializing slots");
 		destroyMACTable(table);
+		return NULL;
 	}
 
 	debug_print("%s\n", "END");
@@ -80,6 +151,9 @@ struct switch_mactable * initMACTable(const unsigned int timeOutLimit) {
 }
 
 
+/**
+ * Readers have to be stopped already.
+ */
 void destroyMACTable(struct switch_mactable * table) {
 	
 	debug_print("%s\n", "START");
@@ -92,243 +166,1429 @@ void destroyMACTable(struct switch_mactable * table) {
 	// Mutex
 	pthread_mutex_destroy(&table->mutex);
 
-	// Destroy HashMap
-	hashMapDestroy(table->map);
-	table = NULL;
+	destroyMACTableArray(table->current);
+	destroyMACTableArray(table->old);
+	while (table->retired != NULL) {
+		struct switch_mactable_array * array = table->retired;
+		table->retired = array->nextRetired;
+		destroyMACTableArray(array);
+	}
+	for (int i = 0; i < MACTABLE_WHEEL_SIZE; i++)
+		free((void *) table->wheel[i].timers);
+	free((void *) table);
 
 	debug_print("%s\n", "END");
 }
 
+/**
+ * Slots are cache line aligned, so four slots share one line.
+ */
+struct switch_mactable_array * initMACTableArray(const unsigned int capacity) {
+
+	struct switch_mactable_array * array = (struct switch_mactable_array *) malloc(sizeof(struct switch_mactable_array));
+	if (array == NULL)
+		return NULL;
 
-struct switch_if * getMACTableRecord(struct switch_mactable * table, void * macAddress) {
+	if (posix_memalign((void **) &array->slots, 64, sizeof(struct switch_mactable_slot) * capacity) != 0) {
+		free((void *) array);
+		return NULL;
+	}
+	memset(array->slots, 0, sizeof(struct switch_mactable_slot) * capacity);
 
-	struct switch_mactable_item * value = NULL;
+	array->capacity = capacity;
+	array->mask = capacity - 1;
+	array->count = 0;
+	array->retiredEpoch = 0;
+	array->nextRetired = NULL;
 
-	if (table == NULL || macAddress == NULL) 
+	return array;
+}
+
+void destroyMACTableArray(struct switch_mactable_array * array) {
+
+	if (array == NULL)
+		return;
+
+	free((void *) array->slots);
+	free((void *) array);
+}
+
+/**
+ * Array is no longer reachable from table, but lock-free readers may still
+ * probe it. It is freed once each online reader went through quiescent state.
+ */
+void retireMACTableArray(struct switch_mactable * table, struct switch_mactable_array * array) {
+
+	array->retiredEpoch = __atomic_add_fetch(&table->epoch, 1, __ATOMIC_SEQ_CST);
+	array->nextRetired = table->retired;
+	table->retired = array;
+
+	reclaimMACTableArrays(table);
+}
+
+void reclaimMACTableArrays(struct switch_mactable * table) {
+
+	struct switch_mactable_array ** array;
+	unsigned long oldest = __atomic_load_n(&table->epoch, __ATOMIC_ACQUIRE);
+
+	for (int i = 0; i < MACTABLE_MAX_READERS; i++) {
+		struct switch_mactable_reader * reader = table->readers + i;
+		if (__atomic_load_n(&reader->online, __ATOMIC_ACQUIRE) == 0)
+			continue;
+		unsigned long epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+		if (epoch < oldest)
+			oldest = epoch;
+	}
+
+	array = &table->retired;
+	while (*array != NULL) {
+		if ((*array)->retiredEpoch <= oldest) {
+			struct switch_mactable_array * reclaimed = *array;
+			*array = reclaimed->nextRetired;
+			destroyMACTableArray(reclaimed);
+		} else {
+			array = &(*array)->nextRetired;
+		}
+	}
+}
+
+struct switch_mactable_reader * registerMACTableReader(struct switch_mactable * table) {
+
+	struct switch_mactable_reader * reader = NULL;
+
+	if (table == NULL)
 		return NULL;
 
+	pthread_mutex_lock(&table->mutex);
+	for (int i = 0; i < MACTABLE_MAX_READERS; i++) {
+		if (table->readers[i].online == 0) {
+			reader = table->readers + i;
+			__atomic_store_n(&reader->epoch, __atomic_load_n(&table->epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+			__atomic_store_n(&reader->online, 1, __ATOMIC_SEQ_CST);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&table->mutex);
+
+	if (reader == NULL)
+		debug_print("%s\n", "Too many MAC Table readers");
+
+	return reader;
+}
+
+void unregisterMACTableReader(struct switch_mactable * table, struct switch_mactable_reader * reader) {
+
+	if (table == NULL || reader == NULL)
+		return;
 
 	pthread_mutex_lock(&table->mutex);
-	value = (struct switch_mactable_item *) hashMapGetValue(table->map, macAddress);
+	__atomic_store_n(&reader->online, 0, __ATOMIC_RELEASE);
+	reclaimMACTableArrays(table);
 	pthread_mutex_unlock(&table->mutex);
-	
-	/* If time_added < 0, record is marked to removal */
-	if (value != NULL && value->time_added < 0)
-		value = NULL;
+}
+
+/**
+ * Called by reader between lookups, it holds no slot array from now on.
+ */
+void quiesceMACTableReader(struct switch_mactable * table, struct switch_mactable_reader * reader) {
+
+	if (reader == NULL)
+		return;
+
+	__atomic_store_n(&reader->epoch, __atomic_load_n(&table->epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+/**
+ * Sequence is odd while entries move between slots, lookups overlapping it
+ * are repeated. Plain refresh of lastSeen does not need it.
+ */
+void beginMACTableWrite(struct switch_mactable * table) {
+
+	__atomic_store_n(&table->sequence, table->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void endMACTableWrite(struct switch_mactable * table) {
 
-	return (value == NULL) ? NULL : value->if_handler;
+	__atomic_store_n(&table->sequence, table->sequence + 1, __ATOMIC_RELEASE);
 }
 
-int insertMACTableRecord(struct switch_mactable * table, void * macAddress, struct switch_if * iface) {
+uint64_t getMACTableSlotKey(const struct switch_mactable_slot * slot) {
 
-	struct switch_mactable_item * item;
+	uint64_t key;
 
-	//debug_print("%s\n","START");
+	memcpy(&key, slot, sizeof(key));
+	return key;
+}
+
+/**
+ * Same byte layout as key of slot, so keys compare as one integer.
+ */
+uint64_t getMACTableLookupKey(void * macAddress, const unsigned int vlan) {
+
+	struct switch_mactable_slot slot;
+
+	memcpy(slot.macAddress, macAddress, ETHER_ADDR_LEN);
+	slot.vlan = vlan;
+
+	return getMACTableSlotKey(&slot);
+}
 
-	if (table == NULL || macAddress == NULL || iface == NULL) 
+unsigned int MACTableSlotHash(const uint64_t key) {
+	return getMACHash(key);
+}
+
+/**
+ * Returns slot index of key, -1 if not present. Probing stops at first slot
+ * closer to its home than the key would be, Robin Hood keeps it there.
+ */
+int findMACTableSlot(struct switch_mactable_array * array, const uint64_t key) {
+
+	if (array == NULL)
 		return -1;
 
-	pthread_mutex_lock(&table->mutex);
-	item = (struct switch_mactable_item *) hashMapGetValue(table->map, macAddress);
-	if (item != NULL) {
-		/* If already exists, update addedDate tu actual date */
-		item->time_added = time(NULL);
-		pthread_mutex_unlock(&table->mutex);
-		//debug_print("%s\n", "Item already present - updating");
-		return 1;
-	} else {
-		/* Add new macTable item */
-		item = initMACTableItem(macAddress, iface);
-		if (item == NULL) {
-			debug_print("%s\n", "Error inserting new MAC Table item");
-			pthread_mutex_unlock(&table->mutex);
+	return findMACTableSlotHash(array, key, MACTableSlotHash(key));
+}
+
+/**
+ * Same as findMACTableSlot, with hash of key computed by caller.
+ */
+int findMACTableSlotHash(struct switch_mactable_array * array, const uint64_t key, const unsigned int hash) {
+
+	unsigned int index;
+
+	if (array == NULL)
+		return -1;
+
+	index = hash & array->mask;
+	for (unsigned int distance = 1; distance <= MACTABLE_MAX_DISTANCE; distance++) {
+		struct switch_mactable_slot * slot = array->slots + index;
+		if (slot->distance < distance)
 			return -1;
+		if (getMACTableSlotKey(slot) == key)
+			return index;
+		index = (index + 1) & array->mask;
+	}
+
+	return -1;
+}
+
+/**
+ * Probes like placeMACTableSlot, but writes nothing. Returns 0 if new or
+ * some displaced entry would overflow probe distance.
+ */
+int canPlaceMACTableSlot(struct switch_mactable_array * array, const uint64_t key) {
+
+	unsigned int index = MACTableSlotHash(key) & array->mask;
+	unsigned int distance = 1;
+
+	while (1) {
+		struct switch_mactable_slot * slot = array->slots + index;
+		if (slot->distance == 0)
+			return 1;
+		if (slot->distance < distance)
+			distance = slot->distance; // Displaced entry carried on
+		if (distance == MACTABLE_MAX_DISTANCE)
+			return 0;
+		distance++;
+		index = (index + 1) & array->mask;
+	}
+}
+
+/**
+ * Robin Hood insert, entry takes slot of any richer (closer to home) one,
+ * which moves on. Returns 0 if probe distance would overflow, array is left
+ * untouched then.
+ */
+int placeMACTableSlot(struct switch_mactable_array * array, struct switch_mactable_slot * entry) {
+
+	struct switch_mactable_slot carried = *entry;
+	unsigned int index = MACTableSlotHash(getMACTableSlotKey(&carried)) & array->mask;
+
+	if (canPlaceMACTableSlot(array, getMACTableSlotKey(&carried)) == 0)
+		return 0;
+
+	carried.distance = 1;
+	while (1) {
+		struct switch_mactable_slot * slot = array->slots + index;
+		if (slot->distance == 0) {
+			*slot = carried;
+			array->count++;
+			return 1;
 		}
-		// Add to hashMap
-		if (hashMapInsertValue(table->map, macAddress, item) < 0) {
-			debug_print("%s\n", "Error inserting to HASHMAP");
-			pthread_mutex_unlock(&table->mutex);
-			return -1;
+		if (slot->distance < carried.distance) {
+			struct switch_mactable_slot swapped = *slot;
+			*slot = carried;
+			carried = swapped;
 		}
-
+		carried.distance++;
+		index = (index + 1) & array->mask;
 	}
+}
 
-	pthread_mutex_unlock(&table->mutex);
-	//debug_print("%s\n", "New item inserted");
+/**
+ * Backward shift deletion, following entries move one slot closer to home,
+ * no tombstones are needed.
+ */
+void removeMACTableSlot(struct switch_mactable_array * array, unsigned int index) {
 
-	//debug_print("%s\n","END");
+	unsigned int next = (index + 1) & array->mask;
 
-	return 1;
+	while (array->slots[next].distance > 1) {
+		array->slots[index] = array->slots[next];
+		array->slots[index].distance--;
+		index = next;
+		next = (next + 1) & array->mask;
+	}
 
+	memset(array->slots + index, 0, sizeof(struct switch_mactable_slot));
+	array->count--;
 }
 
-void deleteMACTableRecord(struct switch_mactable * table, void * macAddress) {
-	
-	struct switch_mactable_item * item;
+/**
+ * Removes entry from table, port keeps count of its dynamic entries.
+ */
+void deleteMACTableSlot(struct switch_mactable * table, struct switch_mactable_array * array, unsigned int index) {
 
-	debug_print("%s\n", "START");
+	if ((array->slots[index].flags & MACTABLE_FLAG_STATIC) == 0)
+		table->portLimits[array->slots[index].port].count--;
+	beginMACTableWrite(table);
+	removeMACTableSlot(array, index);
+	endMACTableWrite(table);
+}
 
-	if (table == NULL || macAddress == NULL) {
-		debug_print("%s\n", "Invalid params");
+/**
+ * Places new entry, dynamic one gets aging timer first. Returns 0 on error.
+ * Entry overflowing probe distance is rejected, existing entries are never
+ * pushed out for it.
+ */
+int addMACTableSlot(struct switch_mactable * table, struct switch_mactable_slot * entry) {
+
+	if (table->current->count >= MACTABLE_MAX_LOAD(table->current->capacity)) {
+		debug_print("%s\n", "MAC Table full");
+		return 0;
 	}
 
-	pthread_mutex_lock(&table->mutex);
-	item = (struct switch_mactable_item *) hashMapGetValue(table->map, macAddress);
+	if (canPlaceMACTableSlot(table->current, getMACTableSlotKey(entry)) == 0) {
+		debug_print("%s\n", "MAC Table probe distance overflow, entry rejected");
+		growMACTable(table);
+		return 0;
+	}
 
-	if (item != NULL) {
-		hashMapDeleteValue(table->map, macAddress);
-		deleteMACTableItem(item);
+	entry->tag = table->nextTag++;
+	if ((entry->flags & MACTABLE_FLAG_STATIC) == 0) {
+		if (scheduleMACTableTimer(table, getMACTableSlotKey(entry), entry->tag, entry->lastSeen + table->timeOutLimit + 1) == 0) {
+			debug_print("%s\n", "Unable to schedule MAC Table aging");
+			return 0;
+		}
+		table->portLimits[entry->port].count++;
+		table->portLimits[entry->port].learned++;
 	}
 
-	pthread_mutex_unlock(&table->mutex);
+	beginMACTableWrite(table);
+	placeMACTableSlot(table->current, entry);
+	endMACTableWrite(table);
 
-	debug_print("%s\n", "END");
+	return 1;
+}
+
+/**
+ * Returns slot index of entry and array it is in, -1 if not present. While
+ * resizing, entry is either in current or in not yet migrated old slots.
+ * Writers only.
+ */
+int findMACTableEntry(struct switch_mactable * table, const uint64_t key, struct switch_mactable_array ** array) {
+
+	int index;
+
+	*array = table->current;
+	index = findMACTableSlot(*array, key);
+	if (index < 0) {
+		*array = table->old;
+		index = findMACTableSlot(*array, key);
+	}
 
+	return index;
 }
 
-void maintainMACTable(struct switch_mactable * table) {
+/**
+ * Lock-free counterpart of findMACTableEntry, result is valid only if sequence
+ * did not change meanwhile.
+ */
+int lookupMACTablePort(struct switch_mactable * table, const uint64_t key) {
 
-	
-	struct hashMap_item_list * list;
-	time_t currTime = time(NULL);
+	struct switch_mactable_array * array;
+	struct switch_mactable_slot slot;
+	int index;
 
-	if (table == NULL) {
-		debug_print("%s\n", "Invalid params");
-		return;
+	array = __atomic_load_n(&table->current, __ATOMIC_ACQUIRE);
+	index = findMACTableSlot(array, key);
+	if (index < 0) {
+		array = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
+		index = findMACTableSlot(array, key);
 	}
+	if (index < 0)
+		return -1;
 
-	pthread_mutex_lock(&table->mutex);
-	list = hashMap2List(table->map);
+	memcpy(&slot, array->slots + index, sizeof(slot));
+	return slot.port;
+}
 
-	for (int i = 0; i < table->map->itemCount; i++) {
-		struct switch_mactable_item * item = (struct switch_mactable_item *) (list + i)->value;
-		if (item == NULL)
-			continue;
-		if (item->time_added < 0 || ((unsigned int) (currTime - item->time_added)) > table->timeOutLimit) {
-			// Erase old record
-			hashMapDeleteValue(table->map, (void *) item->macAddress);
-			deleteMACTableItem(item);
-		}
+/**
+ * Starts moving entries to slot array of new capacity. Entries are migrated
+ * a few slots per insert and by maintenance, so no lookup ever waits for
+ * whole table rehash.
+ */
+void startMACTableResize(struct switch_mactable * table, const unsigned int capacity) {
+
+	struct switch_mactable_array * resized = initMACTableArray(capacity);
+
+	if (resized == NULL) {
+		debug_print("Unable to resize MAC Table to %u slots\n", capacity);
+		return;
 	}
 
-	hashMapDestroyList(list);
-	pthread_mutex_unlock(&table->mutex);
+	if (capacity > table->current->capacity)
+		table->grows++;
+	else
+		table->shrinks++;
+	debug_print("Resizing MAC Table %u -> %u slots\n", table->current->capacity, capacity);
+
+	beginMACTableWrite(table);
+	__atomic_store_n(&table->old, table->current, __ATOMIC_RELEASE);
+	__atomic_store_n(&table->current, resized, __ATOMIC_RELEASE);
+	endMACTableWrite(table);
+	table->migrateCursor = 0;
 }
 
+/**
+ * Removal from old slots shifts next entry into the cursor slot, so it is
+ * migrated again before cursor moves on. Entries never shift behind cursor.
+ * Entry which does not fit into new slots stays in old ones, where it is
+ * still found, and migration waits for room.
+ */
+void migrateMACTable(struct switch_mactable * table, unsigned int steps) {
 
-struct switch_mactable_item * initMACTableItem(void * macAddress, struct switch_if * iface) {
+	struct switch_mactable_array * old = table->old;
 
-	struct switch_mactable_item * item = NULL;	
+	if (old == NULL)
+		return;
 
-	if (macAddress == NULL || iface == NULL) 
-		return NULL;
+	while (steps-- > 0 && old->count > 0 && table->migrateCursor < old->capacity) {
+		struct switch_mactable_slot * slot = old->slots + table->migrateCursor;
+		while (slot->distance != 0) {
+			struct switch_mactable_slot entry = *slot;
+			if (canPlaceMACTableSlot(table->current, getMACTableSlotKey(&entry)) == 0) {
+				debug_print("%s\n", "MAC Table probe distance overflow, migration paused");
+				return;
+			}
+			beginMACTableWrite(table);
+			removeMACTableSlot(old, table->migrateCursor);
+			placeMACTableSlot(table->current, &entry);
+			endMACTableWrite(table);
+		}
+		table->migrateCursor++;
+	}
 
-	item = (struct switch_mactable_item *) malloc(sizeof(struct switch_mactable_item));
-	if (item == NULL) {
-		debug_print("%s\n","Error initializing new MACTable item");
-		return NULL;
+	if (old->count == 0 || table->migrateCursor >= old->capacity) {
+		debug_print("MAC Table resized to %u slots\n", table->current->capacity);
+		__atomic_store_n(&table->old, NULL, __ATOMIC_RELEASE);
+		retireMACTableArray(table, old);
 	}
+}
 
-	// Set values
-	item->macAddress = malloc(sizeof(u_char) * 6);
-	if (item->macAddress == NULL) {
-		debug_print("%s\n", "Error initalizing MACAdrress field in MAC Table init");
-		free((void *) item);
-		return NULL;
+/**
+ * Grows at 3/4 and shrinks below 1/8 of current capacity. Resize running
+ * when next one is due is finished first.
+ */
+void checkMACTableResize(struct switch_mactable * table) {
+
+	unsigned int count = table->current->count + (table->old == NULL ? 0 : table->old->count);
+	unsigned int capacity = table->current->capacity;
+
+	if (count >= MACTABLE_GROW_LOAD(capacity) && capacity < (1U << 31)) {
+		if (table->old != NULL)
+			migrateMACTable(table, table->old->capacity);
+		if (table->old == NULL)
+			startMACTableResize(table, capacity << 1);
+	} else if (count < MACTABLE_SHRINK_LOAD(capacity) && capacity > table->minCapacity && table->old == NULL) {
+		startMACTableResize(table, capacity >> 1);
 	}
-	memcpy(item->macAddress, macAddress, sizeof(u_char) * ETHER_ADDR_LEN);
+}
+
+/**
+ * Called when entry overflows probe distance. Colliding keys collide at any
+ * capacity, so table grows only if it is reasonably loaded.
+ */
+void growMACTable(struct switch_mactable * table) {
 
-	item->if_handler = iface;
-	item->time_added = time(NULL);
+	unsigned int capacity = table->current->capacity;
 
-	return item;
+	if (table->current->count < MACTABLE_GROW_LOAD(capacity) / 2 || capacity >= (1U << 31))
+		return;
 
+	if (table->old != NULL)
+		migrateMACTable(table, table->old->capacity);
+	if (table->old == NULL)
+		startMACTableResize(table, capacity << 1);
 }
 
+/**
+ * Lock-free, calling thread has to be registered reader, which announces
+ * quiescent states (see quiesceMACTableReader).
+ */
+struct switch_if * getMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan) {
 
-unsigned int MACTableHashFunction(void * macAddress) {
-
-	u_char * addr = (u_char *) macAddress;
+	unsigned long sequence;
+	uint64_t key;
+	int port;
 
-	if (macAddress == NULL)
-		return 0;
+	if (table == NULL || macAddress == NULL) 
+		return NULL;
 
-	unsigned int hash = 0;
+	key = getMACTableLookupKey(macAddress, vlan);
 
-	for (int i = 0; i < ETHER_ADDR_LEN; i++) {
-		hash ^= (u_int) addr[i];
+	while (1) {
+		sequence = __atomic_load_n(&table->sequence, __ATOMIC_ACQUIRE);
+		if ((sequence & 1) == 0) {
+			port = lookupMACTablePort(table, key);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&table->sequence, __ATOMIC_RELAXED) == sequence)
+				break;
+		}
 	}
-	
-	return hash;
-}
 
+	return (port < 0 || port >= SWITCH_MAX_IFS) ? NULL : table->ports[port];
+}
 
-int MACAddressEqual(void * addr1, void * addr2) {
+/**
+ * Resolves keys of one burst. Home slots of all keys are prefetched first,
+ * so their cache misses overlap instead of being paid one after another.
+ */
+void lookupMACTableBurst(struct switch_mactable * table, const uint64_t * keys, const unsigned int * hashes, struct switch_mactable_result * results, const unsigned int count) {
 
-	u_char * ad1 = (u_char *) addr1;
-	u_char * ad2 = (u_char *) addr2;
+	struct switch_mactable_array * current = __atomic_load_n(&table->current, __ATOMIC_ACQUIRE);
+	struct switch_mactable_array * old = __atomic_load_n(&table->old, __ATOMIC_ACQUIRE);
 
-	if (addr1 == NULL || addr2 == NULL)
-		return 0;
+	for (unsigned int i = 0; i < count; i++)
+		__builtin_prefetch(current->slots + (hashes[i] & current->mask));
 
-	for (int i = 0; i < ETHER_ADDR_LEN; i++) {
-		if (ad1[i] != ad2[i])
-			return 0;
+	for (unsigned int i = 0; i < count; i++) {
+		struct switch_mactable_array * array = current;
+		struct switch_mactable_slot slot;
+		int index = findMACTableSlotHash(array, keys[i], hashes[i]);
+		if (index < 0 && old != NULL) {
+			array = old;
+			index = findMACTableSlotHash(array, keys[i], hashes[i]);
+		}
+		if (index < 0) {
+			results[i].iface = NULL;
+			continue;
+		}
+		memcpy(&slot, array->slots + index, sizeof(slot));
+		results[i].iface = slot.port < SWITCH_MAX_IFS ? table->ports[slot.port] : NULL;
+		results[i].lastSeen = slot.lastSeen;
 	}
-		
-	return 1;
 }
 
+/**
+ * Lock-free burst counterpart of getMACTableRecord, keys come from
+ * getMACTableLookupKey. Burst overlapping moves of entries is repeated.
+ */
+void getMACTableRecords(struct switch_mactable * table, const uint64_t * keys, struct switch_mactable_result * results, const unsigned int count) {
 
-void deleteMACTableItem(struct switch_mactable_item * item) {
+	unsigned int hashes[MACTABLE_BURST_SIZE];
+	unsigned long sequence;
 
-	if (item == NULL)
+	if (table == NULL || keys == NULL || results == NULL)
 		return;
-		
-	free((void *) item->macAddress);
-	free((void *) item);
+
+	for (unsigned int first = 0; first < count; first += MACTABLE_BURST_SIZE) {
+		unsigned int burst = count - first < MACTABLE_BURST_SIZE ? count - first : MACTABLE_BURST_SIZE;
+
+		for (unsigned int i = 0; i < burst; i++)
+			hashes[i] = MACTableSlotHash(keys[first + i]);
+
+		while (1) {
+			sequence = __atomic_load_n(&table->sequence, __ATOMIC_ACQUIRE);
+			if ((sequence & 1) == 0) {
+				lookupMACTableBurst(table, keys + first, hashes, results + first, burst);
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&table->sequence, __ATOMIC_RELAXED) == sequence)
+					break;
+			}
+		}
+
+		for (unsigned int i = first; i < first + burst; i++) {
+			if (results[i].iface != NULL)
+				SWITCH_TRACE(hit, E_TRACE_HIT, results[i].iface->index, 0, keys[i]);
+			else
+				SWITCH_TRACE(miss, E_TRACE_MISS, -1, 0, keys[i]);
+		}
+	}
 }
 
-void printMACTable(struct switch_mactable * table) {
+/**
+ * Learns address on port, moves it if it was learned on other port before.
+ * Returns 1 if learned, 0 if not due to limits or MACTABLE_INSERT_DROP if
+ * frame has to be dropped too, -1 on error.
+ */
+int insertMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface) {
 
-	struct hashMap_item_list * list = NULL;
-	struct switch_mactable_item * item = NULL;
-	time_t currentTime;
-	char macAddressString[15];
+	int learned;
 
-	debug_print("%s\n","START");
+	if (table == NULL || macAddress == NULL || iface == NULL || iface->index >= SWITCH_MAX_IFS) 
+		return -1;
 
-	user_print("\nMAC address\tPort\tAge%s","\n");
+	pthread_mutex_lock(&table->mutex);
+	learned = learnMACTableRecord(table, getMACTableLookupKey(macAddress, vlan), iface);
+	pthread_mutex_unlock(&table->mutex);
 
-	if (table == NULL) {
-		debug_print("%s\n","MAC table not initialized");
+	return learned;
+}
+
+/**
+ * Learns whole batch, with mutex taken once per few entries instead of once
+ * per frame.
+ */
+void learnMACTableRecords(struct switch_mactable * table, struct switch_mactable_learn * learns, const unsigned int count) {
+
+	if (table == NULL || learns == NULL || count == 0)
 		return;
+
+	pthread_mutex_lock(&table->mutex);
+	for (unsigned int i = 0; i < count; i++) {
+		if (learns[i].iface == NULL || learns[i].iface->index >= SWITCH_MAX_IFS)
+			learns[i].result = -1;
+		else
+			learns[i].result = learnMACTableRecord(table, learns[i].key, learns[i].iface);
+		if ((i + 1) % MACTABLE_WHEEL_BATCH == 0) {
+			pthread_mutex_unlock(&table->mutex);
+			pthread_mutex_lock(&table->mutex);
+		}
 	}
+	pthread_mutex_unlock(&table->mutex);
+}
+
+/**
+ * Mutex has to be held.
+ */
+int learnMACTableRecord(struct switch_mactable * table, const uint64_t key, struct switch_if * iface) {
+
+	struct switch_mactable_array * array;
+	struct switch_mactable_slot * slot;
+	struct switch_mactable_slot entry;
+	struct switch_mactable_port * limits = table->portLimits + iface->index;
+	int index;
+
+	table->ports[iface->index] = iface;
+
+	index = findMACTableEntry(table, key, &array);
+	if (index >= 0) {
+		/* If already exists, refresh it */
+		slot = array->slots + index;
+		slot->lastSeen = getSwitchClockSeconds();
+		if (slot->port == iface->index || (slot->flags & MACTABLE_FLAG_STATIC) != 0)
+			return 1;
+		debug_print("%s\n", "Port change");
+		SWITCH_TRACE(move, E_TRACE_MOVE, iface->index, slot->port, key);
+		if (limits->limit == 0 || limits->count < limits->limit) {
+			table->portLimits[slot->port].count--;
+			beginMACTableWrite(table);
+			slot->port = iface->index;
+			endMACTableWrite(table);
+			bumpMACTableGeneration(table);
+			limits->count++;
+			limits->learned++;
+			return 1;
+		}
+		// New port is full, learn it again under its limit
+		deleteMACTableSlot(table, array, index);
+		bumpMACTableGeneration(table);
+	}
+
+	/* Each insert moves resize on */
+	migrateMACTable(table, MACTABLE_MIGRATE_STEP);
+	checkMACTableResize(table);
+
+	if (checkMACTableLimit(table, iface->index) == 0) {
+		if (table->limitAction == E_MACLIMIT_DROP) {
+			limits->dropped++;
+			return MACTABLE_INSERT_DROP;
+		}
+		return 0;
+	}
+
+	/* Add new slot */
+	memset(&entry, 0, sizeof(entry));
+	memcpy(&entry, &key, sizeof(key));
+	entry.port = iface->index;
+	entry.lastSeen = getSwitchClockSeconds();
+
+	SWITCH_TRACE(learn, E_TRACE_LEARN, iface->index, 0, key);
+	return addMACTableSlot(table, &entry) == 1 ? 1 : -1;
+}
+
+/**
+ * Static entry replaces learned one of same address.
+ */
+int addMACTableStatic(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface) {
+
+	struct switch_mactable_array * array;
+	struct switch_mactable_slot entry;
+	uint64_t key;
+	int index;
+	int added;
+
+	if (table == NULL || macAddress == NULL || iface == NULL || iface->index >= SWITCH_MAX_IFS) 
+		return 0;
+
+	key = getMACTableLookupKey(macAddress, vlan);
 
-	// Load items from HashMap
-	
 	pthread_mutex_lock(&table->mutex);
-	list = hashMap2List(table->map);
-	if (list == NULL) {
-		debug_print("%s\n", "Hash map itemList not initialized");
-		return;
+	table->ports[iface->index] = iface;
+
+	index = findMACTableEntry(table, key, &array);
+	if (index >= 0) {
+		deleteMACTableSlot(table, array, index);
+		bumpMACTableGeneration(table);
 	}
 
-	// Print out each item
-	currentTime = time(NULL);
-	for (int i = 0; i < table->map->itemCount; i++) {
-		item = (struct switch_mactable_item *) (list + i)->value;
-		if (item == NULL)
-			continue;
-		formatMACAddress((u_char *) item->macAddress, macAddressString);
-		user_print("%s\t%s\t%ld\n", macAddressString, item->if_handler->name, (long int) currentTime - item->time_added);
-	}	
-	
+	memset(&entry, 0, sizeof(entry));
+	memcpy(&entry, &key, sizeof(key));
+	entry.port = iface->index;
+	entry.flags = MACTABLE_FLAG_STATIC;
+	entry.lastSeen = getSwitchClockSeconds();
+	added = addMACTableSlot(table, &entry);
+	checkMACTableResize(table);
+
 	pthread_mutex_unlock(&table->mutex);
 
-	hashMapDestroyList(list);
+	return added;
+}
+
+/**
+ * Adds dynamic entry last seen age seconds ago, unless it is known already
+ * or port is over its limits. Nothing is evicted for restored entries.
+ */
+int restoreMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface, const uint32_t age) {
+
+	struct switch_mactable_array * array;
+	struct switch_mactable_slot entry;
+	struct switch_mactable_port * limits;
+	unsigned int count;
+	uint64_t key;
+	int added = 0;
 
-	debug_print("%s\n","END");
+	if (table == NULL || macAddress == NULL || iface == NULL || iface->index >= SWITCH_MAX_IFS) 
+		return 0;
 
-}
+	key = getMACTableLookupKey(macAddress, vlan);
+	limits = table->portLimits + iface->index;
 
+	pthread_mutex_lock(&table->mutex);
+	table->ports[iface->index] = iface;
+
+	count = table->current->count + (table->old == NULL ? 0 : table->old->count);
+	if (age <= table->timeOutLimit
+					&& findMACTableEntry(table, key, &array) < 0
+					&& (limits->limit == 0 || limits->count < limits->limit)
+					&& (table->maxEntries == 0 || count < table->maxEntries)) {
+		migrateMACTable(table, MACTABLE_MIGRATE_STEP);
+		checkMACTableResize(table);
+		memset(&entry, 0, sizeof(entry));
+		memcpy(&entry, &key, sizeof(key));
+		entry.port = iface->index;
+		entry.lastSeen = getSwitchClockSeconds() - age;
+		added = addMACTableSlot(table, &entry);
+	}
+
+	pthread_mutex_unlock(&table->mutex);
+
+	return added;
+}
+
+void deleteMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan) {
+	
+	struct switch_mactable_array * array;
+	uint64_t key;
+	int index;
+
+	debug_print("%s\n", "START");
+
+	if (table == NULL || macAddress == NULL) {
+		debug_print("%s\n", "Invalid params");
+		return;
+	}
+
+	key = getMACTableLookupKey(macAddress, vlan);
+
+	pthread_mutex_lock(&table->mutex);
+	index = findMACTableEntry(table, key, &array);
+	if (index >= 0) {
+		deleteMACTableSlot(table, array, index);
+		bumpMACTableGeneration(table);
+	}
+	pthread_mutex_unlock(&table->mutex);
+
+	debug_print("%s\n", "END");
+}
+
+/**
+ * Removal shifts next entry into the current slot, so it is checked again
+ * before moving on.
+ */
+int removeMACTablePort(struct switch_mactable * table, struct switch_mactable_array * array, const unsigned int port) {
+
+	int removed = 0;
+
+	for (unsigned int i = 0; array != NULL && i < array->capacity; i++) {
+		struct switch_mactable_slot * slot = array->slots + i;
+		while (slot->distance != 0 && slot->port == port && (slot->flags & MACTABLE_FLAG_STATIC) == 0) {
+			deleteMACTableSlot(table, array, i);
+			removed++;
+		}
+	}
+
+	return removed;
+}
+
+/**
+ * Static entries stay.
+ */
+void flushMACTablePort(struct switch_mactable * table, struct switch_if * iface) {
+
+	if (table == NULL || iface == NULL) {
+		debug_print("%s\n", "Invalid params");
+		return;
+	}
+
+	pthread_mutex_lock(&table->mutex);
+	removeMACTablePort(table, table->current, iface->index);
+	removeMACTablePort(table, table->old, iface->index);
+	bumpMACTableGeneration(table);
+	pthread_mutex_unlock(&table->mutex);
+}
+
+/**
+ * Timer is due in bucket of expiry second, rounds over wheel size are
+ * rescheduled when they fire.
+ */
+int scheduleMACTableTimer(struct switch_mactable * table, const uint64_t key, const unsigned int tag, uint32_t expiry) {
+
+	struct switch_mactable_bucket * bucket;
+
+	// Already past, fire on next tick
+	if ((int32_t) (expiry - table->wheelTime) <= 0)
+		expiry = table->wheelTime + 1;
+
+	bucket = table->wheel + (expiry % MACTABLE_WHEEL_SIZE);
+	if (bucket->count == bucket->size) {
+		unsigned int size = bucket->size == 0 ? 16 : bucket->size * 2;
+		struct switch_mactable_timer * timers = (struct switch_mactable_timer *) realloc(bucket->timers, sizeof(struct switch_mactable_timer) * size);
+		if (timers == NULL)
+			return 0;
+		bucket->timers = timers;
+		bucket->size = size;
+	}
+
+	bucket->timers[bucket->count].key = key;
+	bucket->timers[bucket->count].tag = tag;
+	bucket->count++;
+	table->timers++;
+
+	return 1;
+}
+
+/**
+ * Lazy aging, refresh only updates lastSeen. Timer of still active entry
+ * is moved to its new expiry under fresh tag, so stale timer of re-learned
+ * key whose tag wrapped around fails the check next time. Timers of deleted
+ * or rescheduled entries are just dropped. Returns 1 if entry was aged out.
+ */
+int expireMACTableTimer(struct switch_mactable * table, struct switch_mactable_timer * timer, const uint32_t currTime) {
+
+	struct switch_mactable_array * array;
+	struct switch_mactable_slot * slot;
+	int index;
+
+	index = findMACTableEntry(table, timer->key, &array);
+	if (index < 0)
+		return 0;
+
+	slot = array->slots + index;
+	if (slot->tag != (u_char) timer->tag)
+		return 0;
+
+	if (currTime - slot->lastSeen > table->timeOutLimit) {
+		deleteMACTableSlot(table, array, index);
+		return 1;
+	}
+
+	unsigned int tag = table->nextTag++;
+	if (scheduleMACTableTimer(table, timer->key, tag, slot->lastSeen + table->timeOutLimit + 1) == 0) {
+		// Keep it in next bucket instead of never aging
+		debug_print("%s\n", "Unable to reschedule MAC Table aging");
+		if (scheduleMACTableTimer(table, timer->key, tag, currTime + 1) == 0)
+			return 0;
+	}
+	slot->tag = tag;
+
+	return 0;
+}
+
+void removeMACTableTimer(struct switch_mactable * table, struct switch_mactable_bucket * bucket, const unsigned int index) {
+
+	bucket->timers[index] = bucket->timers[--bucket->count];
+	table->timers--;
+}
+
+/**
+ * Walks aging wheel from the earliest second, first entry really due there
+ * is the least recently seen one. If none is due within wheel round, the
+ * earliest of later rounds is taken. Timers of refreshed entries met on the
+ * way are moved, as maintenance would do anyway, timer of evicted entry goes
+ * stale. Port -1 evicts entry of any port. Returns 1 if entry was evicted.
+ */
+int evictMACTableEntry(struct switch_mactable * table, const int port) {
+
+	unsigned int scanned = 0;
+	uint64_t victim = 0;
+	uint32_t victimExpiry = 0;
+	int found = 0;
+	struct switch_mactable_array * array;
+	int index;
+
+	for (unsigned int offset = 1; offset <= MACTABLE_WHEEL_SIZE && scanned < MACTABLE_EVICT_SCAN; offset++) {
+		uint32_t second = table->wheelTime + offset;
+		struct switch_mactable_bucket * bucket = table->wheel + (second % MACTABLE_WHEEL_SIZE);
+		unsigned int i = 0;
+
+		while (i < bucket->count && scanned++ < MACTABLE_EVICT_SCAN) {
+			struct switch_mactable_timer timer = bucket->timers[i];
+			struct switch_mactable_slot * slot;
+			uint32_t expiry;
+
+			index = findMACTableEntry(table, timer.key, &array);
+			if (index < 0 || array->slots[index].tag != (u_char) timer.tag) {
+				removeMACTableTimer(table, bucket, i);
+				continue;
+			}
+
+			slot = array->slots + index;
+			expiry = slot->lastSeen + table->timeOutLimit + 1;
+			if ((int32_t) (expiry - second) > 0 && expiry % MACTABLE_WHEEL_SIZE != second % MACTABLE_WHEEL_SIZE) {
+				// Refreshed since scheduled, fresh tag as on expiry
+				unsigned int tag = table->nextTag++;
+				if (scheduleMACTableTimer(table, timer.key, tag, expiry) == 1) {
+					slot->tag = tag;
+					removeMACTableTimer(table, bucket, i);
+					continue;
+				}
+			}
+			i++;
+
+			if (port >= 0 && slot->port != port)
+				continue;
+			if (found == 0 || (int32_t) (expiry - victimExpiry) < 0) {
+				victim = timer.key;
+				victimExpiry = expiry;
+				found = 1;
+			}
+			// Due in this round, nothing later can be older
+			if ((int32_t) (expiry - second) <= 0)
+				break;
+		}
+		if (found == 1 && (int32_t) (victimExpiry - second) <= 0)
+			break;
+	}
+
+	if (found == 0)
+		return 0;
+
+	index = findMACTableEntry(table, victim, &array);
+	table->portLimits[array->slots[index].port].evicted++;
+	deleteMACTableSlot(table, array, index);
+	bumpMACTableGeneration(table);
+
+	return 1;
+}
+
+/**
+ * Makes room for new entry of port, returns 1 if it may be learned. Port
+ * over its limit evicts its own entries only, so flooding it with sources
+ * never pushes out entries of other ports.
+ */
+int checkMACTableLimit(struct switch_mactable * table, const unsigned int port) {
+
+	struct switch_mactable_port * limits = table->portLimits + port;
+	unsigned int count = table->current->count + (table->old == NULL ? 0 : table->old->count);
+	int portFull = limits->limit > 0 && limits->count >= limits->limit;
+	int tableFull = table->maxEntries > 0 && count >= table->maxEntries;
+
+	if (portFull == 0 && tableFull == 0)
+		return 1;
+
+	limits->limitHits++;
+	if (table->limitAction != E_MACLIMIT_EVICT)
+		return 0;
+
+	// Own entries first, others only if table is full
+	if (limits->count > 0 && evictMACTableEntry(table, port) == 1)
+		return 1;
+	if (portFull == 0 && evictMACTableEntry(table, -1) == 1)
+		return 1;
+
+	return 0;
+}
+
+/**
+ * Fires buckets of seconds passed since last run, in O(due timers). Mutex is
+ * released every few timers, so learning is not held up by large buckets.
+ */
+void maintainMACTable(struct switch_mactable * table) {
+
+	uint32_t currTime = getSwitchClockSeconds();
+	int removed = 0;
+
+	if (table == NULL) {
+		debug_print("%s\n", "Invalid params");
+		return;
+	}
+
+	pthread_mutex_lock(&table->mutex);
+	if ((int32_t) (currTime - table->wheelTime) > MACTABLE_WHEEL_SIZE)
+		table->wheelTime = currTime - MACTABLE_WHEEL_SIZE;
+
+	while ((int32_t) (currTime - table->wheelTime) > 0) {
+		struct switch_mactable_bucket * bucket;
+		struct switch_mactable_timer * timers;
+		unsigned int count;
+
+		table->wheelTime++;
+
+		// Take due timers out, rescheduled ones may land in same bucket
+		bucket = table->wheel + (table->wheelTime % MACTABLE_WHEEL_SIZE);
+		timers = bucket->timers;
+		count = bucket->count;
+		memset(bucket, 0, sizeof(struct switch_mactable_bucket));
+		table->timers -= count;
+
+		for (unsigned int i = 0; i < count; i++) {
+			removed += expireMACTableTimer(table, timers + i, currTime);
+			if ((i + 1) % MACTABLE_WHEEL_BATCH == 0) {
+				pthread_mutex_unlock(&table->mutex);
+				pthread_mutex_lock(&table->mutex);
+			}
+		}
+		free((void *) timers);
+	}
+	if (removed > 0)
+		bumpMACTableGeneration(table);
+
+	// Finish resize even if nothing is learned
+	migrateMACTable(table, MACTABLE_MIGRATE_IDLE_STEP);
+	checkMACTableResize(table);
+	reclaimMACTableArrays(table);
+	pthread_mutex_unlock(&table->mutex);
+}
+
+/**
+ * New tags make all pending timers stale, entries get one timer for new
+ * timeout each.
+ */
+void rescheduleMACTableArray(struct switch_mactable * table, struct switch_mactable_array * array) {
+
+	for (unsigned int i = 0; array != NULL && i < array->capacity; i++) {
+		struct switch_mactable_slot * slot = array->slots + i;
+		if (slot->distance == 0 || (slot->flags & MACTABLE_FLAG_STATIC) != 0)
+			continue;
+		slot->tag = table->nextTag++;
+		scheduleMACTableTimer(table, getMACTableSlotKey(slot), slot->tag, slot->lastSeen + table->timeOutLimit + 1);
+	}
+}
+
+void setMACTableTimeout(struct switch_mactable * table, const unsigned int timeOutLimit) {
+
+	if (table == NULL)
+		return;
+
+	pthread_mutex_lock(&table->mutex);
+	table->timeOutLimit = timeOutLimit;
+	for (int i = 0; i < MACTABLE_WHEEL_SIZE; i++) {
+		free((void *) table->wheel[i].timers);
+		memset(table->wheel + i, 0, sizeof(struct switch_mactable_bucket));
+	}
+	table->timers = 0;
+	rescheduleMACTableArray(table, table->current);
+	rescheduleMACTableArray(table, table->old);
+	pthread_mutex_unlock(&table->mutex);
+}
+
+void setMACTableLimit(struct switch_mactable * table, const unsigned int maxEntries) {
+
+	if (table == NULL)
+		return;
+
+	pthread_mutex_lock(&table->mutex);
+	table->maxEntries = maxEntries;
+	pthread_mutex_unlock(&table->mutex);
+}
+
+/**
+ * Entries over new limit are not evicted, they just age out.
+ */
+void setMACTablePortLimit(struct switch_mactable * table, struct switch_if * iface, const unsigned int limit) {
+
+	if (table == NULL || iface == NULL || iface->index >= SWITCH_MAX_IFS)
+		return;
+
+	pthread_mutex_lock(&table->mutex);
+	table->ports[iface->index] = iface;
+	table->portLimits[iface->index].limit = limit;
+	pthread_mutex_unlock(&table->mutex);
+}
+
+void setMACTableLimitAction(struct switch_mactable * table, enum e_macLimitAction action) {
+
+	if (table == NULL)
+		return;
+
+	pthread_mutex_lock(&table->mutex);
+	table->limitAction = action;
+	pthread_mutex_unlock(&table->mutex);
+}
+
+/**
+ * Writers may skip refresh of source seen on same port less than this many
+ * seconds ago, entries then age a bit sooner than aging says.
+ */
+unsigned int getMACTableRefresh(struct switch_mactable * table) {
+
+	unsigned int refresh = __atomic_load_n(&table->timeOutLimit, __ATOMIC_RELAXED) / MACTABLE_REFRESH_DIVIDER;
+
+	return refresh > 0 ? refresh : 1;
+}
+
+unsigned int getMACTableCount(struct switch_mactable * table) {
+
+	unsigned int count;
+
+	if (table == NULL)
+		return 0;
+
+	pthread_mutex_lock(&table->mutex);
+	count = table->current->count + (table->old == NULL ? 0 : table->old->count);
+	pthread_mutex_unlock(&table->mutex);
+
+	return count;
+}
+
+unsigned int copyMACTableArray(struct switch_mactable_array * array, struct switch_mactable_slot * entries, unsigned int count, const unsigned int max) {
+
+	for (unsigned int i = 0; array != NULL && i < array->capacity && count < max; i++) {
+		if (array->slots[i].distance != 0)
+			entries[count++] = array->slots[i];
+	}
+
+	return count;
+}
+
+/**
+ * Copies up to max entries, returns their count.
+ */
+unsigned int getMACTableEntries(struct switch_mactable * table, struct switch_mactable_slot * entries, const unsigned int max) {
+
+	unsigned int count;
+
+	if (table == NULL || entries == NULL)
+		return 0;
+
+	pthread_mutex_lock(&table->mutex);
+	count = copyMACTableArray(table->current, entries, 0, max);
+	count = copyMACTableArray(table->old, entries, count, max);
+	pthread_mutex_unlock(&table->mutex);
+
+	return count;
+}
+
+/**
+ * Generation lets caches of MAC table lookups find out, they are stale.
+ */
+unsigned long getMACTableGeneration(struct switch_mactable * table) {
+	return __atomic_load_n(&table->generation, __ATOMIC_ACQUIRE);
+}
+
+void bumpMACTableGeneration(struct switch_mactable * table) {
+	__atomic_add_fetch(&table->generation, 1, __ATOMIC_RELEASE);
+}
+
+
+void setMACTableKey(struct switch_mactable_key * key, void * macAddress, const unsigned int vlan) {
+
+	memcpy(key->macAddress, macAddress, sizeof(u_char) * ETHER_ADDR_LEN);
+	key->vlan = vlan;
+}
+
+
+unsigned int MACTableHashFunction(void * key) {
+
+	uint64_t k;
+
+	if (key == NULL)
+		return 0;
+
+	// MAC address & VLAN, 8 B
+	memcpy(&k, key, sizeof(k));
+	
+	return getMACHash(k);
+}
+
+
+int MACTableKeyEqual(void * key1, void * key2) {
+
+	struct switch_mactable_key * k1 = (struct switch_mactable_key *) key1;
+	struct switch_mactable_key * k2 = (struct switch_mactable_key *) key2;
+
+	if (key1 == NULL || key2 == NULL)
+		return 0;
+
+	if (k1->vlan != k2->vlan)
+		return 0;
+
+	for (int i = 0; i < ETHER_ADDR_LEN; i++) {
+		if (k1->macAddress[i] != k2->macAddress[i])
+			return 0;
+	}
+		
+	return 1;
+}
+
+void initMACTableCursor(struct switch_mactable_cursor * cursor, const struct switch_mactable_filter * filter) {
+
+	memset(cursor, 0, sizeof(struct switch_mactable_cursor));
+	if (filter != NULL)
+		cursor->filter = *filter;
+	else
+		cursor->filter.vlan = -1;
+}
+
+int matchMACTableFilter(const struct switch_mactable_filter * filter, const struct switch_mactable_slot * slot, const uint32_t currentTime) {
+
+	if (filter->iface != NULL && slot->port != filter->iface->index)
+		return 0;
+	if (filter->vlan >= 0 && slot->vlan != filter->vlan)
+		return 0;
+	if (filter->minAge > 0 && ((slot->flags & MACTABLE_FLAG_STATIC) != 0 || currentTime - slot->lastSeen < filter->minAge))
+		return 0;
+
+	for (unsigned int i = 0; i < filter->prefixLength && i < ETHER_ADDR_LEN * 2; i++) {
+		unsigned int shift = (i % 2) == 0 ? 4 : 0;
+		if (((slot->macAddress[i / 2] >> shift) & 0x0f) != ((filter->macPrefix[i / 2] >> shift) & 0x0f))
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Copies up to max entries matching filter of cursor, returns their count.
+ * Mutex is held for a chunk of home slots at a time only, so listing large
+ * table never holds up learning. Entries are resumed by home slot, which
+ * neither backward shift nor Robin Hood displacement changes. Old slots are
+ * walked first while resizing, entry migrated meanwhile may be listed twice.
+ * Walk restarts if another resize begins, listing entries again.
+ */
+unsigned int getMACTableCursorEntries(struct switch_mactable * table, struct switch_mactable_cursor * cursor, struct switch_mactable_slot * entries, const unsigned int max) {
+
+	unsigned int count = 0;
+	int chunkDone = 1;
+
+	if (table == NULL || cursor == NULL || entries == NULL || max == 0)
+		return 0;
+
+	while (chunkDone == 1 && count < max && cursor->array != MACTABLE_CURSOR_DONE) {
+		uint32_t currentTime = getSwitchClockSeconds();
+		struct switch_mactable_array * array;
+
+		pthread_mutex_lock(&table->mutex);
+		if (cursor->array == 0 && cursor->index == 0) {
+			cursor->resizes = table->grows + table->shrinks;
+		} else if (cursor->resizes != table->grows + table->shrinks) {
+			// Slots walked so far may have been replaced
+			cursor->array = 0;
+			cursor->index = 0;
+			cursor->resizes = table->grows + table->shrinks;
+		}
+
+		array = cursor->array == 0 ? table->old : table->current;
+		if (array != NULL && cursor->index < array->capacity)
+			chunkDone = getMACTableChunkEntries(array, cursor, entries, &count, max, currentTime);
+		if (array == NULL || cursor->index >= array->capacity) {
+			cursor->array++;
+			cursor->index = 0;
+		}
+		pthread_mutex_unlock(&table->mutex);
+	}
+
+	return count;
+}
+
+/**
+ * Lists entries of one chunk of home slots, from its first home slot to
+ * the end of the cluster past its last one. Entries of one home slot are
+ * adjacent, if they do not all fit, cursor stops before them and 0 is
+ * returned.
+ */
+int getMACTableChunkEntries(struct switch_mactable_array * array, struct switch_mactable_cursor * cursor, struct switch_mactable_slot * entries, unsigned int * count, const unsigned int max, const uint32_t currentTime) {
+
+	unsigned int start = cursor->index;
+	unsigned int chunk = array->capacity - start < MACTABLE_CURSOR_CHUNK ? array->capacity - start : MACTABLE_CURSOR_CHUNK;
+	unsigned int groupStart = *count; // First listed entry of last home slot
+	unsigned int lastOffset = chunk;
+
+	for (unsigned int i = 0; i < array->capacity; i++) {
+		struct switch_mactable_slot * slot = array->slots + ((start + i) & array->mask);
+		unsigned int offset = (start + i - (slot->distance - 1) - start) & array->mask; // Home slot within chunk
+
+		if (slot->distance == 0 || offset >= chunk) {
+			if (i >= chunk)
+				break; // Cluster after chunk ended
+			continue; // Empty or home before chunk
+		}
+		if (matchMACTableFilter(&cursor->filter, slot, currentTime) == 0)
+			continue;
+
+		if (offset != lastOffset) {
+			groupStart = *count;
+			lastOffset = offset;
+		}
+		if (*count == max) {
+			// More than max entries of one home slot are listed partially
+			if (groupStart > 0)
+				*count = groupStart;
+			cursor->index = start + offset + (groupStart > 0 ? 0 : 1);
+			return 0;
+		}
+		entries[(*count)++] = *slot;
+	}
+
+	cursor->index = start + chunk;
+	return 1;
+}
+
+/**
+ * Port of entry is looked up in table, interfaces live as long as table does.
+ */
+void printMACTableEntry(struct switch_mactable * table, const struct switch_mactable_slot * slot, const uint32_t currentTime) {
+
+	char macAddressString[15];
+	struct switch_if * iface = table->ports[slot->port];
+
+	formatMACAddress((u_char *) slot->macAddress, macAddressString);
+	if ((slot->flags & MACTABLE_FLAG_STATIC) != 0)
+		user_print("%s\t%u\t%s\tstatic\n", macAddressString, (unsigned int) slot->vlan, iface == NULL ? "?" : iface->name);
+	else
+		user_print("%s\t%u\t%s\t%u\n", macAddressString, (unsigned int) slot->vlan, iface == NULL ? "?" : iface->name, currentTime - slot->lastSeen);
+}
+
+/**
+ * Probe distances, bucket i holds distances up to 2^i.
+ */
+void addMACTableHistogram(struct switch_mactable_array * array, unsigned long * histogram, unsigned int * maxDistance) {
+
+	for (unsigned int i = 0; array != NULL && i < array->capacity; i++) {
+		unsigned int distance = array->slots[i].distance;
+		int bucket = 0;
+		if (distance == 0)
+			continue;
+		while (bucket < MACTABLE_HISTOGRAM_SIZE - 1 && distance > (1U << bucket))
+			bucket++;
+		histogram[bucket]++;
+		if (distance > *maxDistance)
+			*maxDistance = distance;
+	}
+}
+
+void printMACTableStats(struct switch_mactable * table) {
+
+	unsigned long histogram[MACTABLE_HISTOGRAM_SIZE] = {0};
+	unsigned int maxDistance = 0;
+
+	if (table == NULL)
+		return;
+
+	pthread_mutex_lock(&table->mutex);
+	user_print("\nMAC table: %u entries, %u slots, %lu grows, %lu shrinks",
+					table->current->count + (table->old == NULL ? 0 : table->old->count),
+					table->current->capacity,
+					table->grows,
+					table->shrinks);
+	if (table->old != NULL)
+		user_print(", resizing from %u slots (%u left)", table->old->capacity, table->old->count);
+	user_print("%s\n", "");
+	user_print("MAC table aging: %u seconds, %u timers pending\n", table->timeOutLimit, table->timers);
+
+	addMACTableHistogram(table->current, histogram, &maxDistance);
+	addMACTableHistogram(table->old, histogram, &maxDistance);
+	pthread_mutex_unlock(&table->mutex);
+
+	user_print("MAC table probes (%s):", getMACHashName());
+	for (int i = 0; i < MACTABLE_HISTOGRAM_SIZE; i++) {
+		if (i <= 1)
+			user_print("%s%u: %lu", i == 0 ? " " : ", ", i + 1, histogram[i]);
+		else if (i == MACTABLE_HISTOGRAM_SIZE - 1)
+			user_print(", >%u: %lu", 1U << (i - 1), histogram[i]);
+		else
+			user_print(", %u-%u: %lu", (1U << (i - 1)) + 1, 1U << i, histogram[i]);
+	}
+	user_print(", max %u\n", maxDistance);
+}
+
+int getMACTableLimitAction(const char * name, enum e_macLimitAction * action) {
+
+	if (name == NULL)
+		return 0;
+
+	if (strcmp(name, "stop") == 0)
+		*action = E_MACLIMIT_STOP;
+	else if (strcmp(name, "evict") == 0)
+		*action = E_MACLIMIT_EVICT;
+	else if (strcmp(name, "drop") == 0)
+		*action = E_MACLIMIT_DROP;
+	else
+		return 0;
+
+	return 1;
+}
+
+const char * getMACTableLimitActionName(enum e_macLimitAction action) {
+
+	switch (action) {
+		case E_MACLIMIT_EVICT:
+			return "evict";
+		case E_MACLIMIT_DROP:
+			return "drop";
+		default:
+			return "stop";
+	}
+}
+
+void printMACTableLimits(struct switch_mactable * table, struct switch_if * ifs) {
+
+	if (table == NULL)
+		return;
+
+	pthread_mutex_lock(&table->mutex);
+	user_print("\nMAC table limit: %u entries (0 - none), action on overflow: %s\n", table->maxEntries, getMACTableLimitActionName(table->limitAction));
+	user_print("\nIface\tLimit\tEntries\tLearned\tHits\tEvicted\tDropped\n%s", "");
+	for (struct switch_if * iface = ifs; iface != NULL; iface = iface->next) {
+		struct switch_mactable_port * limits;
+		if (iface->index >= SWITCH_MAX_IFS)
+			continue;
+		limits = table->portLimits + iface->index;
+		user_print("%-6s\t%-6u\t%-6u\t%-6lu\t%-6lu\t%-6lu\t%-6lu\n", iface->name, limits->limit, limits->count,
+						limits->learned, limits->limitHits, limits->evicted, limits->dropped);
+	}
+	pthread_mutex_unlock(&table->mutex);
+}
@@ -27,34 +27,171 @@
 #ifndef _MACTABLE_
 #define _MACTABLE_
 
+// Needed by switch config
+enum e_macLimitAction {E_MACLIMIT_STOP = 0, // Stop learning, unknown sources flood
+				E_MACLIMIT_EVICT, // Evict least recently seen entry
+				E_MACLIMIT_DROP}; // Drop frames of unknown sources
+
 #include "switchcore.h"
-#include "hashmap.h"
 
+#include <stdint.h>
 #include <pthread.h>
 #include <time.h>
+#include <net/ethernet.h>
+
+#define MACTABLE_MIN_CAPACITY 1024 // Slots, power of 2
+#define MACTABLE_GROW_LOAD(capacity) ((capacity) / 4 * 3) // Doubled at 3/4 full
+#define MACTABLE_SHRINK_LOAD(capacity) ((capacity) / 8) // Halved below 1/8 full
+#define MACTABLE_MAX_LOAD(capacity) ((capacity) - (capacity) / 8) // If it cannot grow
+#define MACTABLE_MAX_DISTANCE 255 // Probe distance kept in one byte
+#define MACTABLE_MIGRATE_STEP 64 // Old slots moved per insert while resizing
+#define MACTABLE_MIGRATE_IDLE_STEP 4096 // Old slots moved per maintenance run
+#define MACTABLE_HISTOGRAM_SIZE 7 // Probe distance buckets 1, 2, 3-4, .. 17-32, >32
+#define MACTABLE_MAX_READERS 16 // Lock-free lookup threads
+#define MACTABLE_WHEEL_SIZE 256 // Aging wheel, one bucket per second
+#define MACTABLE_WHEEL_BATCH 64 // Timers fired per mutex hold
+#define MACTABLE_EVICT_SCAN 1024 // Timers looked at for LRU entry
+#define MACTABLE_BURST_SIZE 64 // Keys resolved together by burst lookup
+#define MACTABLE_REFRESH_DIVIDER 8 // Known source is refreshed every 1/8 of aging
+#define MACTABLE_CURSOR_CHUNK 256 // Home slots listed by cursor per mutex hold
+#define MACTABLE_CURSOR_DONE 2
+
+#define MACTABLE_FLAG_STATIC 0x01 // Operator defined, never aged, moved nor evicted
+
+#define MACTABLE_INSERT_DROP -2 // Source not learned, frame has to be dropped
+
+struct switch_mactable_key { // MAC Table key
+	u_char macAddress[ETHER_ADDR_LEN];
+	unsigned short vlan;
+};
+
+struct switch_mactable_slot { // MAC Table slot, 16 B - four slots per cache line
+	u_char macAddress[ETHER_ADDR_LEN]; // Together with vlan 8 B key
+	unsigned short vlan;
+	u_char port; // Index to ports
+	u_char tag; // Of live aging timer, others are stale
+	u_char distance; // Probe distance + 1, 0 - empty slot
+	u_char flags; // MACTABLE_FLAG_*
+	uint32_t lastSeen; // Seconds
+};
+
+struct switch_mactable_result { // Burst lookup result
+	struct switch_if * iface; // NULL if not known
+	uint32_t lastSeen;
+};
+
+struct switch_mactable_learn { // Batched learning request
+	uint64_t key;
+	struct switch_if * iface;
+	int result; // As returned by insertMACTableRecord
+};
+
+struct switch_mactable_array { // Slot array, open addressing with Robin Hood hashing
+	struct switch_mactable_slot * slots;
+	unsigned int capacity; // Power of 2, never changes once published
+	unsigned int mask; // capacity - 1
+	unsigned int count;
+	unsigned long retiredEpoch; // Freed once all readers pass it
+	struct switch_mactable_array * nextRetired;
+};
 
-#define MACTABLE_HASHMAP_SIZE 20
+struct switch_mactable_timer { // Aging timer, fires in wheel bucket of expiry second
+	uint64_t key;
+	unsigned int tag;
+};
+
+struct switch_mactable_bucket { // Aging wheel bucket
+	struct switch_mactable_timer * timers;
+	unsigned int count;
+	unsigned int size;
+};
 
-struct switch_mactable_item { // MAC Table item
-	void * macAddress;
-	struct switch_if * if_handler;
-	time_t time_added;
+struct switch_mactable_port { // Learning limit & counters of port
+	unsigned int limit; // 0 - no limit
+	unsigned int count; // Static entries excluded
+	unsigned long learned;
+	unsigned long limitHits;
+	unsigned long evicted;
+	unsigned long dropped; // Frames of unknown sources
 };
 
+struct switch_mactable_filter { // Entries listed by cursor
+	struct switch_if * iface; // NULL - any port
+	int vlan; // -1 - any VLAN
+	u_char macPrefix[ETHER_ADDR_LEN];
+	unsigned int prefixLength; // Hex digits, 0 - any address
+	unsigned int minAge; // Seconds
+};
+
+struct switch_mactable_cursor { // Position of chunked iteration
+	struct switch_mactable_filter filter;
+	unsigned int array; // 0 - old slots, 1 - current slots, MACTABLE_CURSOR_DONE
+	unsigned int index; // Next home slot
+	unsigned long resizes; // Grows & shrinks when walk started
+};
+
+struct switch_mactable_reader { // Lock-free lookup thread
+	unsigned long epoch; // Last quiescent state
+	unsigned int online;
+} __attribute__((aligned(64)));
+
 struct switch_mactable { // MAC Table
-	struct hashMap * map;
+	struct switch_mactable_array * current;
+	struct switch_mactable_array * old; // Being migrated to current, NULL if not resizing
+	unsigned int migrateCursor; // Next old slot to migrate
+	unsigned int minCapacity; // Never shrinks below
+	unsigned long grows;
+	unsigned long shrinks;
+	struct switch_if * ports[SWITCH_MAX_IFS]; // Slot port index to interface
+	struct switch_mactable_port portLimits[SWITCH_MAX_IFS];
+	unsigned int maxEntries; // 0 - no limit
+	enum e_macLimitAction limitAction;
 	unsigned int timeOutLimit; 
-	pthread_mutex_t mutex;
+	struct switch_mactable_bucket wheel[MACTABLE_WHEEL_SIZE];
+	uint32_t wheelTime; // Last processed second
+	unsigned int timers; // Pending in wheel
+	u_char nextTag;
+	unsigned long generation; // Bumped on each move, deletion & aging
+	unsigned long sequence; // Odd while slots are being moved
+	unsigned long epoch; // Bumped on each retired array
+	struct switch_mactable_array * retired; // Waiting for readers
+	struct switch_mactable_reader readers[MACTABLE_MAX_READERS];
+	pthread_mutex_t mutex; // Writers only
 };
 
-struct switch_mactable * initMACTable(const unsigned int timeOutLimit);
+struct switch_mactable * initMACTable(const unsigned int timeOutLimit, const unsigned int capacity);
 void destroyMACTable(struct switch_mactable * table);
-struct switch_if * getMACTableRecord(struct switch_mactable * table, void * macAddress);
-int insertMACTableRecord(struct switch_mactable * table, void * macAddress, struct switch_if * iface);
-void deleteMACTableRecord(struct switch_mactable * table, void * macAddress);
+struct switch_if * getMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan);
+void getMACTableRecords(struct switch_mactable * table, const uint64_t * keys, struct switch_mactable_result * results, const unsigned int count);
+uint64_t getMACTableLookupKey(void * macAddress, const unsigned int vlan);
+int insertMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface);
+void learnMACTableRecords(struct switch_mactable * table, struct switch_mactable_learn * learns, const unsigned int count);
+unsigned int getMACTableRefresh(struct switch_mactable * table);
+void deleteMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan);
+int addMACTableStatic(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface);
+int restoreMACTableRecord(struct switch_mactable * table, void * macAddress, const unsigned int vlan, struct switch_if * iface, const uint32_t age);
+unsigned int getMACTableCount(struct switch_mactable * table);
+unsigned int getMACTableEntries(struct switch_mactable * table, struct switch_mactable_slot * entries, const unsigned int max);
+void flushMACTablePort(struct switch_mactable * table, struct switch_if * iface);
 void maintainMACTable(struct switch_mactable * table);
-void deleteMACTableItem(struct switch_mactable_item * item);
-void printMACTable(struct switch_mactable * table);
+void setMACTableTimeout(struct switch_mactable * table, const unsigned int timeOutLimit);
+void setMACTableLimit(struct switch_mactable * table, const unsigned int maxEntries);
+void setMACTablePortLimit(struct switch_mactable * table, struct switch_if * iface, const unsigned int limit);
+void setMACTableLimitAction(struct switch_mactable * table, enum e_macLimitAction action);
+int getMACTableLimitAction(const char * name, enum e_macLimitAction * action);
+const char * getMACTableLimitActionName(enum e_macLimitAction action);
+void printMACTableLimits(struct switch_mactable * table, struct switch_if * ifs);
+struct switch_mactable_reader * registerMACTableReader(struct switch_mactable * table);
+void unregisterMACTableReader(struct switch_mactable * table, struct switch_mactable_reader * reader);
+void quiesceMACTableReader(struct switch_mactable * table, struct switch_mactable_reader * reader);
+unsigned long getMACTableGeneration(struct switch_mactable * table);
+void setMACTableKey(struct switch_mactable_key * key, void * macAddress, const unsigned int vlan);
+unsigned int MACTableHashFunction(void * key);
+int MACTableKeyEqual(void * key1, void * key2);
+void initMACTableCursor(struct switch_mactable_cursor * cursor, const struct switch_mactable_filter * filter);
+unsigned int getMACTableCursorEntries(struct switch_mactable * table, struct switch_mactable_cursor * cursor, struct switch_mactable_slot * entries, const unsigned int max);
+void printMACTableEntry(struct switch_mactable * table, const struct switch_mactable_slot * slot, const uint32_t currentTime);
+void printMACTableStats(struct switch_mactable * table);
 
 #endif
 
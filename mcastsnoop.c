@@ -0,0 +1,576 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     mcastsnoop.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * IGMP / MLD snooping implementation
+ */
+
+#include "mcastsnoop.h"
+#include "mactable.h"
+#include "switchcore.h"
+#include "vlan.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+#define MCAST_ALL_PORTS (~0ULL)
+
+#define IGMP_QUERY 0x11
+#define IGMP_V1_REPORT 0x12
+#define IGMP_V2_REPORT 0x16
+#define IGMP_V2_LEAVE 0x17
+#define IGMP_V3_REPORT 0x22
+
+#define MLD_QUERY 130
+#define MLD_V1_REPORT 131
+#define MLD_V1_DONE 132
+#define MLD_V2_REPORT 143
+
+#define MCAST_RECORD_IS_INCLUDE 1
+#define MCAST_RECORD_IS_EXCLUDE 2
+#define MCAST_RECORD_TO_INCLUDE 3
+#define MCAST_RECORD_TO_EXCLUDE 4
+#define MCAST_RECORD_ALLOW 5
+
+#define PROTO_PIM 103
+
+enum e_mcastFrame {
+				E_MCAST_FRAME_FLOOD = 0, // Not snooped (link local, non IP, ...)
+				E_MCAST_FRAME_DATA,
+				E_MCAST_FRAME_QUERY,
+				E_MCAST_FRAME_REPORT};
+
+/********************************************************************/
+
+struct switch_mcast_table * initMcastTable();
+void destroyMcastTable(struct switch_mcast_table * table);
+unsigned long long snoopMcastFrame(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const u_char * frame, const unsigned int length);
+void maintainMcastTable(struct switch_mcast_table * table);
+void printMcastTable(struct switch_mcast_table * table, struct switch_if * ifs);
+enum e_mcastFrame snoopIGMP(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const u_char * packet, const unsigned int length);
+enum e_mcastFrame snoopMLD(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const u_char * packet, const unsigned int length);
+void mcastRecordUpdate(struct switch_mcast_table * table, struct switch_if * iface, struct switch_mactable_key * key, const unsigned int type, const unsigned int sourcesCount);
+void mcastJoin(struct switch_mcast_table * table, struct switch_if * iface, struct switch_mactable_key * key);
+void mcastLeave(struct switch_mcast_table * table, struct switch_if * iface, struct switch_mactable_key * key);
+void mcastRouterSeen(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const int isQuery);
+unsigned long long getMcastRouters(struct switch_mcast_table * table, const unsigned int vlan);
+void deleteMcastGroup(void * group);
+void deleteMcastRouter(void * router);
+
+/*******************************************************************/
+
+struct switch_mcast_table * initMcastTable() {
+
+	debug_print("%s\n", "START");
+
+	struct switch_mcast_table * table = (struct switch_mcast_table *) malloc(sizeof(struct switch_mcast_table));
+	if (table == NULL) {
+		debug_print("%s\n", "Error initializing multicast table");
+		return NULL;
+	}
+
+	// Mutex
+	if (pthread_mutex_init(&table->mutex, NULL) != 0) {
+		debug_print("%s\n", "Error initializing mutex");
+		free((void *) table);
+		return NULL;
+	}
+
+	// Init hashmap, keyed by group MAC address
+	table->map = hashMapInit(MCAST_HASHMAP_SIZE, MACTableHashFunction, MACTableKeyEqual, deleteMcastGroup);
+	if (table->map == NULL) {
+		debug_print("%s\n", "Error initializing hashmap");
+		pthread_mutex_destroy(&table->mutex);
+		free((void *) table);
+		return NULL;
+	}
+
+	// Router ports, keyed by VLAN with zero MAC address
+	table->routers = hashMapInit(MCAST_HASHMAP_SIZE, MACTableHashFunction, MACTableKeyEqual, deleteMcastRouter);
+	if (table->routers == NULL) {
+		debug_print("%s\n", "Error initializing hashmap");
+		hashMapDestroy(table->map);
+		pthread_mutex_destroy(&table->mutex);
+		free((void *) table);
+		return NULL;
+	}
+
+	debug_print("%s\n", "END");
+	return table;
+}
+
+void destroyMcastTable(struct switch_mcast_table * table) {
+
+	debug_print("%s\n", "START");
+
+	if (table == NULL) {
+		debug_print("%s\n", "Multicast table already uninitialized");
+		return;
+	}
+
+	pthread_mutex_destroy(&table->mutex);
+	hashMapDestroy(table->map);
+	hashMapDestroy(table->routers);
+	free((void *) table);
+
+	debug_print("%s\n", "END");
+}
+
+/**
+ * Snoops multicast frame and returns mask of ports, frame should be sent to.
+ * Queries and unsnooped frames are flooded, reports go to router ports only
+ * and data go to member & router ports. Router ports are kept per VLAN,
+ * unregistered groups & reports are flooded within VLAN until some router
+ * is detected in it.
+ */
+unsigned long long snoopMcastFrame(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const u_char * frame, const unsigned int length) {
+
+	struct ether_header * frameHdr = (struct ether_header *) frame;
+	enum e_mcastFrame frameType = E_MCAST_FRAME_FLOOD;
+	unsigned long long ports = MCAST_ALL_PORTS;
+	unsigned int headerLength;
+	struct switch_mactable_key key;
+
+	if (table == NULL || iface == NULL || frame == NULL || length < ETHER_HDR_LEN)
+		return MCAST_ALL_PORTS;
+
+	// Only IP multicast MAC ranges are snooped (01:00:5e, 33:33)
+	switch (getFrameEtherType(frame, length, &headerLength)) {
+		case ETHERTYPE_IP:
+			if (frameHdr->ether_dhost[0] == 0x01 && frameHdr->ether_dhost[1] == 0x00 && frameHdr->ether_dhost[2] == 0x5e)
+				frameType = snoopIGMP(table, iface, vlan, frame + headerLength, length - headerLength);
+			break;
+		case ETHERTYPE_IPV6:
+			if (frameHdr->ether_dhost[0] == 0x33 && frameHdr->ether_dhost[1] == 0x33)
+				frameType = snoopMLD(table, iface, vlan, frame + headerLength, length - headerLength);
+			break;
+		default:
+			break;
+	}
+
+	pthread_mutex_lock(&table->mutex);
+	switch (frameType) {
+		case E_MCAST_FRAME_DATA: {
+			unsigned long long routers = getMcastRouters(table, vlan);
+			setMACTableKey(&key, frameHdr->ether_dhost, vlan);
+			struct switch_mcast_group * group = (struct switch_mcast_group *) hashMapGetValue(table->map, &key);
+			if (group != NULL)
+				ports = group->members | routers;
+			else if (routers != 0)
+				ports = routers;
+			break;
+		}
+		case E_MCAST_FRAME_REPORT: {
+			unsigned long long routers = getMcastRouters(table, vlan);
+			if (routers != 0)
+				ports = routers;
+			break;
+		}
+		default:
+			break;
+	}
+	pthread_mutex_unlock(&table->mutex);
+
+	return ports;
+}
+
+enum e_mcastFrame snoopIGMP(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const u_char * packet, const unsigned int length) {
+
+	struct switch_mactable_key group = {{0x01, 0x00, 0x5e, 0x00, 0x00, 0x00}, vlan};
+	unsigned int headerLength;
+	const u_char * igmp;
+
+	if (length < 20 || (packet[0] >> 4) != 4)
+		return E_MCAST_FRAME_FLOOD;
+
+	headerLength = (packet[0] & 0x0f) * 4;
+	if (headerLength < 20 || length < headerLength)
+		return E_MCAST_FRAME_FLOOD;
+
+	// Multicast routers
+	if (packet[9] == PROTO_PIM) {
+		mcastRouterSeen(table, iface, vlan, 0);
+		return E_MCAST_FRAME_FLOOD;
+	}
+
+	if (packet[9] != IPPROTO_IGMP) {
+		// 224.0.0.0/24 is link local, always flooded
+		if (packet[16] == 224 && packet[17] == 0 && packet[18] == 0)
+			return E_MCAST_FRAME_FLOOD;
+		return E_MCAST_FRAME_DATA;
+	}
+
+	igmp = packet + headerLength;
+	if (length - headerLength < 8)
+		return E_MCAST_FRAME_FLOOD;
+
+	switch (igmp[0]) {
+		case IGMP_QUERY:
+			mcastRouterSeen(table, iface, vlan, 1);
+			return E_MCAST_FRAME_QUERY;
+		case IGMP_V1_REPORT:
+		case IGMP_V2_REPORT:
+		case IGMP_V2_LEAVE:
+			if (igmp[4] == 224 && igmp[5] == 0 && igmp[6] == 0)
+				return E_MCAST_FRAME_FLOOD;
+			group.macAddress[3] = igmp[5] & 0x7f;
+			group.macAddress[4] = igmp[6];
+			group.macAddress[5] = igmp[7];
+			if (igmp[0] == IGMP_V2_LEAVE)
+				mcastLeave(table, iface, &group);
+			else
+				mcastJoin(table, iface, &group);
+			return E_MCAST_FRAME_REPORT;
+		case IGMP_V3_REPORT: {
+			unsigned int records = (igmp[6] << 8) | igmp[7];
+			unsigned int offset = 8;
+			for (unsigned int i = 0; i < records; i++) {
+				const u_char * record = igmp + offset;
+				if (offset + 8 > length - headerLength)
+					break;
+				unsigned int sources = (record[2] << 8) | record[3];
+				offset += 8 + sources * 4 + record[1] * 4;
+				if (record[4] == 224 && record[5] == 0 && record[6] == 0)
+					continue;
+				group.macAddress[3] = record[5] & 0x7f;
+				group.macAddress[4] = record[6];
+				group.macAddress[5] = record[7];
+				mcastRecordUpdate(table, iface, &group, record[0], sources);
+			}
+			return E_MCAST_FRAME_REPORT;
+		}
+		default:
+			return E_MCAST_FRAME_FLOOD;
+	}
+}
+
+enum e_mcastFrame snoopMLD(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const u_char * packet, const unsigned int length) {
+
+	struct switch_mactable_key group = {{0x33, 0x33, 0x00, 0x00, 0x00, 0x00}, vlan};
+	unsigned int nextHeader;
+	unsigned int offset = 40;
+	const u_char * icmp;
+
+	if (length < 40 || (packet[0] >> 4) != 6)
+		return E_MCAST_FRAME_FLOOD;
+
+	// Skip extension headers (hop-by-hop, routing, destination options)
+	nextHeader = packet[6];
+	while (nextHeader == IPPROTO_HOPOPTS || nextHeader == IPPROTO_ROUTING || nextHeader == IPPROTO_DSTOPTS) {
+		if (offset + 2 > length)
+			return E_MCAST_FRAME_FLOOD;
+		nextHeader = packet[offset];
+		offset += (packet[offset + 1] + 1) * 8;
+	}
+
+	if (nextHeader == PROTO_PIM) {
+		mcastRouterSeen(table, iface, vlan, 0);
+		return E_MCAST_FRAME_FLOOD;
+	}
+
+	if (nextHeader == IPPROTO_ICMPV6 && offset + 8 <= length) {
+		icmp = packet + offset;
+		switch (icmp[0]) {
+			case MLD_QUERY:
+				mcastRouterSeen(table, iface, vlan, 1);
+				return E_MCAST_FRAME_QUERY;
+			case MLD_V1_REPORT:
+			case MLD_V1_DONE:
+				if (offset + 24 > length)
+					return E_MCAST_FRAME_FLOOD;
+				// Link local scope groups are always flooded
+				if ((icmp[9] & 0x0f) <= 2)
+					return E_MCAST_FRAME_FLOOD;
+				memcpy(group.macAddress + 2, icmp + 20, 4);
+				if (icmp[0] == MLD_V1_DONE)
+					mcastLeave(table, iface, &group);
+				else
+					mcastJoin(table, iface, &group);
+				return E_MCAST_FRAME_REPORT;
+			case MLD_V2_REPORT: {
+				unsigned int records = (icmp[6] << 8) | icmp[7];
+				unsigned int recordOffset = offset + 8;
+				for (unsigned int i = 0; i < records; i++) {
+					const u_char * record = packet + recordOffset;
+					if (recordOffset + 20 > length)
+						break;
+					unsigned int sources = (record[2] << 8) | record[3];
+					recordOffset += 20 + sources * 16 + record[1] * 4;
+					if ((record[5] & 0x0f) <= 2)
+						continue;
+					memcpy(group.macAddress + 2, record + 16, 4);
+					mcastRecordUpdate(table, iface, &group, record[0], sources);
+				}
+				return E_MCAST_FRAME_REPORT;
+			}
+			default:
+				break;
+		}
+	}
+
+	// Interface & link local scope (ff01::/16, ff02::/16) are always flooded
+	if ((packet[25] & 0x0f) <= 2)
+		return E_MCAST_FRAME_FLOOD;
+
+	return E_MCAST_FRAME_DATA;
+}
+
+/**
+ * IGMPv3 / MLDv2 group record. Source filtering is not supported, so any
+ * record asking for some traffic is taken as join and TO_INCLUDE({}) as leave.
+ */
+void mcastRecordUpdate(struct switch_mcast_table * table, struct switch_if * iface, struct switch_mactable_key * key, const unsigned int type, const unsigned int sourcesCount) {
+
+	switch (type) {
+		case MCAST_RECORD_IS_EXCLUDE:
+		case MCAST_RECORD_TO_EXCLUDE:
+			mcastJoin(table, iface, key);
+			break;
+		case MCAST_RECORD_IS_INCLUDE:
+		case MCAST_RECORD_TO_INCLUDE:
+		case MCAST_RECORD_ALLOW:
+			if (sourcesCount > 0)
+				mcastJoin(table, iface, key);
+			else if (type == MCAST_RECORD_TO_INCLUDE)
+				mcastLeave(table, iface, key);
+			break;
+		default:
+			break;
+	}
+}
+
+void mcastJoin(struct switch_mcast_table * table, struct switch_if * iface, struct switch_mactable_key * key) {
+
+	struct switch_mcast_group * group;
+
+	pthread_mutex_lock(&table->mutex);
+	group = (struct switch_mcast_group *) hashMapGetValue(table->map, key);
+	if (group == NULL) {
+		group = (struct switch_mcast_group *) malloc(sizeof(struct switch_mcast_group));
+		if (group == NULL) {
+			debug_print("%s\n", "Error initializing multicast group");
+			pthread_mutex_unlock(&table->mutex);
+			return;
+		}
+		group->key = *key;
+		group->members = 0;
+		if (hashMapInsertValue(table->map, key, group) < 0) {
+			debug_print("%s\n", "Error inserting to HASHMAP");
+			free((void *) group);
+			pthread_mutex_unlock(&table->mutex);
+			return;
+		}
+	}
+
+	group->members |= SWITCH_IF_MASK(iface);
+	group->memberTime[iface->index] = time(NULL) + MCAST_MEMBER_TIMEOUT;
+	pthread_mutex_unlock(&table->mutex);
+}
+
+void mcastLeave(struct switch_mcast_table * table, struct switch_if * iface, struct switch_mactable_key * key) {
+
+	struct switch_mcast_group * group;
+	time_t leaveTime = time(NULL) + MCAST_LEAVE_TIMEOUT;
+
+	pthread_mutex_lock(&table->mutex);
+	group = (struct switch_mcast_group *) hashMapGetValue(table->map, key);
+	/* Port is kept for last member query time, so other hosts behind it can report */
+	if (group != NULL && (group->members & SWITCH_IF_MASK(iface)) != 0 && group->memberTime[iface->index] > leaveTime)
+		group->memberTime[iface->index] = leaveTime;
+	pthread_mutex_unlock(&table->mutex);
+}
+
+void mcastRouterSeen(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const int isQuery) {
+
+	struct switch_mcast_router * router;
+	struct switch_mactable_key key;
+	u_char noAddress[ETHER_ADDR_LEN] = {0};
+	time_t currTime = time(NULL);
+
+	setMACTableKey(&key, noAddress, vlan);
+
+	pthread_mutex_lock(&table->mutex);
+	router = (struct switch_mcast_router *) hashMapGetValue(table->routers, &key);
+	if (router == NULL) {
+		router = (struct switch_mcast_router *) malloc(sizeof(struct switch_mcast_router));
+		if (router == NULL) {
+			debug_print("%s\n", "Error initializing multicast router");
+			pthread_mutex_unlock(&table->mutex);
+			return;
+		}
+		router->key = key;
+		router->ports = 0;
+		router->lastQuery = 0;
+		if (hashMapInsertValue(table->routers, &key, router) < 0) {
+			debug_print("%s\n", "Error inserting to HASHMAP");
+			free((void *) router);
+			pthread_mutex_unlock(&table->mutex);
+			return;
+		}
+	}
+
+	router->ports |= SWITCH_IF_MASK(iface);
+	router->portTime[iface->index] = currTime + MCAST_ROUTER_TIMEOUT;
+	if (isQuery)
+		router->lastQuery = currTime;
+	pthread_mutex_unlock(&table->mutex);
+}
+
+// Caller holds table mutex
+unsigned long long getMcastRouters(struct switch_mcast_table * table, const unsigned int vlan) {
+
+	struct switch_mcast_router * router;
+	struct switch_mactable_key key;
+	u_char noAddress[ETHER_ADDR_LEN] = {0};
+
+	setMACTableKey(&key, noAddress, vlan);
+	router = (struct switch_mcast_router *) hashMapGetValue(table->routers, &key);
+	return router == NULL ? 0 : router->ports;
+}
+
+void maintainMcastTable(struct switch_mcast_table * table) {
+
+	struct hashMap_item_list * list;
+	unsigned int count;
+	time_t currTime = time(NULL);
+
+	if (table == NULL) {
+		debug_print("%s\n", "Invalid params");
+		return;
+	}
+
+	pthread_mutex_lock(&table->mutex);
+
+	// Age router ports
+	count = table->routers->itemCount;
+	list = (count > 0) ? hashMap2List(table->routers) : NULL;
+	for (int i = 0; list != NULL && i < count; i++) {
+		struct switch_mcast_router * router = (struct switch_mcast_router *) (list + i)->value;
+		if (router == NULL)
+			continue;
+		for (int j = 0; j < SWITCH_MAX_IFS; j++) {
+			if ((router->ports & (1ULL << j)) != 0 && router->portTime[j] <= currTime)
+				router->ports &= ~(1ULL << j);
+		}
+		if (router->ports == 0) {
+			hashMapDeleteValue(table->routers, &router->key);
+			deleteMcastRouter(router);
+		}
+	}
+	if (list != NULL)
+		hashMapDestroyList(list);
+
+	// Age group members
+	count = table->map->itemCount;
+	list = (count > 0) ? hashMap2List(table->map) : NULL;
+	for (int i = 0; list != NULL && i < count; i++) {
+		struct switch_mcast_group * group = (struct switch_mcast_group *) (list + i)->value;
+		if (group == NULL)
+			continue;
+		for (int j = 0; j < SWITCH_MAX_IFS; j++) {
+			if ((group->members & (1ULL << j)) != 0 && group->memberTime[j] <= currTime)
+				group->members &= ~(1ULL << j);
+		}
+		if (group->members == 0) {
+			hashMapDeleteValue(table->map, &group->key);
+			deleteMcastGroup(group);
+		}
+	}
+
+	if (list != NULL)
+		hashMapDestroyList(list);
+	pthread_mutex_unlock(&table->mutex);
+}
+
+void deleteMcastGroup(void * group) {
+	free(group);
+}
+
+void deleteMcastRouter(void * router) {
+	free(router);
+}
+
+void printMcastTable(struct switch_mcast_table * table, struct switch_if * ifs) {
+
+	struct hashMap_item_list * list;
+	unsigned int count;
+	char macAddressString[15];
+	time_t currTime = time(NULL);
+
+	debug_print("%s\n","START");
+
+	if (table == NULL) {
+		debug_print("%s\n","Multicast table not initialized");
+		return;
+	}
+
+	pthread_mutex_lock(&table->mutex);
+
+	user_print("\nVLAN\tLast query\tRouter ports%s", "\n");
+	count = table->routers->itemCount;
+	list = (count > 0) ? hashMap2List(table->routers) : NULL;
+	for (int i = 0; list != NULL && i < count; i++) {
+		struct switch_mcast_router * router = (struct switch_mcast_router *) (list + i)->value;
+		if (router == NULL)
+			continue;
+		user_print("%u\t", (unsigned int) router->key.vlan);
+		if (router->lastQuery != 0)
+			user_print("%ld s ago\t", (long int) (currTime - router->lastQuery));
+		else
+			user_print("%s\t\t", "none");
+		for (struct switch_if * iface = ifs; iface != NULL; iface = iface->next) {
+			if ((router->ports & SWITCH_IF_MASK(iface)) != 0)
+				user_print(" %s(%ld)", iface->name, (long int) (router->portTime[iface->index] - currTime));
+		}
+		user_print("%s\n", "");
+	}
+	if (list != NULL)
+		hashMapDestroyList(list);
+	user_print("%s\n", "Unregistered groups are flooded in VLANs without router port");
+
+	user_print("\nGroup MAC\tVLAN\tPorts%s","\n");
+	count = table->map->itemCount;
+	list = (count > 0) ? hashMap2List(table->map) : NULL;
+	for (int i = 0; list != NULL && i < count; i++) {
+		struct switch_mcast_group * group = (struct switch_mcast_group *) (list + i)->value;
+		if (group == NULL)
+			continue;
+		formatMACAddress(group->key.macAddress, macAddressString);
+		user_print("%s\t%u\t", macAddressString, (unsigned int) group->key.vlan);
+		for (struct switch_if * iface = ifs; iface != NULL; iface = iface->next) {
+			if ((group->members & SWITCH_IF_MASK(iface)) != 0)
+				user_print(" %s(%ld)", iface->name, (long int) (group->memberTime[iface->index] - currTime));
+		}
+		user_print("%s\n", "");
+	}
+
+	if (list != NULL)
+		hashMapDestroyList(list);
+	pthread_mutex_unlock(&table->mutex);
+
+	debug_print("%s\n","END");
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     mcastsnoop.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * IGMP / MLD snooping implementation
+ */
+
+#ifndef _MCASTSNOOP_
+#define _MCASTSNOOP_
+
+#include "switchcore.h"
+#include "mactable.h"
+#include "hashmap.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define MCAST_HASHMAP_SIZE 64
+#define MCAST_MEMBER_TIMEOUT 260 // Group membership interval (RFC 3376)
+#define MCAST_ROUTER_TIMEOUT 255 // Other querier present interval (RFC 3376)
+#define MCAST_LEAVE_TIMEOUT 2 // Last member query time
+
+struct switch_mcast_group { // Multicast group
+	struct switch_mactable_key key; // Group MAC address & VLAN
+	unsigned long long members; // Member ports mask
+	time_t memberTime[SWITCH_MAX_IFS]; // Membership expiry per port
+};
+
+struct switch_mcast_router { // Router (querier) ports of VLAN
+	struct switch_mactable_key key; // Zero MAC address & VLAN
+	unsigned long long ports; // Router ports mask
+	time_t portTime[SWITCH_MAX_IFS]; // Router presence expiry per port
+	time_t lastQuery; // Last query seen in VLAN
+};
+
+struct switch_mcast_table { // Multicast group table
+	struct hashMap * map;
+	struct hashMap * routers; // Keyed by VLAN
+	pthread_mutex_t mutex;
+};
+
+struct switch_mcast_table * initMcastTable();
+void destroyMcastTable(struct switch_mcast_table * table);
+unsigned long long snoopMcastFrame(struct switch_mcast_table * table, struct switch_if * iface, const unsigned int vlan, const u_char * frame, const unsigned int length);
+void maintainMcastTable(struct switch_mcast_table * table);
+void printMcastTable(struct switch_mcast_table * table, struct switch_if * ifs);
+
+#endif
+
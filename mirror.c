@@ -0,0 +1,439 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     mirror.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Port mirroring implementation
+ */
+
+#include "mirror.h"
+#include "switchcore.h"
+#include "switchbuffer.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define MIRROR_IDLE_SLEEP 1000 // Microseconds
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4D
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_PAD(length) (((length) + 3) & ~3U)
+
+/********************************************************************/
+
+struct switch_mirror * initMirror(struct switch_if * ifs);
+void destroyMirror(struct switch_mirror * mirror);
+void mirrorFrame(struct switch_mirror * mirror, const struct switch_buffer_item * item);
+int setMirrorPort(struct switch_mirror * mirror, struct switch_if * iface);
+int setMirrorMAC(struct switch_mirror * mirror, u_char * macAddress);
+int setMirrorFile(struct switch_mirror * mirror, const char * fileName, const unsigned long maxFileSize, const unsigned int maxFiles);
+void setMirrorDestination(struct switch_mirror * mirror, struct switch_if * iface);
+void clearMirror(struct switch_mirror * mirror);
+void printMirror(struct switch_mirror * mirror);
+void updateMirrorState(struct switch_mirror * mirror);
+void * mirrorWriterThread(void * mirror);
+int openMirrorFile(struct switch_mirror * mirror);
+void closeMirrorFile(struct switch_mirror * mirror);
+void writeMirrorFrame(struct switch_mirror * mirror, const struct switch_buffer_item * item);
+void writePcapngUInt32(struct switch_mirror * mirror, const uint32_t value);
+void writePcapngUInt16(struct switch_mirror * mirror, const uint16_t value);
+void writePcapngData(struct switch_mirror * mirror, const void * data, const unsigned int length);
+void writePcapngPadded(struct switch_mirror * mirror, const void * data, const unsigned int length);
+
+/*******************************************************************/
+
+struct switch_mirror * initMirror(struct switch_if * ifs) {
+
+	debug_print("%s\n", "START");
+
+	struct switch_mirror * mirror = (struct switch_mirror *) malloc(sizeof(struct switch_mirror));
+	if (mirror == NULL) {
+		debug_print("%s\n", "Error initializing mirror");
+		return NULL;
+	}
+
+	mirror->enabled = 0;
+	mirror->ports = 0;
+	mirror->macsCount = 0;
+	mirror->ring = NULL;
+	mirror->destIf = NULL;
+	mirror->fileName = NULL;
+	mirror->maxFileSize = MIRROR_FILE_SIZE;
+	mirror->maxFiles = MIRROR_FILES;
+	mirror->file = NULL;
+	mirror->fileSize = 0;
+	mirror->fileIndex = 0;
+	mirror->mirroredFrames = 0;
+	mirror->droppedFrames = 0;
+	mirror->ifs = ifs;
+	pthread_mutex_init(&mirror->mutex, NULL);
+
+	initSwitchBuffer(&mirror->ring, SWITCH_BUFFER_MAX_SIZE);
+	if (mirror->ring == NULL) {
+		debug_print("%s\n", "Error initializing mirror ring");
+		pthread_mutex_destroy(&mirror->mutex);
+		free((void *) mirror);
+		return NULL;
+	}
+
+	// Writer thread
+	mirror->running = 1;
+	if (pthread_create(&mirror->writer_thread, NULL, mirrorWriterThread, (void *) mirror) != 0) {
+		debug_print("%s\n", "Unable to start mirror writer thread");
+		freeSwitchBuffer(&mirror->ring);
+		pthread_mutex_destroy(&mirror->mutex);
+		free((void *) mirror);
+		return NULL;
+	}
+
+	debug_print("%s\n", "END");
+	return mirror;
+}
+
+void destroyMirror(struct switch_mirror * mirror) {
+
+	debug_print("%s\n", "START");
+
+	if (mirror == NULL)
+		return;
+
+	pthread_mutex_lock(&mirror->mutex);
+	mirror->enabled = 0;
+	mirror->running = 0;
+	pthread_mutex_unlock(&mirror->mutex);
+
+	if (pthread_join(mirror->writer_thread, NULL) != 0) {
+		debug_print("%s\n", "Error joining mirror writer thread");
+	}
+
+	closeMirrorFile(mirror);
+	free((void *) mirror->fileName);
+	freeSwitchBuffer(&mirror->ring);
+	pthread_mutex_destroy(&mirror->mutex);
+	free((void *) mirror);
+
+	debug_print("%s\n", "END");
+}
+
+/**
+ * Called by switching thread for each received frame. Never blocks, frame
+ * is dropped (and counted) if the writer falls behind.
+ */
+void mirrorFrame(struct switch_mirror * mirror, const struct switch_buffer_item * item) {
+
+	int mirrored = 0;
+
+	if (mirror == NULL || mirror->enabled == 0)
+		return;
+
+	if ((mirror->ports & SWITCH_IF_MASK(item->receiverIf)) != 0) {
+		mirrored = 1;
+	} else {
+		struct ether_header * frameHdr = (struct ether_header *) item->packetData;
+		for (int i = 0; i < mirror->macsCount && mirrored == 0; i++) {
+			if (memcmp(mirror->macAddresses[i], frameHdr->ether_shost, ETHER_ADDR_LEN) == 0
+					|| memcmp(mirror->macAddresses[i], frameHdr->ether_dhost, ETHER_ADDR_LEN) == 0)
+				mirrored = 1;
+		}
+	}
+
+	if (mirrored == 0)
+		return;
+
+	if (switchBufferQueue(mirror->ring, item->receiverIf, item->packetData, item->size, item->vlan, &item->timestamp) == 0)
+		mirror->droppedFrames++;
+	else
+		mirror->mirroredFrames++;
+}
+
+/**
+ * Mirroring runs only when there is both source and destination.
+ */
+void updateMirrorState(struct switch_mirror * mirror) {
+
+	mirror->enabled = (mirror->ports != 0 || mirror->macsCount > 0) && (mirror->destIf != NULL || mirror->fileName != NULL);
+}
+
+int setMirrorPort(struct switch_mirror * mirror, struct switch_if * iface) {
+
+	if (mirror == NULL || iface == NULL)
+		return 0;
+
+	pthread_mutex_lock(&mirror->mutex);
+	mirror->ports |= SWITCH_IF_MASK(iface);
+	updateMirrorState(mirror);
+	pthread_mutex_unlock(&mirror->mutex);
+
+	return 1;
+}
+
+int setMirrorMAC(struct switch_mirror * mirror, u_char * macAddress) {
+
+	if (mirror == NULL || macAddress == NULL)
+		return 0;
+
+	pthread_mutex_lock(&mirror->mutex);
+	if (mirror->macsCount >= MIRROR_MAX_MACS) {
+		pthread_mutex_unlock(&mirror->mutex);
+		return 0;
+	}
+	memcpy(mirror->macAddresses[mirror->macsCount], macAddress, ETHER_ADDR_LEN);
+	__atomic_store_n(&mirror->macsCount, mirror->macsCount + 1, __ATOMIC_RELEASE);
+	updateMirrorState(mirror);
+	pthread_mutex_unlock(&mirror->mutex);
+
+	return 1;
+}
+
+int setMirrorFile(struct switch_mirror * mirror, const char * fileName, const unsigned long maxFileSize, const unsigned int maxFiles) {
+
+	int ret;
+
+	if (mirror == NULL || fileName == NULL)
+		return 0;
+
+	pthread_mutex_lock(&mirror->mutex);
+	closeMirrorFile(mirror);
+	free((void *) mirror->fileName);
+	mirror->fileName = strdup(fileName);
+	mirror->maxFileSize = maxFileSize > 0 ? maxFileSize : MIRROR_FILE_SIZE;
+	mirror->maxFiles = maxFiles > 0 ? maxFiles : MIRROR_FILES;
+	mirror->fileIndex = 0;
+	ret = openMirrorFile(mirror);
+	if (ret == 0) {
+		free((void *) mirror->fileName);
+		mirror->fileName = NULL;
+	}
+	updateMirrorState(mirror);
+	pthread_mutex_unlock(&mirror->mutex);
+
+	return ret;
+}
+
+void setMirrorDestination(struct switch_mirror * mirror, struct switch_if * iface) {
+
+	if (mirror == NULL)
+		return;
+
+	pthread_mutex_lock(&mirror->mutex);
+	mirror->destIf = iface;
+	updateMirrorState(mirror);
+	pthread_mutex_unlock(&mirror->mutex);
+}
+
+void clearMirror(struct switch_mirror * mirror) {
+
+	if (mirror == NULL)
+		return;
+
+	pthread_mutex_lock(&mirror->mutex);
+	mirror->enabled = 0;
+	mirror->ports = 0;
+	mirror->macsCount = 0;
+	mirror->destIf = NULL;
+	closeMirrorFile(mirror);
+	free((void *) mirror->fileName);
+	mirror->fileName = NULL;
+	pthread_mutex_unlock(&mirror->mutex);
+}
+
+void * mirrorWriterThread(void * mirror) {
+
+	struct switch_mirror * mrr = (struct switch_mirror *) mirror;
+	const struct switch_buffer_item * item;
+	int written;
+
+	while (1) {
+		written = 0;
+
+		pthread_mutex_lock(&mrr->mutex);
+		if (mrr->running == 0) {
+			pthread_mutex_unlock(&mrr->mutex);
+			break;
+		}
+
+		// Write one batch
+		while (written < MIRROR_BATCH_SIZE && (item = switchBufferDequeue(mrr->ring)) != NULL) {
+			if (mrr->destIf != NULL && isSwitchIfOpened(mrr->destIf) == 1)
+				switchBufferQueue(mrr->destIf->sendBuffer, NULL, item->packetData, item->size, mrr->destIf->vlan.pvid, &item->timestamp);
+			if (mrr->file != NULL)
+				writeMirrorFrame(mrr, item);
+			written++;
+		}
+		if (written > 0 && mrr->file != NULL)
+			fflush(mrr->file);
+		pthread_mutex_unlock(&mrr->mutex);
+
+		if (written == 0)
+			usleep(MIRROR_IDLE_SLEEP);
+	}
+
+	debug_print("%s\n", "Thread :: Stopping mirror writer thread");
+	pthread_exit(NULL);
+}
+
+void writePcapngUInt32(struct switch_mirror * mirror, const uint32_t value) {
+	writePcapngData(mirror, &value, sizeof(uint32_t));
+}
+
+void writePcapngUInt16(struct switch_mirror * mirror, const uint16_t value) {
+	writePcapngData(mirror, &value, sizeof(uint16_t));
+}
+
+void writePcapngData(struct switch_mirror * mirror, const void * data, const unsigned int length) {
+
+	fwrite(data, 1, length, mirror->file);
+	mirror->fileSize += length;
+}
+
+/**
+ * Variable length fields are padded to 32 bits.
+ */
+void writePcapngPadded(struct switch_mirror * mirror, const void * data, const unsigned int length) {
+
+	static const u_char padding[4] = {0, 0, 0, 0};
+
+	writePcapngData(mirror, data, length);
+	if (PCAPNG_PAD(length) != length)
+		writePcapngData(mirror, padding, PCAPNG_PAD(length) - length);
+}
+
+/**
+ * Opens next file of rotation and writes section header and interface
+ * description blocks, interface ID is switch interface index.
+ */
+int openMirrorFile(struct switch_mirror * mirror) {
+
+	char fileName[1024];
+
+	if (mirror->maxFiles > 1)
+		snprintf(fileName, sizeof(fileName), "%s.%u", mirror->fileName, mirror->fileIndex % mirror->maxFiles);
+	else
+		snprintf(fileName, sizeof(fileName), "%s", mirror->fileName);
+
+	mirror->file = fopen(fileName, "wb");
+	if (mirror->file == NULL) {
+		error_print("Unable to open mirror file: %s\n", fileName);
+		return 0;
+	}
+	mirror->fileSize = 0;
+
+	// Section header block
+	writePcapngUInt32(mirror, PCAPNG_SHB);
+	writePcapngUInt32(mirror, 28);
+	writePcapngUInt32(mirror, PCAPNG_BYTE_ORDER);
+	writePcapngUInt16(mirror, 1); // Version 1.0
+	writePcapngUInt16(mirror, 0);
+	writePcapngUInt32(mirror, 0xffffffff); // Section length unknown
+	writePcapngUInt32(mirror, 0xffffffff);
+	writePcapngUInt32(mirror, 28);
+
+	// Interface description blocks
+	for (struct switch_if * iface = mirror->ifs; iface != NULL; iface = iface->next) {
+		unsigned int nameLength = strlen(iface->name);
+		uint32_t blockLength = 20 + 4 + PCAPNG_PAD(nameLength) + 4;
+
+		writePcapngUInt32(mirror, PCAPNG_IDB);
+		writePcapngUInt32(mirror, blockLength);
+		writePcapngUInt16(mirror, DLT_EN10MB);
+		writePcapngUInt16(mirror, 0);
+		writePcapngUInt32(mirror, SWITCH_BUFFER_PACKET_DATA_SIZE); // Snap length
+		writePcapngUInt16(mirror, PCAPNG_OPT_IF_NAME);
+		writePcapngUInt16(mirror, nameLength);
+		writePcapngPadded(mirror, iface->name, nameLength);
+		writePcapngUInt32(mirror, 0); // End of options
+		writePcapngUInt32(mirror, blockLength);
+	}
+
+	return 1;
+}
+
+void closeMirrorFile(struct switch_mirror * mirror) {
+
+	if (mirror->file == NULL)
+		return;
+
+	fclose(mirror->file);
+	mirror->file = NULL;
+}
+
+void writeMirrorFrame(struct switch_mirror * mirror, const struct switch_buffer_item * item) {
+
+	uint32_t blockLength = 32 + PCAPNG_PAD(item->size);
+	uint64_t timestamp;
+
+	// Rotate
+	if (mirror->fileSize + blockLength > mirror->maxFileSize) {
+		closeMirrorFile(mirror);
+		mirror->fileIndex++;
+		if (openMirrorFile(mirror) == 0)
+			return;
+	}
+
+	timestamp = (uint64_t) item->timestamp.tv_sec * 1000000 + item->timestamp.tv_usec;
+
+	// Enhanced packet block
+	writePcapngUInt32(mirror, PCAPNG_EPB);
+	writePcapngUInt32(mirror, blockLength);
+	writePcapngUInt32(mirror, item->receiverIf != NULL ? item->receiverIf->index : 0);
+	writePcapngUInt32(mirror, (uint32_t) (timestamp >> 32));
+	writePcapngUInt32(mirror, (uint32_t) timestamp);
+	writePcapngUInt32(mirror, item->size);
+	writePcapngUInt32(mirror, item->size);
+	writePcapngPadded(mirror, item->packetData, item->size);
+	writePcapngUInt32(mirror, blockLength);
+}
+
+void printMirror(struct switch_mirror * mirror) {
+
+	char macAddressString[15];
+
+	if (mirror == NULL)
+		return;
+
+	pthread_mutex_lock(&mirror->mutex);
+	user_print("\nMirroring: %s\n", mirror->enabled ? "enabled" : "disabled");
+	user_print("Source ports:%s", "");
+	for (struct switch_if * iface = mirror->ifs; iface != NULL; iface = iface->next) {
+		if ((mirror->ports & SWITCH_IF_MASK(iface)) != 0)
+			user_print(" %s", iface->name);
+	}
+	user_print("\nSource MACs:%s", "");
+	for (int i = 0; i < mirror->macsCount; i++) {
+		formatMACAddress(mirror->macAddresses[i], macAddressString);
+		user_print(" %s", macAddressString);
+	}
+	user_print("\nMirror port: %s\n", mirror->destIf != NULL ? mirror->destIf->name : "-");
+	if (mirror->fileName != NULL)
+		user_print("File: %s (%lu bytes x %u files, current %u)\n", mirror->fileName, mirror->maxFileSize, mirror->maxFiles, mirror->fileIndex % mirror->maxFiles);
+	else
+		user_print("File: %s\n", "-");
+	user_print("Mirrored frames: %lu, dropped: %lu\n\n", mirror->mirroredFrames, mirror->droppedFrames);
+	pthread_mutex_unlock(&mirror->mutex);
+}
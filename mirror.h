@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     mirror.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Port mirroring implementation
+ */
+
+#ifndef _MIRROR_
+#define _MIRROR_
+
+#include "switchcore.h"
+#include "switchbuffer.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <net/ethernet.h>
+
+#define MIRROR_MAX_MACS 16
+#define MIRROR_BATCH_SIZE 32 // Frames written per file flush
+#define MIRROR_FILE_SIZE (64 * 1024 * 1024) // Default rotation size
+#define MIRROR_FILES 4 // Default count of rotated files
+
+struct switch_mirror { // Port mirroring session
+	unsigned int enabled;
+	unsigned long long ports; // Mirrored (ingress) ports mask
+	u_char macAddresses[MIRROR_MAX_MACS][ETHER_ADDR_LEN]; // Mirrored src or dst
+	unsigned int macsCount;
+	struct switch_buffer * ring; // Frames waiting for writer
+	struct switch_if * destIf; // Mirror port
+	char * fileName; // pcapng output
+	unsigned long maxFileSize;
+	unsigned int maxFiles;
+	FILE * file;
+	unsigned long fileSize;
+	unsigned int fileIndex;
+	unsigned long mirroredFrames;
+	unsigned long droppedFrames; // Writer fell behind
+	struct switch_if * ifs; // For pcapng interface blocks
+	unsigned int running:1;
+	pthread_t writer_thread;
+	pthread_mutex_t mutex;
+};
+
+struct switch_mirror * initMirror(struct switch_if * ifs);
+void destroyMirror(struct switch_mirror * mirror);
+void mirrorFrame(struct switch_mirror * mirror, const struct switch_buffer_item * item);
+int setMirrorPort(struct switch_mirror * mirror, struct switch_if * iface);
+int setMirrorMAC(struct switch_mirror * mirror, u_char * macAddress);
+int setMirrorFile(struct switch_mirror * mirror, const char * fileName, const unsigned long maxFileSize, const unsigned int maxFiles);
+void setMirrorDestination(struct switch_mirror * mirror, struct switch_if * iface);
+void clearMirror(struct switch_mirror * mirror);
+void printMirror(struct switch_mirror * mirror);
+
+#endif
+
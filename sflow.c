@@ -0,0 +1,418 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     sflow.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * sFlow v5 packet sampling & counter export
+ */
+
+#include "sflow.h"
+#include "switchcore.h"
+#include "switchstats.h"
+#include "switchclock.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SFLOW_VERSION 5
+#define SFLOW_ADDRESS_IPV4 1
+#define SFLOW_FLOW_SAMPLE 1 // Enterprise 0 formats
+#define SFLOW_COUNTER_SAMPLE 2
+#define SFLOW_RAW_HEADER 1
+#define SFLOW_GENERIC_COUNTERS 1
+#define SFLOW_PROTOCOL_ETHERNET 1
+#define SFLOW_FCS_LENGTH 4 // Removed by capture, still part of frame length
+#define SFLOW_UNKNOWN 0xFFFFFFFF
+#define SFLOW_HEADER_LENGTH 28 // Datagram header with IPv4 agent
+#define SFLOW_FLOW_LENGTH(headerLength) (64 + (((headerLength) + 3) & ~3U))
+#define SFLOW_COUNTER_LENGTH 116
+
+struct switch_sflow_datagram { // Being filled by exporter
+	u_char data[SFLOW_DATAGRAM_SIZE];
+	unsigned int length;
+	unsigned int samples;
+};
+
+/********************************************************************/
+
+struct switch_sflow * initSFlow(const char * collector, const unsigned int rate, struct switch_if * ifs);
+void destroySFlow(struct switch_sflow * sflow);
+int parseSFlowCollector(const char * collector, struct sockaddr_in * address);
+void sampleSFlow(struct switch_sflow * sflow, const struct switch_buffer_item * item);
+uint32_t getSFlowSkip(struct switch_sflow * sflow, const unsigned int rate);
+void setSFlowRate(struct switch_sflow * sflow, const unsigned int rate);
+void setSFlowCounterInterval(struct switch_sflow * sflow, const unsigned int interval);
+void * sflowExportThread(void * sflow);
+void putSFlow32(struct switch_sflow_datagram * datagram, const uint32_t value);
+void putSFlow64(struct switch_sflow_datagram * datagram, const uint64_t value);
+void addSFlowFlowSample(struct switch_sflow * sflow, struct switch_sflow_datagram * datagram, const struct switch_sflow_sample * sample);
+void addSFlowCounterSample(struct switch_sflow * sflow, struct switch_sflow_datagram * datagram, struct switch_if * iface);
+void sendSFlowDatagram(struct switch_sflow * sflow, struct switch_sflow_datagram * datagram);
+void printSFlow(struct switch_sflow * sflow);
+
+/*******************************************************************/
+
+/**
+ * Collector is "<IPv4>[:<port>]". UDP socket is connected, so its local
+ * address is the one collector sees and is reported as agent address.
+ */
+struct switch_sflow * initSFlow(const char * collector, const unsigned int rate, struct switch_if * ifs) {
+	debug_print("%s\n", "START");
+
+	struct sockaddr_in local;
+	socklen_t localLength = sizeof(local);
+
+	struct switch_sflow * sflow = (struct switch_sflow *) malloc(sizeof(struct switch_sflow));
+	if (sflow == NULL) {
+		debug_print("%s\n", "Error initializing sFlow");
+		return NULL;
+	}
+
+	memset(sflow, 0, sizeof(struct switch_sflow));
+	sflow->socket = -1;
+	sflow->rate = rate;
+	sflow->counterInterval = SFLOW_COUNTER_INTERVAL;
+	sflow->random = (uint32_t) getSwitchClockNanos() | 1;
+	sflow->startTime = getSwitchClockMillis();
+	sflow->ifs = ifs;
+
+	if (parseSFlowCollector(collector, &sflow->collector) == 0) {
+		error_print("Invalid sFlow collector: %s\n", collector);
+		destroySFlow(sflow);
+		return NULL;
+	}
+
+	sflow->socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sflow->socket == -1 || connect(sflow->socket, (struct sockaddr *) &sflow->collector, sizeof(sflow->collector)) == -1) {
+		error_print("Unable to reach sFlow collector: %s\n", collector);
+		destroySFlow(sflow);
+		return NULL;
+	}
+	if (getsockname(sflow->socket, (struct sockaddr *) &local, &localLength) == 0)
+		sflow->agent = local.sin_addr;
+
+	sflow->running = 1;
+	if (pthread_create(&sflow->export_thread, NULL, sflowExportThread, (void *) sflow) != 0) {
+		debug_print("%s\n", "Unable to start sFlow export thread");
+		sflow->running = 0;
+		destroySFlow(sflow);
+		return NULL;
+	}
+
+	debug_print("%s\n", "END");
+	return sflow;
+}
+
+void destroySFlow(struct switch_sflow * sflow) {
+	if (sflow == NULL)
+		return;
+
+	if (sflow->running == 1) {
+		sflow->running = 0;
+		pthread_join(sflow->export_thread, NULL);
+	}
+
+	if (sflow->socket != -1)
+		close(sflow->socket);
+	free((void *) sflow);
+}
+
+int parseSFlowCollector(const char * collector, struct sockaddr_in * address) {
+
+	char host[INET_ADDRSTRLEN];
+	const char * colon = strchr(collector, ':');
+	size_t hostLength = colon == NULL ? strlen(collector) : (size_t) (colon - collector);
+	unsigned long port = SFLOW_DEFAULT_PORT;
+	char * end;
+
+	if (hostLength == 0 || hostLength >= sizeof(host))
+		return 0;
+	memcpy(host, collector, hostLength);
+	host[hostLength] = '\0';
+
+	if (colon != NULL) {
+		port = strtoul(colon + 1, &end, 10);
+		if (*end != '\0' || port == 0 || port > 65535)
+			return 0;
+	}
+
+	memset(address, 0, sizeof(struct sockaddr_in));
+	address->sin_family = AF_INET;
+	address->sin_port = htons(port);
+	return inet_pton(AF_INET, host, &address->sin_addr) == 1 ? 1 : 0;
+}
+
+/**
+ * Called by switching thread for each received frame. Unsampled frames
+ * only count down, sampled ones copy their header into the ring. Nothing
+ * is locked, ring has this thread as its only producer.
+ */
+void sampleSFlow(struct switch_sflow * sflow, const struct switch_buffer_item * item) {
+	if (sflow == NULL)
+		return;
+
+	unsigned int rate = __atomic_load_n(&sflow->rate, __ATOMIC_RELAXED);
+	struct switch_if * iface = item->receiverIf;
+	if (rate == 0 || iface == NULL || iface->index >= SWITCH_MAX_IFS)
+		return;
+
+	struct switch_sflow_port * port = sflow->ports + iface->index;
+	port->pool++;
+	if (port->skip == 0 || port->skip > 2 * rate)
+		port->skip = getSFlowSkip(sflow, rate); // First frame or rate lowered
+	if (--port->skip > 0)
+		return;
+
+	unsigned int head = sflow->head;
+	if (head - __atomic_load_n(&sflow->tail, __ATOMIC_ACQUIRE) >= SFLOW_RING_SIZE) {
+		port->drops++;
+		return;
+	}
+
+	struct switch_sflow_sample * sample = sflow->ring + (head & (SFLOW_RING_SIZE - 1));
+	sample->port = iface->index;
+	sample->rate = rate;
+	sample->pool = port->pool;
+	sample->drops = port->drops;
+	sample->frameLength = item->size;
+	sample->headerLength = item->size < SFLOW_HEADER_SIZE ? item->size : SFLOW_HEADER_SIZE;
+	memcpy(sample->header, item->packetData, sample->headerLength);
+	__atomic_store_n(&sflow->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Random skip, uniform in 1 .. 2 * rate - 1, so mean is rate
+uint32_t getSFlowSkip(struct switch_sflow * sflow, const unsigned int rate) {
+
+	uint32_t random = sflow->random;
+	random ^= random << 13;
+	random ^= random >> 17;
+	random ^= random << 5;
+	sflow->random = random;
+
+	return rate <= 1 ? 1 : 1 + random % (2 * rate - 1);
+}
+
+void setSFlowRate(struct switch_sflow * sflow, const unsigned int rate) {
+	if (sflow != NULL)
+		__atomic_store_n(&sflow->rate, rate, __ATOMIC_RELAXED);
+}
+
+void setSFlowCounterInterval(struct switch_sflow * sflow, const unsigned int interval) {
+	if (sflow != NULL)
+		__atomic_store_n(&sflow->counterInterval, interval, __ATOMIC_RELAXED);
+}
+
+/**
+ * Drains ring into datagrams, sent once full or once ring is empty.
+ * Counter samples of all ports follow every counter interval.
+ */
+void * sflowExportThread(void * sflow) {
+
+	struct switch_sflow * agent = (struct switch_sflow *) sflow;
+	struct switch_sflow_datagram datagram;
+	uint64_t counterTime = getSwitchClockMillis();
+
+	datagram.length = SFLOW_HEADER_LENGTH;
+	datagram.samples = 0;
+
+	while (agent->running == 1) {
+		unsigned int tail = agent->tail;
+		unsigned int head = __atomic_load_n(&agent->head, __ATOMIC_ACQUIRE);
+
+		for (; tail != head; tail++) {
+			const struct switch_sflow_sample * sample = agent->ring + (tail & (SFLOW_RING_SIZE - 1));
+			if (datagram.length + SFLOW_FLOW_LENGTH(sample->headerLength) > SFLOW_DATAGRAM_SIZE)
+				sendSFlowDatagram(agent, &datagram);
+			addSFlowFlowSample(agent, &datagram, sample);
+			__atomic_store_n(&agent->tail, tail + 1, __ATOMIC_RELEASE);
+		}
+
+		unsigned int interval = __atomic_load_n(&agent->counterInterval, __ATOMIC_RELAXED);
+		uint64_t now = getSwitchClockMillis();
+		if (interval > 0 && now - counterTime >= interval * 1000ULL) {
+			for (struct switch_if * iface = agent->ifs; iface != NULL; iface = iface->next) {
+				if (iface->index >= SWITCH_MAX_IFS)
+					continue;
+				if (datagram.length + SFLOW_COUNTER_LENGTH > SFLOW_DATAGRAM_SIZE)
+					sendSFlowDatagram(agent, &datagram);
+				addSFlowCounterSample(agent, &datagram, iface);
+			}
+			counterTime = now;
+		}
+
+		sendSFlowDatagram(agent, &datagram);
+		if (head == __atomic_load_n(&agent->head, __ATOMIC_ACQUIRE))
+			usleep(SFLOW_IDLE_SLEEP);
+	}
+
+	debug_print("%s\n", "Thread :: Stopping sFlow export thread");
+	pthread_exit(NULL);
+}
+
+void putSFlow32(struct switch_sflow_datagram * datagram, const uint32_t value) {
+	uint32_t network = htonl(value);
+	memcpy(datagram->data + datagram->length, &network, sizeof(network));
+	datagram->length += sizeof(network);
+}
+
+void putSFlow64(struct switch_sflow_datagram * datagram, const uint64_t value) {
+	putSFlow32(datagram, (uint32_t) (value >> 32));
+	putSFlow32(datagram, (uint32_t) value);
+}
+
+// Flow sample with one raw packet header record, output port is not known at ingress
+void addSFlowFlowSample(struct switch_sflow * sflow, struct switch_sflow_datagram * datagram, const struct switch_sflow_sample * sample) {
+
+	struct switch_sflow_port * port = sflow->ports + sample->port;
+	unsigned int padded = (sample->headerLength + 3) & ~3U;
+
+	putSFlow32(datagram, SFLOW_FLOW_SAMPLE);
+	putSFlow32(datagram, SFLOW_FLOW_LENGTH(sample->headerLength) - 8);
+	putSFlow32(datagram, ++port->flowSequence);
+	putSFlow32(datagram, sample->port + 1); // ifIndex, 0 is reserved
+	putSFlow32(datagram, sample->rate);
+	putSFlow32(datagram, sample->pool);
+	putSFlow32(datagram, sample->drops);
+	putSFlow32(datagram, sample->port + 1);
+	putSFlow32(datagram, 0);
+	putSFlow32(datagram, 1); // Records
+
+	putSFlow32(datagram, SFLOW_RAW_HEADER);
+	putSFlow32(datagram, 16 + padded);
+	putSFlow32(datagram, SFLOW_PROTOCOL_ETHERNET);
+	putSFlow32(datagram, sample->frameLength + SFLOW_FCS_LENGTH);
+	putSFlow32(datagram, SFLOW_FCS_LENGTH);
+	putSFlow32(datagram, sample->headerLength);
+	memcpy(datagram->data + datagram->length, sample->header, sample->headerLength);
+	memset(datagram->data + datagram->length + sample->headerLength, 0, padded - sample->headerLength);
+	datagram->length += padded;
+
+	datagram->samples++;
+	sflow->samples++;
+}
+
+/**
+ * Generic interface counters. Counters are never reset by 'stat reset',
+ * collectors expect them to only grow. Drops from LAG down on are
+ * charged to egress port, so they are output discards.
+ */
+void addSFlowCounterSample(struct switch_sflow * sflow, struct switch_sflow_datagram * datagram, struct switch_if * iface) {
+
+	struct switch_stats_sample counters;
+	unsigned long drops[E_STATS_DROP_COUNT];
+	uint32_t inDiscards = 0, outDiscards = 0;
+
+	readSwitchStats(&iface->stats, &counters);
+	readSwitchStatsDrops(&iface->stats, drops);
+	for (int reason = 0; reason < E_STATS_DROP_SEND_ERROR; reason++) {
+		if (reason < E_STATS_DROP_LAG_DOWN)
+			inDiscards += drops[reason];
+		else
+			outDiscards += drops[reason];
+	}
+
+	putSFlow32(datagram, SFLOW_COUNTER_SAMPLE);
+	putSFlow32(datagram, SFLOW_COUNTER_LENGTH - 8);
+	putSFlow32(datagram, ++sflow->ports[iface->index].counterSequence);
+	putSFlow32(datagram, iface->index + 1);
+	putSFlow32(datagram, 1); // Records
+
+	putSFlow32(datagram, SFLOW_GENERIC_COUNTERS);
+	putSFlow32(datagram, 88);
+	putSFlow32(datagram, iface->index + 1);
+	putSFlow32(datagram, 6); // ethernetCsmacd
+	putSFlow64(datagram, 0); // Speed not known
+	putSFlow32(datagram, 0); // Direction not known
+	putSFlow32(datagram, (isSwitchIfOpened(iface) == 1 ? 1 : 0) | (iface->linkUp == 1 ? 2 : 0));
+	putSFlow64(datagram, counters.receivedBytes);
+	putSFlow32(datagram, counters.receivedFrames); // Not split by cast
+	putSFlow32(datagram, SFLOW_UNKNOWN);
+	putSFlow32(datagram, SFLOW_UNKNOWN);
+	putSFlow32(datagram, inDiscards);
+	putSFlow32(datagram, 0);
+	putSFlow32(datagram, SFLOW_UNKNOWN);
+	putSFlow64(datagram, counters.sentBytes);
+	putSFlow32(datagram, counters.sentFrames);
+	putSFlow32(datagram, SFLOW_UNKNOWN);
+	putSFlow32(datagram, SFLOW_UNKNOWN);
+	putSFlow32(datagram, outDiscards);
+	putSFlow32(datagram, drops[E_STATS_DROP_SEND_ERROR]);
+	putSFlow32(datagram, 1); // Promiscuous capture
+
+	datagram->samples++;
+}
+
+void sendSFlowDatagram(struct switch_sflow * sflow, struct switch_sflow_datagram * datagram) {
+	if (datagram->samples == 0)
+		return;
+
+	unsigned int length = datagram->length;
+	datagram->length = 0;
+	putSFlow32(datagram, SFLOW_VERSION);
+	putSFlow32(datagram, SFLOW_ADDRESS_IPV4);
+	memcpy(datagram->data + datagram->length, &sflow->agent, 4);
+	datagram->length += 4;
+	putSFlow32(datagram, 0); // Sub agent
+	putSFlow32(datagram, ++sflow->sequence);
+	putSFlow32(datagram, (uint32_t) (getSwitchClockMillis() - sflow->startTime));
+	putSFlow32(datagram, datagram->samples);
+
+	if (send(sflow->socket, datagram->data, length, 0) == -1)
+		sflow->sendErrors++; // Collector not listening, ICMP refused
+
+	datagram->length = SFLOW_HEADER_LENGTH;
+	datagram->samples = 0;
+}
+
+void printSFlow(struct switch_sflow * sflow) {
+	if (sflow == NULL) {
+		user_print("%s\n","sFlow not enabled, see -F");
+		return;
+	}
+
+	char collector[INET_ADDRSTRLEN], agent[INET_ADDRSTRLEN];
+	unsigned long drops = 0;
+
+	inet_ntop(AF_INET, &sflow->collector.sin_addr, collector, sizeof(collector));
+	inet_ntop(AF_INET, &sflow->agent, agent, sizeof(agent));
+	for (int i = 0; i < SWITCH_MAX_IFS; i++)
+		drops += sflow->ports[i].drops;
+
+	user_print("\nsFlow v5 to %s:%u, agent %s\n", collector, ntohs(sflow->collector.sin_port), agent);
+	if (sflow->rate == 0)
+		user_print("%s\n", "Sampling:          off");
+	else
+		user_print("Sampling:          1 in %u frames\n", sflow->rate);
+	user_print("Counter interval:  %u s\n", sflow->counterInterval);
+	user_print("Flow samples:      %lu\n", sflow->samples);
+	user_print("Lost samples:      %lu\n", drops);
+	user_print("Datagrams:         %u\n", sflow->sequence);
+	user_print("Send errors:       %lu\n\n", sflow->sendErrors);
+}
+
@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     sflow.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * sFlow v5 packet sampling & counter export
+ */
+
+#ifndef _SFLOW_
+#define _SFLOW_
+
+#include "switchcore.h"
+#include "switchbuffer.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define SFLOW_DEFAULT_PORT 6343
+#define SFLOW_RATE 1024 // Default 1 in N frames
+#define SFLOW_COUNTER_INTERVAL 20 // Seconds between counter samples
+#define SFLOW_HEADER_SIZE 128 // Bytes of sampled frame exported
+#define SFLOW_RING_SIZE 1024 // Samples waiting for exporter, power of 2
+#define SFLOW_DATAGRAM_SIZE 1400 // Fits into usual MTU
+#define SFLOW_IDLE_SLEEP 10000 // Microseconds
+
+struct switch_sflow_sample { // Sampled frame, written by switching thread only
+	unsigned int port; // Index of receiving interface
+	unsigned int rate;
+	uint32_t pool; // Frames seen by sampler of port
+	uint32_t drops; // Samples lost because ring was full
+	unsigned int frameLength;
+	unsigned int headerLength;
+	u_char header[SFLOW_HEADER_SIZE];
+};
+
+struct switch_sflow_port { // Sampler of port, written by switching thread only
+	uint32_t skip; // Frames till next sample
+	uint32_t pool;
+	uint32_t drops;
+	uint32_t flowSequence; // Written by exporter
+	uint32_t counterSequence;
+} __attribute__((aligned(64)));
+
+struct switch_sflow { // sFlow agent
+	int socket; // Connected to collector
+	struct sockaddr_in collector;
+	struct in_addr agent; // Local address towards collector
+	unsigned int rate; // 1 in N, 0 - sampling off
+	unsigned int counterInterval; // Seconds, 0 - no counter samples
+	uint32_t random; // Xorshift state of switching thread
+	struct switch_sflow_port ports[SWITCH_MAX_IFS];
+	struct switch_sflow_sample ring[SFLOW_RING_SIZE]; // Single producer & consumer
+	unsigned int head; // Next written by switching thread
+	unsigned int tail; // Next read by exporter
+	uint32_t sequence; // Datagrams sent
+	unsigned long samples; // Flow samples exported
+	unsigned long sendErrors;
+	uint64_t startTime; // Switch clock, milliseconds
+	struct switch_if * ifs; // For counter samples
+	unsigned int running:1;
+	pthread_t export_thread;
+};
+
+struct switch_sflow * initSFlow(const char * collector, const unsigned int rate, struct switch_if * ifs);
+void destroySFlow(struct switch_sflow * sflow);
+void sampleSFlow(struct switch_sflow * sflow, const struct switch_buffer_item * item);
+void setSFlowRate(struct switch_sflow * sflow, const unsigned int rate);
+void setSFlowCounterInterval(struct switch_sflow * sflow, const unsigned int interval);
+void printSFlow(struct switch_sflow * sflow);
+
+#endif
+
@@ -25,12 +25,125 @@
  */
 
 #include "switchcore.h"
+#include "macsnapshot.h"
+#include "switchtrace.h"
+#include "sflow.h"
 #include "utils.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+
+void printUsage(const char * program);
+int parseArguments(int argc, char * argv[], struct switch_config * config);
+
+void printUsage(const char * program) {
+	user_print("Usage: %s [options]\n", program);
+	user_print("%s\n","  -a <role>:<cpus>   place threads of role (listen, send, switch, maintain)");
+	user_print("%s\n","                     on CPUs: numa (port's NIC node), list (2-5,8) or none");
+	user_print("%s\n","  -p <role>:<prio>   run threads of role with SCHED_FIFO priority");
+	user_print("%s\n","  -m                 lock switch memory (mlockall)");
+	user_print("%s\n","  -c <slots>         initial MAC table capacity");
+	user_print("%s\n","  -H crc32c|siphash  MAC table hash, default SipHash, CRC32C for trusted hosts");
+	user_print("%s\n","  -l <entries>       MAC table limit");
+	user_print("%s\n","  -L <entries>       MAC table limit of each port");
+	user_print("%s\n","  -A stop|evict|drop action on MAC table limit, default stop");
+	user_print("%s\n","  -s <file>          MAC table snapshot, loaded on start, saved on quit");
+	user_print("%s\n","  -S <seconds>       MAC table snapshot interval, 0 - on quit only");
+	user_print("%s\n","  -r <s>[,<s>..]     port rate windows, default 1,10,60 seconds");
+	user_print("%s\n","  -M <path>          serve Prometheus metrics on Unix socket");
+	user_print("%s\n","  -P <port>          serve Prometheus metrics on localhost TCP port");
+	user_print("%s\n","  -T <file>          trace from start, dump trace rings to file on crash");
+	user_print("%s\n","  -F <ip>[:<port>]   export sFlow v5 to collector, default port 6343");
+	user_print("%s\n","  -N <n>             sFlow sampling of 1 in n frames, default 1024");
+	user_print("%s\n","  -h                 show this help");
+}
+
+int parseArguments(int argc, char * argv[], struct switch_config * config) {
+
+	int option;
+	char * end;
+
+	while ((option = getopt(argc, argv, "a:p:mc:H:l:L:A:s:S:r:M:P:T:F:N:h")) != -1) {
+		switch (option) {
+			case 'a':
+				if (setSwitchAffinityPlacement(&config->affinity, optarg) == 0)
+					return 0;
+				break;
+			case 'p':
+				if (setSwitchAffinityPriority(&config->affinity, optarg) == 0)
+					return 0;
+				break;
+			case 'm':
+				config->affinity.lockMemory = 1;
+				break;
+			case 'c':
+				config->macTableCapacity = strtoul(optarg, &end, 10);
+				if (*end != '\0' || config->macTableCapacity == 0)
+					return 0;
+				break;
+			case 'H':
+				if (strcmp(optarg, "crc32c") == 0)
+					config->macHash = E_MACHASH_CRC32C;
+				else if (strcmp(optarg, "siphash") == 0)
+					config->macHash = E_MACHASH_SIPHASH;
+				else
+					return 0;
+				break;
+			case 'l':
+				config->macTableLimit = strtoul(optarg, &end, 10);
+				if (*end != '\0')
+					return 0;
+				break;
+			case 'L':
+				config->macPortLimit = strtoul(optarg, &end, 10);
+				if (*end != '\0')
+					return 0;
+				break;
+			case 'A':
+				if (getMACTableLimitAction(optarg, &config->macLimitAction) == 0)
+					return 0;
+				break;
+			case 's':
+				config->macSnapshotFile = optarg;
+				break;
+			case 'S':
+				config->macSnapshotInterval = strtoul(optarg, &end, 10);
+				if (*end != '\0')
+					return 0;
+				break;
+			case 'r':
+				if (parseSwitchStatsWindows(optarg, config->statsWindows) == 0)
+					return 0;
+				break;
+			case 'T':
+				config->traceFile = optarg;
+				break;
+			case 'F':
+				config->sflowCollector = optarg;
+				break;
+			case 'N':
+				config->sflowRate = strtoul(optarg, &end, 10);
+				if (*end != '\0')
+					return 0;
+				break;
+			case 'M':
+				config->metricsSocket = optarg;
+				break;
+			case 'P':
+				config->metricsPort = strtoul(optarg, &end, 10);
+				if (*end != '\0' || config->metricsPort == 0 || config->metricsPort > 65535)
+					return 0;
+				break;
+			default:
+				return 0;
+		}
+	}
+
+	return 1;
+}
 
 int main(int argc, char * argv[]) {
 
@@ -42,9 +155,44 @@ int main(int argc, char * argv[]) {
 	device.started &= 0;
 	device.if_count &= 0;
 	device.ifs = NULL;
+	device.lags = NULL;
 	device.mac_table = NULL;
+	device.mcast_table = NULL;
+	device.flow_cache = NULL;
+	device.mirror = NULL;
+	device.metrics = NULL;
+	device.top_talkers = NULL;
+	device.sflow = NULL;
 	device.swtch_thread = 0;
 	pthread_mutex_init(&device.mutex, NULL);
+	initSwitchAffinity(&device.config.affinity);
+	device.config.macTableCapacity = MACTABLE_MIN_CAPACITY;
+	device.config.macTableTimeout = SWITCH_MACTABLE_TIMEOUT;
+	device.config.macHash = E_MACHASH_AUTO;
+	device.config.macTableLimit = 0;
+	device.config.macPortLimit = 0;
+	device.config.macLimitAction = E_MACLIMIT_STOP;
+	device.config.macSnapshotFile = NULL;
+	device.config.macSnapshotInterval = MACSNAPSHOT_INTERVAL;
+	device.config.statsWindows[0] = 1;
+	device.config.statsWindows[1] = 10;
+	device.config.statsWindows[2] = 60;
+	device.config.metricsSocket = NULL;
+	device.config.metricsPort = 0;
+	device.config.traceFile = NULL;
+	device.config.sflowCollector = NULL;
+	device.config.sflowRate = SFLOW_RATE;
+
+	if (parseArguments(argc, argv, &device.config) == 0) {
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (initMACHash(device.config.macHash) == 0)
+		return EXIT_FAILURE;
+
+	if (device.config.traceFile != NULL && enableSwitchTrace(SWITCHTRACE_ENTRIES, device.config.traceFile) == 0)
+		return EXIT_FAILURE;
 
 	// Start switch automatically
 	fireSwitchCommand(&device, "start");
@@ -62,6 +210,7 @@ int main(int argc, char * argv[]) {
 
 	// Destroy mutex
 	pthread_mutex_destroy(&device.mutex);
+	destroySwitchTrace();
 
 	return EXIT_SUCCESS;
 }
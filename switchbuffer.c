@@ -27,9 +27,12 @@
 #include "switchbuffer.h"
 #include "utils.h"
 #include "switchcore.h"
+#include "switchclock.h"
+#include "switchtrace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pcap.h>
 #include <pthread.h>
 
@@ -37,8 +40,14 @@
 
 void initSwitchBuffer(struct switch_buffer ** buffer, unsigned int size);
 void freeSwitchBuffer(struct switch_buffer ** buffer);
-int switchBufferQueue(struct switch_buffer * buffer, struct switch_if * receiverIf, const u_char * packetData, const int packetLength);
+int switchBufferQueue(struct switch_buffer * buffer, struct switch_if * receiverIf, const u_char * packetData, const int packetLength, const unsigned int vlan, const struct timeval * timestamp);
 const struct switch_buffer_item * switchBufferDequeue(struct switch_buffer * buffer);
+unsigned int switchBufferPeek(struct switch_buffer * buffer, const struct switch_buffer_item ** items, const unsigned int max);
+void switchBufferRelease(struct switch_buffer * buffer, const unsigned int count);
+unsigned int getSwitchBufferDepth(struct switch_buffer * buffer);
+void updateSwitchBufferDepth(struct switch_buffer * buffer);
+void getSwitchBufferTelemetry(struct switch_buffer * buffer, struct switch_buffer_telemetry * telemetry);
+void resetSwitchBufferStats(struct switch_buffer * buffer);
 
 /**************************************************************/
 
@@ -65,6 +74,8 @@ void initSwitchBuffer(struct switch_buffer ** buffer, unsigned int size) {
 	(*buffer)->size = size;
 	(*buffer)->start = 0;
 	(*buffer)->end = 0;
+	memset(&(*buffer)->stats, 0, sizeof(struct switch_buffer_stats));
+	(*buffer)->stats.depthTime = (*buffer)->stats.resetTime = getSwitchClockNanos();
 
 	// Init MUTEX
 	pthread_mutex_init(&(*buffer)->mutex, NULL);
@@ -111,7 +122,7 @@ void freeSwitchBuffer(struct switch_buffer ** buffer) {
 }
 
 
-int switchBufferQueue(struct switch_buffer * buffer, struct switch_if * receiverIf,const u_char * packetData, const int packetLength) {	
+int switchBufferQueue(struct switch_buffer * buffer, struct switch_if * receiverIf,const u_char * packetData, const int packetLength, const unsigned int vlan, const struct timeval * timestamp) {	
 
 	if (buffer == NULL) {
 		debug_print("%s\n", "Cannot queue to unitialized buffer");
@@ -126,19 +137,30 @@ int switchBufferQueue(struct switch_buffer * buffer, struct switch_if * receiver
 				buffer->end, 
 				(buffer->start-1) % buffer->size,
 				buffer->end);*/
+		buffer->stats.fullEvents++;
 		pthread_mutex_unlock(&buffer->mutex);
 		return 0; // Not added
 	}
 
+	updateSwitchBufferDepth(buffer);
 	
 	// Add to queue
 	buffer->items[buffer->end].receiverIf = receiverIf;
+	buffer->items[buffer->end].vlan = vlan;
+	if (timestamp != NULL)
+		buffer->items[buffer->end].timestamp = *timestamp;
+	else
+		timerclear(&buffer->items[buffer->end].timestamp);
 	buffer->items[buffer->end].size = packetLength;
 
 	//TODO: Memcpy or packet reference counter?
 	//buffer->items[buffer->end].packetData = packetData;
 	memcpy(buffer->items[buffer->end].packetData, packetData,sizeof(char) * packetLength);
 	buffer->end = (buffer->end + 1) % buffer->size;
+	buffer->stats.enqueued++;
+	if (getSwitchBufferDepth(buffer) > buffer->stats.highWatermark)
+		buffer->stats.highWatermark = getSwitchBufferDepth(buffer);
+	SWITCH_TRACE(enqueue, E_TRACE_ENQUEUE, receiverIf == NULL ? -1 : receiverIf->index, getSwitchBufferDepth(buffer), (uintptr_t) buffer);
 
 	pthread_mutex_unlock(&buffer->mutex);
 	
@@ -161,11 +183,104 @@ const struct switch_buffer_item * switchBufferDequeue(struct switch_buffer * buf
 	        return NULL; // No data
 	}
 	
+	updateSwitchBufferDepth(buffer);
 	retItem =  &buffer->items[buffer->start]; // Data returned
 	buffer->start = (buffer->start + 1) % buffer->size; // Dequeue
+	buffer->stats.dequeued++;
+	SWITCH_TRACE(dequeue, E_TRACE_DEQUEUE, -1, 1, (uintptr_t) buffer);
 
 	pthread_mutex_unlock(&buffer->mutex);
 
 	return retItem;
 }
 
+/**
+ * Returns up to max oldest items, which stay queued. Unlike dequeued item,
+ * they cannot be overwritten by producer until released.
+ */
+unsigned int switchBufferPeek(struct switch_buffer * buffer, const struct switch_buffer_item ** items, const unsigned int max) {
+
+	unsigned int count = 0;
+	unsigned int index;
+
+	if (buffer == NULL) {
+		debug_print("%s\n", "Cannot peek unitialized buffer");
+		return 0;
+	}
+
+	pthread_mutex_lock(&buffer->mutex);
+	index = buffer->start;
+	while (index != buffer->end && count < max) {
+		items[count++] = &buffer->items[index];
+		index = (index + 1) % buffer->size;
+	}
+	pthread_mutex_unlock(&buffer->mutex);
+
+	return count;
+}
+
+/**
+ * Dequeues count items returned by switchBufferPeek.
+ */
+void switchBufferRelease(struct switch_buffer * buffer, const unsigned int count) {
+
+	if (buffer == NULL || count == 0)
+		return;
+
+	pthread_mutex_lock(&buffer->mutex);
+	updateSwitchBufferDepth(buffer);
+	buffer->start = (buffer->start + count) % buffer->size;
+	buffer->stats.dequeued += count;
+	SWITCH_TRACE(dequeue, E_TRACE_DEQUEUE, -1, count, (uintptr_t) buffer);
+	pthread_mutex_unlock(&buffer->mutex);
+}
+
+// Called with mutex held
+unsigned int getSwitchBufferDepth(struct switch_buffer * buffer) {
+	return (buffer->end + buffer->size - buffer->start) % buffer->size;
+}
+
+/**
+ * Accounts time spent at current depth, called with mutex held before depth
+ * changes. Switch clock is cached, so it costs no system call.
+ */
+void updateSwitchBufferDepth(struct switch_buffer * buffer) {
+	uint64_t now = getSwitchClockNanos();
+
+	if (now > buffer->stats.depthTime) {
+		buffer->stats.depthArea += getSwitchBufferDepth(buffer) * (now - buffer->stats.depthTime);
+		buffer->stats.depthTime = now;
+	}
+}
+
+void getSwitchBufferTelemetry(struct switch_buffer * buffer, struct switch_buffer_telemetry * telemetry) {
+
+	memset(telemetry, 0, sizeof(struct switch_buffer_telemetry));
+	if (buffer == NULL)
+		return;
+
+	pthread_mutex_lock(&buffer->mutex);
+	updateSwitchBufferDepth(buffer);
+	telemetry->size = buffer->size - 1; // One item is always kept free
+	telemetry->depth = getSwitchBufferDepth(buffer);
+	telemetry->highWatermark = buffer->stats.highWatermark;
+	telemetry->enqueued = buffer->stats.enqueued;
+	telemetry->dequeued = buffer->stats.dequeued;
+	telemetry->fullEvents = buffer->stats.fullEvents;
+	if (buffer->stats.depthTime > buffer->stats.resetTime)
+		telemetry->averageDepth = (double) buffer->stats.depthArea / (buffer->stats.depthTime - buffer->stats.resetTime);
+	else
+		telemetry->averageDepth = telemetry->depth;
+	pthread_mutex_unlock(&buffer->mutex);
+}
+
+void resetSwitchBufferStats(struct switch_buffer * buffer) {
+	if (buffer == NULL)
+		return;
+
+	pthread_mutex_lock(&buffer->mutex);
+	memset(&buffer->stats, 0, sizeof(struct switch_buffer_stats));
+	buffer->stats.highWatermark = getSwitchBufferDepth(buffer);
+	buffer->stats.depthTime = buffer->stats.resetTime = getSwitchClockNanos();
+	pthread_mutex_unlock(&buffer->mutex);
+}
@@ -31,28 +31,57 @@
 
 #include <pcap.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/time.h>
 
 #define SWITCH_BUFFER_MAX_SIZE 100
 #define SWITCH_BUFFER_PACKET_DATA_SIZE BUFSIZ // Same as pcap_next buffer
 
 struct switch_buffer_item {
 	struct switch_if * receiverIf;
+	unsigned int vlan;
+	struct timeval timestamp; // Ingress time
 	unsigned int size;
 	u_char * packetData;
 };
 
+struct switch_buffer_stats { // Ring occupancy, kept under buffer mutex
+	unsigned long enqueued;
+	unsigned long dequeued;
+	unsigned long fullEvents; // Items refused by full ring
+	unsigned int highWatermark; // Since reset
+	uint64_t depthArea; // Sum of depth x nanoseconds, since reset
+	uint64_t depthTime; // Switch clock of last depth change
+	uint64_t resetTime;
+};
+
+struct switch_buffer_telemetry { // Snapshot of ring occupancy
+	unsigned int size; // Usable items
+	unsigned int depth;
+	unsigned int highWatermark;
+	double averageDepth; // Time weighted
+	unsigned long enqueued;
+	unsigned long dequeued;
+	unsigned long fullEvents;
+};
+
 struct switch_buffer {
 	struct switch_buffer_item * items;
 	unsigned int size;
 	unsigned int start;
 	unsigned int end;
+	struct switch_buffer_stats stats;
 	pthread_mutex_t mutex;
 };
 
 void initSwitchBuffer(struct switch_buffer ** buffer, unsigned int size); 
 void freeSwitchBuffer(struct switch_buffer ** buffer);
-int switchBufferQueue(struct switch_buffer * buffer, struct switch_if * receiverIf, const u_char * packetData, const int packetLength);
+int switchBufferQueue(struct switch_buffer * buffer, struct switch_if * receiverIf, const u_char * packetData, const int packetLength, const unsigned int vlan, const struct timeval * timestamp);
 const struct switch_buffer_item * switchBufferDequeue(struct switch_buffer * buffer);
+unsigned int switchBufferPeek(struct switch_buffer * buffer, const struct switch_buffer_item ** items, const unsigned int max);
+void switchBufferRelease(struct switch_buffer * buffer, const unsigned int count);
+void getSwitchBufferTelemetry(struct switch_buffer * buffer, struct switch_buffer_telemetry * telemetry);
+void resetSwitchBufferStats(struct switch_buffer * buffer);
 
 #endif
 
@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchclock.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Switch wide coarse clock
+ */
+
+#include "switchclock.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct switch_clock switchClock;
+
+/********************************************************************/
+
+int startSwitchClock();
+void stopSwitchClock();
+void updateSwitchClock();
+pthread_t getSwitchClockThread();
+uint64_t getSwitchClockNanos();
+uint64_t getSwitchClockMillis();
+uint32_t getSwitchClockSeconds();
+void * switchClockThread(void * arg);
+
+/*******************************************************************/
+
+/**
+ * Clock is valid as soon as it is started, before the thread runs.
+ */
+int startSwitchClock() {
+
+	if (switchClock.running == 1)
+		return 1;
+
+	updateSwitchClock();
+	switchClock.running = 1;
+	if (pthread_create(&switchClock.thread, NULL, switchClockThread, NULL) != 0) {
+		switchClock.running = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+void stopSwitchClock() {
+
+	if (switchClock.running == 0)
+		return;
+
+	__atomic_store_n(&switchClock.running, 0, __ATOMIC_RELEASE);
+	pthread_join(switchClock.thread, NULL);
+}
+
+void updateSwitchClock() {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	__atomic_store_n(&switchClock.nanos, (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec, __ATOMIC_RELAXED);
+}
+
+pthread_t getSwitchClockThread() {
+	return switchClock.thread;
+}
+
+/**
+ * Readers pay one load, clock resolution is the update period. Clock
+ * read before start is sampled once.
+ */
+uint64_t getSwitchClockNanos() {
+
+	uint64_t nanos = __atomic_load_n(&switchClock.nanos, __ATOMIC_RELAXED);
+
+	if (nanos == 0) {
+		updateSwitchClock();
+		nanos = __atomic_load_n(&switchClock.nanos, __ATOMIC_RELAXED);
+	}
+
+	return nanos;
+}
+
+uint64_t getSwitchClockMillis() {
+	return getSwitchClockNanos() / 1000000;
+}
+
+uint32_t getSwitchClockSeconds() {
+	return (uint32_t) (getSwitchClockNanos() / 1000000000);
+}
+
+void * switchClockThread(void * arg) {
+
+	while (__atomic_load_n(&switchClock.running, __ATOMIC_ACQUIRE) == 1) {
+		updateSwitchClock();
+		usleep(SWITCHCLOCK_TICK);
+	}
+
+	debug_print("%s\n", "Thread :: Stopping clock thread");
+	pthread_exit(NULL);
+}
+
@@ -0,0 +1,50 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchclock.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Switch wide coarse clock
+ */
+
+#ifndef _SWITCHCLOCK_
+#define _SWITCHCLOCK_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define SWITCHCLOCK_TICK 1000 // Update period, microseconds
+
+struct switch_clock { // Monotonic clock, updated by its own thread
+	uint64_t nanos;
+	unsigned int running;
+	pthread_t thread;
+};
+
+int startSwitchClock();
+void stopSwitchClock();
+void updateSwitchClock();
+pthread_t getSwitchClockThread();
+uint64_t getSwitchClockNanos();
+uint64_t getSwitchClockMillis();
+uint32_t getSwitchClockSeconds();
+
+#endif
+
@@ -27,6 +27,15 @@
 #include "switchcore.h"
 #include "utils.h"
 #include "mactable.h"
+#include "mcastsnoop.h"
+#include "flowcache.h"
+#include "mirror.h"
+#include "switchclock.h"
+#include "macsnapshot.h"
+#include "switchmetrics.h"
+#include "switchtrace.h"
+#include "toptalkers.h"
+#include "sflow.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -36,10 +45,11 @@
 #include <netinet/if_ether.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
 #include <libnet.h>
 
-#define SWITCH_COMMANDS_COUNT 6
-char * switchCommands[] = {"start", "quit", "cam", "stat", "help", "const"};
+#define SWITCH_COMMANDS_COUNT 19
+char * switchCommands[] = {"start", "quit", "cam", "stat", "help", "const", "mcast", "vlan", "lag", "mirror", "aging", "limit", "static", "snapshot", "rate", "lat", "trace", "top", "sflow"};
 enum e_switchCommand {
 				E_SWITCH_COMMAND_NONE = -2,
 				E_SWITCH_COMMAND_INVALID = -1,
@@ -48,14 +58,44 @@ enum e_switchCommand {
 				E_SWITCH_COMMAND_MAC,
 				E_SWITCH_COMMAND_STATS,
 				E_SWITCH_COMMAND_HELP,
-				E_SWITCH_COMMAND_CONST};
+				E_SWITCH_COMMAND_CONST,
+				E_SWITCH_COMMAND_MCAST,
+				E_SWITCH_COMMAND_VLAN,
+				E_SWITCH_COMMAND_LAG,
+				E_SWITCH_COMMAND_MIRROR,
+				E_SWITCH_COMMAND_AGING,
+				E_SWITCH_COMMAND_LIMIT,
+				E_SWITCH_COMMAND_STATIC,
+				E_SWITCH_COMMAND_SNAPSHOT,
+				E_SWITCH_COMMAND_RATE,
+				E_SWITCH_COMMAND_LATENCY,
+				E_SWITCH_COMMAND_TRACE,
+				E_SWITCH_COMMAND_TOP,
+				E_SWITCH_COMMAND_SFLOW};
 
 /********************************************************************/
 
 void printHelp();
-void printStats(struct switch_dev * device);
-void printCAM(struct switch_dev * device);
-void printConstants();
+void printStats(struct switch_dev * device, char * args);
+void printRings(struct switch_dev * device);
+void printDrops(struct switch_dev * device);
+void printRing(const char * name, const char * direction, struct switch_buffer * buffer);
+void printRates(struct switch_dev * device, char * args);
+void printLatency(struct switch_dev * device, char * args);
+void printCAM(struct switch_dev * device, char * args);
+int parseCAMFilter(struct switch_dev * device, char * args, struct switch_mactable_filter * filter);
+void printMcast(struct switch_dev * device);
+void printConstants(struct switch_dev * device);
+void configureVlan(struct switch_dev * device, char * args);
+void configureLag(struct switch_dev * device, char * args);
+void configureMirror(struct switch_dev * device, char * args);
+void configureAging(struct switch_dev * device, char * args);
+void configureLimit(struct switch_dev * device, char * args);
+void configureStatic(struct switch_dev * device, char * args);
+void saveSnapshot(struct switch_dev * device, char * args);
+void configureTrace(struct switch_dev * device, char * args);
+void configureTopTalkers(struct switch_dev * device, char * args);
+void configureSFlow(struct switch_dev * device, char * args);
 enum e_switchCommand getSwitchCommand(char * command);
 int fireSwitchCommand(struct switch_dev * device, char * command);
 unsigned int getSwitchState(struct switch_dev * dev);
@@ -64,21 +104,26 @@ int switchStartup(struct switch_dev * swtch);
 void switchShutdown(struct switch_dev * swtch);
 int loadSwitchIfs(struct switch_if ** iterface, char * errorMsg);
 int getSwitchOpenedIfsCount(struct switch_dev * dev);
+struct switch_if * getSwitchIfByName(struct switch_dev * dev, const char * name);
 void resetSwitchIfStats(struct switch_if * ifs);
-void openSwitchIf(struct switch_if * iface, char * errorMsg);
-int openSwitchIfs(struct switch_if * ifaces, char * errorMsg);
+pcap_t * openSwitchIfCapture(const char * name, char * error);
+void openSwitchIf(struct switch_if * iface, struct switch_affinity * affinity, char * errorMsg);
+int openSwitchIfs(struct switch_if * ifaces, struct switch_affinity * affinity, char * errorMsg);
 void closeSwitchIf(struct switch_if * iface, char * errorMsg);
 void * switchIfListeningThread(void * iface);
 void * switchIfSendingThread(void * iface);
 unsigned int isSwitchIfOpened(struct switch_if * iface);
 void setSwitchIfState(struct switch_if * iface, int isOpened);
-void incSwitchIfStats(struct switch_if * iface, long * counter, const int amount);
-void getSwitchifStats(struct switch_if * iface, long * counter, long * value);
+void recordSwitchIfLatency(struct switch_if * iface, const struct switch_buffer_item * item);
 int startSwitching(struct switch_dev * dev, char * errorMsg);
 void * switchMACTableMaintainThread(void * dev);
 void * switchSwitchingThread(void * dev);
-void sendBroadcast(struct switch_dev * dev, const struct switch_buffer_item * item);
-void sendUnicast(struct switch_if * iface, const struct switch_buffer_item * item);
+void switchFrames(struct switch_dev * device, struct switch_flowcache * cache, const struct switch_buffer_item ** items, const unsigned int count);
+void switchFrame(struct switch_dev * device, struct switch_flowcache * cache, const struct switch_burst_frame * frame, const unsigned long generation, const struct switch_mactable_result * results);
+void sendBroadcast(struct switch_dev * dev, const struct switch_buffer_item * item, const unsigned int vlan);
+void sendUnicast(struct switch_if * port, const struct switch_buffer_item * item, const unsigned int vlan);
+void sendMulticast(struct switch_dev * dev, const struct switch_buffer_item * item, const unsigned int vlan, const unsigned long long ports);
+void dropSwitchFrame(struct switch_if * iface, const enum e_statsDrop reason, const struct switch_buffer_item * item);
 
 /*******************************************************************/
 
@@ -88,51 +133,724 @@ void printHelp() {
 	user_print("%s\n","==================");
 	//user_print("%s\n","start  - start switching");	
 	user_print("%s\n","cam    - show MAC table");
-	user_print("%s\n","stat  - show stats");
+	user_print("%s\n","cam [port <iface>] [vlan <vlan>] [mac <prefix>] [age <seconds>]");
+	user_print("%s\n","mcast  - show multicast groups");
+	user_print("%s\n","vlan   - show port VLANs");
+	user_print("%s\n","vlan <iface> access <vlan>");
+	user_print("%s\n","vlan <iface> trunk <native vlan> [<vlan list>|all]");
+	user_print("%s\n","lag    - show link aggregation groups");
+	user_print("%s\n","lag add <id> <iface> / lag del <iface>");
+	user_print("%s\n","mirror - show port mirroring");
+	user_print("%s\n","mirror port <iface> / mirror mac <mac> / mirror to <iface>");
+	user_print("%s\n","mirror file <path> [<MB per file> [<files>]] / mirror off");
+	user_print("%s\n","aging [<seconds>] - show / set MAC table aging");
+	user_print("%s\n","limit  - show MAC table limits & counters");
+	user_print("%s\n","limit max <entries> / limit port <iface> <entries> / limit action stop|evict|drop");
+	user_print("%s\n","static add <mac> <vlan> <iface> / static del <mac> <vlan>");
+	user_print("%s\n","snapshot [<file>] - save MAC table snapshot");
+	user_print("%s\n","stat [reset] - show / reset stats");
+	user_print("%s\n","stat rings - show receive & send ring occupancy");
+	user_print("%s\n","stat drops - show dropped frames by port & reason");
+	user_print("%s\n","rate [<seconds>[,<seconds>..]] - show port rates / set windows");
+	user_print("%s\n","lat [reset] - show / reset forwarding latency of egress ports");
+	user_print("%s\n","trace  - show trace rings");
+	user_print("%s\n","trace on [<entries per thread>] / trace off / trace dump <file>");
+	user_print("%s\n","top [<iface>] - show top talkers of last window");
+	user_print("%s\n","top window <seconds> / top sample <1 in n frames> / top on|off");
+	user_print("%s\n","sflow  - show sFlow export");
+	user_print("%s\n","sflow rate <1 in n frames, 0 - off> / sflow interval <counter seconds>");
 	user_print("%s\n","help   - show help");
 	user_print("%s\n","const  - show switch constants");
 	user_print("%s\n","quit   - quit application\n");
 }
 
-void printStats(struct switch_dev * device) {
+void printStats(struct switch_dev * device, char * args) {
 	if (device == NULL || device->started == 0) {
 		user_print("%s\n","Switch is not running");
 		return;
 	}
 
-	user_print("\nIface\tSent-B\tSent-frm\tRecv-B\tRecv-frm\n%s","");
+	if (args != NULL && strcmp(args, "reset") == 0) {
+		for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+			resetSwitchIfStats(iface);
+			resetSwitchBufferStats(iface->receiveBuffer);
+			resetSwitchBufferStats(iface->sendBuffer);
+		}
+		user_print("%s\n","Stats reset");
+		return;
+	}
+
+	if (args != NULL && strcmp(args, "rings") == 0) {
+		printRings(device);
+		return;
+	}
+
+	if (args != NULL && strcmp(args, "drops") == 0) {
+		printDrops(device);
+		return;
+	}
+
+	struct switch_stats_sample sample;
+
+	user_print("\nIface\tSent-B\tSent-frm\tRecv-B\tRecv-frm\tDrop-B\tDrop-frm\n%s","");
 	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
-		user_print("%-6s\t%-6ld\t%-8ld\t%-6ld\t%-8ld\n",
+		getSwitchStats(&iface->stats, &sample);
+		user_print("%-6s\t%-6lu\t%-8lu\t%-6lu\t%-8lu\t%-6lu\t%-8lu\n",
 					   			iface->name, 
-								(iface->stats).sentBytes, 
-								(iface->stats).sentFrames,
-								(iface->stats).receivedBytes, 
-								(iface->stats).receivedFrames);
+								sample.sentBytes, 
+								sample.sentFrames,
+								sample.receivedBytes, 
+								sample.receivedFrames,
+								sample.droppedBytes,
+								sample.droppedFrames);
+	}
+
+	printMACTableStats(device->mac_table);
+
+	struct switch_flowcache * cache = device->flow_cache;
+	if (cache != NULL) {
+		unsigned long hits = __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+		unsigned long misses = __atomic_load_n(&cache->misses, __ATOMIC_RELAXED);
+		unsigned long lookups = hits + misses;
+		user_print("\nFlow cache: %lu hits, %lu misses (%.1f%% hit rate)\n",
+								hits,
+								misses,
+								lookups == 0 ? 0.0 : 100.0 * hits / lookups);
 	}
 	user_print("%s\n","");
 }
 
-void printCAM(struct switch_dev * device) {
+void printRings(struct switch_dev * device) {
+
+	user_print("\nIface\tRing\tSize\tDepth\tHigh\tAvg\tEnqueued\tDequeued\tFull\n%s","");
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		printRing(iface->name, "recv", iface->receiveBuffer);
+		printRing(iface->name, "send", iface->sendBuffer);
+	}
+	user_print("%s\n","");
+}
+
+// Only reasons port has dropped for
+void printDrops(struct switch_dev * device) {
+
+	unsigned long drops[E_STATS_DROP_COUNT];
+
+	user_print("\nIface\tReason\t\tFrames\n%s","");
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		getSwitchStatsDrops(&iface->stats, drops);
+		for (int reason = 0; reason < E_STATS_DROP_COUNT; reason++) {
+			if (drops[reason] > 0)
+				user_print("%-6s\t%-14s\t%lu\n", iface->name, getSwitchStatsDropName(reason), drops[reason]);
+		}
+	}
+	user_print("%s\n","");
+}
+
+void printRing(const char * name, const char * direction, struct switch_buffer * buffer) {
+
+	struct switch_buffer_telemetry telemetry;
+
+	if (buffer == NULL)
+		return; // Iface not opened
+
+	getSwitchBufferTelemetry(buffer, &telemetry);
+	user_print("%-6s\t%s\t%u\t%u\t%u\t%-6.2f\t%-8lu\t%-8lu\t%lu\n",
+							name,
+							direction,
+							telemetry.size,
+							telemetry.depth,
+							telemetry.highWatermark,
+							telemetry.averageDepth,
+							telemetry.enqueued,
+							telemetry.dequeued,
+							telemetry.fullEvents);
+}
+
+void printRates(struct switch_dev * device, char * args) {
+
+	struct switch_stats_rate rate;
+
+	if (device == NULL)
+		return;
+
+	if (args != NULL && strcmp(args, "") != 0) {
+		if (parseSwitchStatsWindows(args, device->config.statsWindows) == 0) {
+			error_print("Invalid rate windows: %s, up to %d of 1-%d seconds\n", args, SWITCHSTATS_WINDOWS, SWITCHSTATS_MAX_WINDOW);
+			return;
+		}
+	}
+
+	if (device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	user_print("\nIface\tWindow\tSent-pps\tSent-bps\tRecv-pps\tRecv-bps\tDrop-pps\n%s","");
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		for (int i = 0; i < SWITCHSTATS_WINDOWS; i++) {
+			if (device->config.statsWindows[i] == 0)
+				continue;
+			if (getSwitchStatsRate(&iface->stats, device->config.statsWindows[i], &rate) == 0) {
+				user_print("%-6s\t%us\t%s\n", iface->name, device->config.statsWindows[i], "no samples yet");
+				continue;
+			}
+			user_print("%-6s\t%us\t%-8.0f\t%-8.0f\t%-8.0f\t%-8.0f\t%-8.0f\n",
+								iface->name,
+								rate.window,
+								rate.sentFrames,
+								rate.sentBits,
+								rate.receivedFrames,
+								rate.receivedBits,
+								rate.droppedFrames);
+		}
+	}
+	user_print("%s\n","");
+}
+
+void printLatency(struct switch_dev * device, char * args) {
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	if (args != NULL && strcmp(args, "reset") == 0) {
+		for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next)
+			resetSwitchStatsLatency(&iface->stats);
+		user_print("%s\n","Latency reset");
+		return;
+	}
+
+	struct switch_stats_percentiles latency;
+
+	user_print("\nIface\tFrames\t\tMean-us\tp50-us\tp99-us\tp99.9-us\tMax-us\n%s","");
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		getSwitchStatsLatency(&iface->stats, &latency);
+		user_print("%-6s\t%-8lu\t%-6.1f\t%-6.1f\t%-6.1f\t%-8.1f\t%-6.1f\n",
+								iface->name,
+								latency.frames,
+								latency.mean / 1000.0,
+								latency.p50 / 1000.0,
+								latency.p99 / 1000.0,
+								latency.p999 / 1000.0,
+								latency.max / 1000.0);
+	}
+	user_print("%s\n","");
+}
+
+int parseCAMFilter(struct switch_dev * device, char * args, struct switch_mactable_filter * filter) {
+
+	char * savePtr;
+	char * name, * value;
+
+	memset(filter, 0, sizeof(struct switch_mactable_filter));
+	filter->vlan = -1;
+
+	name = args == NULL ? NULL : strtok_r(args, " ", &savePtr);
+	while (name != NULL) {
+		value = strtok_r(NULL, " ", &savePtr);
+		if (value == NULL)
+			return 0;
+		if (strcmp(name, "port") == 0) {
+			filter->iface = getSwitchIfByName(device, value);
+			if (filter->iface == NULL) {
+				error_print("Unknown interface: %s\n", value);
+				return 0;
+			}
+		} else if (strcmp(name, "vlan") == 0) {
+			filter->vlan = atoi(value);
+		} else if (strcmp(name, "mac") == 0) {
+			filter->prefixLength = parseMACPrefix(value, filter->macPrefix);
+			if (filter->prefixLength == 0)
+				return 0;
+		} else if (strcmp(name, "age") == 0) {
+			filter->minAge = atoi(value);
+		} else {
+			return 0;
+		}
+		name = strtok_r(NULL, " ", &savePtr);
+	}
+
+	return 1;
+}
+
+/**
+ * Entries are fetched page by page, MAC table is not locked while page is
+ * printed or while operator reads it.
+ */
+void printCAM(struct switch_dev * device, char * args) {
+
+	struct switch_mactable_filter filter;
+	struct switch_mactable_cursor cursor;
+	struct switch_mactable_slot entries[SWITCH_CAM_PAGE];
+	char answer[SWITCH_COMMAND_MAX_LENGTH];
+	unsigned long listed = 0;
+	unsigned int count;
+	int paged = isatty(STDIN_FILENO);
 	
 	if (device == NULL || device->started == 0) {
 		user_print("%s\n","Switch is not running");
 		return;
 	}
 
-	printMACTable(device->mac_table);
+	if (parseCAMFilter(device, args, &filter) == 0) {
+		error_print("%s\n","Usage: cam [port <iface>] [vlan <vlan>] [mac <prefix>] [age <seconds>]");
+		return;
+	}
+
+	user_print("\nMAC address\tVLAN\tPort\tAge%s","\n");
+	initMACTableCursor(&cursor, &filter);
+	while ((count = getMACTableCursorEntries(device->mac_table, &cursor, entries, SWITCH_CAM_PAGE)) > 0) {
+		uint32_t currentTime = getSwitchClockSeconds();
+		for (unsigned int i = 0; i < count; i++)
+			printMACTableEntry(device->mac_table, entries + i, currentTime);
+		listed += count;
+		if (paged == 0 || cursor.array == MACTABLE_CURSOR_DONE)
+			continue;
+		user_print("%s", "-- More (Enter - next page, q - quit) --");
+		fflush(stdout);
+		if (readCommand(answer, SWITCH_COMMAND_MAX_LENGTH) > 0 && answer[0] == 'q')
+			break;
+	}
+
+	user_print("%lu entries\n\n", listed);
+}
+
+void printMcast(struct switch_dev * device) {
+
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	printMcastTable(device->mcast_table, device->ifs);
 
 	user_print("%s\n","");
 }
 
-void printConstants() {
+void printConstants(struct switch_dev * device) {
+
+	char name[64];
 
 	user_print("%s\n","");
 	user_print("Maximal PCAP packet size: %d bytes\n", BUFSIZ);
 	user_print("Buffers size: %d items\n", SWITCH_BUFFER_MAX_SIZE);
-	user_print("MAC table timeout: %d seconds\n", SWITCH_MACTABLE_TIMEOUT);
+	user_print("MAC table timeout: %u seconds\n", device->config.macTableTimeout);
+	user_print("MAC table initial capacity: %u slots\n", device->config.macTableCapacity);
+	user_print("MAC table hash: %s\n", getMACHashName());
+	if (device->config.macSnapshotFile != NULL)
+		user_print("MAC table snapshot: %s, every %u seconds\n", device->config.macSnapshotFile, device->config.macSnapshotInterval);
+	user_print("Multicast membership timeout: %d seconds\n", MCAST_MEMBER_TIMEOUT);
+	printSwitchAffinity(&device->config.affinity);
+
+	if (getSwitchState(device) == 1) {
+		user_print("%s\n","Threads in effect:");
+		for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+			if (isSwitchIfOpened(iface) == 0)
+				continue;
+			snprintf(name, sizeof(name), "%s listen", iface->name);
+			printSwitchThreadPlacement(name, iface->listening_thread);
+			snprintf(name, sizeof(name), "%s send", iface->name);
+			printSwitchThreadPlacement(name, iface->sending_thread);
+		}
+		printSwitchThreadPlacement("switching", device->swtch_thread);
+		printSwitchThreadPlacement("maintain", device->swtch_mactable_maintain_thread);
+		printSwitchThreadPlacement("clock", getSwitchClockThread());
+	}
 	user_print("%s\n","");
 }
 
+void configureVlan(struct switch_dev * device, char * args) {
+
+	char * savePtr;
+	char * ifName, * mode, * vlan, * allowed;
+	struct switch_if * iface;
+
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	// No arguments, show config
+	if (args == NULL || strcmp(args, "") == 0) {
+		printSwitchIfVlans(device->ifs);
+		return;
+	}
+
+	ifName = strtok_r(args, " ", &savePtr);
+	mode = strtok_r(NULL, " ", &savePtr);
+	vlan = strtok_r(NULL, " ", &savePtr);
+	allowed = strtok_r(NULL, " ", &savePtr);
+
+	iface = getSwitchIfByName(device, ifName);
+	if (iface == NULL) {
+		error_print("Unknown interface: %s\n", ifName);
+		return;
+	}
+	if (mode == NULL || vlan == NULL) {
+		error_print("%s\n","Usage: vlan <iface> access|trunk <vlan> [<vlan list>|all]");
+		return;
+	}
+
+	if (strcmp(mode, "access") == 0) {
+		if (setSwitchIfVlan(iface, E_VLAN_MODE_ACCESS, atoi(vlan), NULL) == 0)
+			error_print("%s\n","Invalid VLAN");
+	} else if (strcmp(mode, "trunk") == 0) {
+		if (setSwitchIfVlan(iface, E_VLAN_MODE_TRUNK, atoi(vlan), allowed) == 0)
+			error_print("%s\n","Invalid VLAN");
+	} else {
+		error_print("Invalid VLAN mode: %s\n", mode);
+	}
+}
+
+void configureLag(struct switch_dev * device, char * args) {
+
+	char * savePtr;
+	char * action, * id, * ifName;
+	struct switch_if * iface;
+
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	// No arguments, show groups
+	if (args == NULL || strcmp(args, "") == 0) {
+		printSwitchLags(device);
+		return;
+	}
+
+	action = strtok_r(args, " ", &savePtr);
+	if (strcmp(action, "add") == 0) {
+		id = strtok_r(NULL, " ", &savePtr);
+		ifName = strtok_r(NULL, " ", &savePtr);
+	} else if (strcmp(action, "del") == 0) {
+		id = NULL;
+		ifName = strtok_r(NULL, " ", &savePtr);
+	} else {
+		error_print("%s\n","Usage: lag add <id> <iface> / lag del <iface>");
+		return;
+	}
+
+	iface = getSwitchIfByName(device, ifName);
+	if (iface == NULL) {
+		error_print("Unknown interface: %s\n", ifName == NULL ? "" : ifName);
+		return;
+	}
+
+	if (id != NULL)
+		addSwitchLagMember(device, atoi(id), iface);
+	else if (removeSwitchLagMember(device, iface) == 0)
+		error_print("Interface %s is not LAG member\n", iface->name);
+}
+
+void configureMirror(struct switch_dev * device, char * args) {
+
+	char * savePtr;
+	char * action, * arg;
+	struct switch_if * iface = NULL;
+	u_char macAddress[ETHER_ADDR_LEN];
+
+	if (device == NULL || device->started == 0 || device->mirror == NULL) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	// No arguments, show session
+	if (args == NULL || strcmp(args, "") == 0) {
+		printMirror(device->mirror);
+		return;
+	}
+
+	action = strtok_r(args, " ", &savePtr);
+	arg = strtok_r(NULL, " ", &savePtr);
+
+	if (strcmp(action, "off") == 0) {
+		clearMirror(device->mirror);
+		return;
+	}
+
+	if (arg == NULL) {
+		error_print("%s\n","Usage: mirror port|mac|to|file <arg>");
+		return;
+	}
+
+	if (strcmp(action, "port") == 0 || strcmp(action, "to") == 0) {
+		iface = getSwitchIfByName(device, arg);
+		if (iface == NULL) {
+			error_print("Unknown interface: %s\n", arg);
+			return;
+		}
+	}
+
+	if (strcmp(action, "port") == 0) {
+		setMirrorPort(device->mirror, iface);
+	} else if (strcmp(action, "to") == 0) {
+		setMirrorDestination(device->mirror, iface);
+	} else if (strcmp(action, "mac") == 0) {
+		if (parseMACAddress(arg, macAddress) == 0)
+			error_print("Invalid MAC address: %s\n", arg);
+		else if (setMirrorMAC(device->mirror, macAddress) == 0)
+			error_print("%s\n","Too many mirrored MAC addresses");
+	} else if (strcmp(action, "file") == 0) {
+		char * size = strtok_r(NULL, " ", &savePtr);
+		char * files = strtok_r(NULL, " ", &savePtr);
+		setMirrorFile(device->mirror, arg,
+					size == NULL ? 0 : strtoul(size, NULL, 10) * 1024 * 1024,
+					files == NULL ? 0 : atoi(files));
+	} else {
+		error_print("Invalid mirror action: %s\n", action);
+	}
+}
+
+void configureAging(struct switch_dev * device, char * args) {
+
+	char * end;
+	unsigned long timeout;
+
+	if (args == NULL || strcmp(args, "") == 0) {
+		user_print("MAC table aging: %u seconds\n", device->config.macTableTimeout);
+		return;
+	}
+
+	timeout = strtoul(args, &end, 10);
+	if (*end != '\0' || timeout == 0 || timeout > 1000000) {
+		error_print("Invalid aging time: %s\n", args);
+		return;
+	}
+
+	device->config.macTableTimeout = timeout;
+	if (getSwitchState(device) == 1)
+		setMACTableTimeout(device->mac_table, timeout);
+}
+
+void configureLimit(struct switch_dev * device, char * args) {
+
+	char * savePtr;
+	char * action, * arg, * end;
+	struct switch_if * iface = NULL;
+	enum e_macLimitAction limitAction;
+	unsigned long limit;
+
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	// No arguments, show limits
+	if (args == NULL || strcmp(args, "") == 0) {
+		printMACTableLimits(device->mac_table, device->ifs);
+		return;
+	}
+
+	action = strtok_r(args, " ", &savePtr);
+	arg = strtok_r(NULL, " ", &savePtr);
+	if (strcmp(action, "action") == 0) {
+		if (getMACTableLimitAction(arg, &limitAction) == 0) {
+			error_print("Invalid limit action: %s\n", arg == NULL ? "" : arg);
+			return;
+		}
+		device->config.macLimitAction = limitAction;
+		setMACTableLimitAction(device->mac_table, limitAction);
+		return;
+	}
+
+	if (strcmp(action, "port") == 0) {
+		iface = getSwitchIfByName(device, arg);
+		if (iface == NULL) {
+			error_print("Unknown interface: %s\n", arg == NULL ? "" : arg);
+			return;
+		}
+		arg = strtok_r(NULL, " ", &savePtr);
+	} else if (strcmp(action, "max") != 0) {
+		error_print("%s\n","Usage: limit max <entries> / limit port <iface> <entries> / limit action stop|evict|drop");
+		return;
+	}
+
+	if (arg == NULL) {
+		error_print("%s\n","Missing limit");
+		return;
+	}
+	limit = strtoul(arg, &end, 10);
+	if (*end != '\0' || limit > 1000000000) {
+		error_print("Invalid limit: %s\n", arg);
+		return;
+	}
+
+	if (iface != NULL) {
+		setMACTablePortLimit(device->mac_table, iface, limit);
+	} else {
+		device->config.macTableLimit = limit;
+		setMACTableLimit(device->mac_table, limit);
+	}
+}
+
+void configureStatic(struct switch_dev * device, char * args) {
+
+	char * savePtr;
+	char * action, * mac, * vlan, * ifName;
+	struct switch_if * iface;
+	u_char macAddress[ETHER_ADDR_LEN];
+
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	action = args == NULL ? NULL : strtok_r(args, " ", &savePtr);
+	mac = action == NULL ? NULL : strtok_r(NULL, " ", &savePtr);
+	vlan = mac == NULL ? NULL : strtok_r(NULL, " ", &savePtr);
+	if (vlan == NULL || parseMACAddress(mac, macAddress) == 0 || atoi(vlan) < 0 || atoi(vlan) >= VLAN_COUNT) {
+		error_print("%s\n","Usage: static add <mac> <vlan> <iface> / static del <mac> <vlan>");
+		return;
+	}
+
+	if (strcmp(action, "del") == 0) {
+		deleteMACTableRecord(device->mac_table, macAddress, atoi(vlan));
+	} else if (strcmp(action, "add") == 0) {
+		ifName = strtok_r(NULL, " ", &savePtr);
+		iface = getSwitchIfByName(device, ifName);
+		if (iface == NULL) {
+			error_print("Unknown interface: %s\n", ifName == NULL ? "" : ifName);
+			return;
+		}
+		if (addMACTableStatic(device->mac_table, macAddress, atoi(vlan), iface) == 0)
+			error_print("%s\n","Unable to add static entry");
+	} else {
+		error_print("%s\n","Usage: static add <mac> <vlan> <iface> / static del <mac> <vlan>");
+	}
+}
+
+void saveSnapshot(struct switch_dev * device, char * args) {
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	char * fileName = device->config.macSnapshotFile;
+
+	if (args != NULL && strcmp(args, "") != 0)
+		fileName = args;
+	if (fileName == NULL) {
+		error_print("%s\n","Usage: snapshot <file>");
+		return;
+	}
+
+	if (saveMACSnapshot(device, fileName) == 1)
+		user_print("MAC table saved to %s\n", fileName);
+}
+
+void configureTrace(struct switch_dev * device, char * args) {
+
+	char * savePtr;
+	char * action, * arg, * end;
+	unsigned long entries = SWITCHTRACE_ENTRIES;
+
+	action = args == NULL ? NULL : strtok_r(args, " ", &savePtr);
+	arg = action == NULL ? NULL : strtok_r(NULL, " ", &savePtr);
+
+	if (action == NULL) {
+		printSwitchTrace();
+	} else if (strcmp(action, "on") == 0) {
+		if (arg != NULL) {
+			entries = strtoul(arg, &end, 10);
+			if (*end != '\0' || entries < 2 || entries > (1UL << 24)) {
+				error_print("Invalid trace ring size: %s\n", arg);
+				return;
+			}
+		}
+		if (enableSwitchTrace(entries, device->config.traceFile) == 1)
+			user_print("%s\n","Tracing enabled");
+	} else if (strcmp(action, "off") == 0) {
+		disableSwitchTrace();
+		user_print("%s\n","Tracing disabled, rings kept");
+	} else if (strcmp(action, "dump") == 0 && arg != NULL) {
+		if (dumpSwitchTrace(arg) == 1)
+			user_print("Trace dumped to %s\n", arg);
+	} else {
+		error_print("%s\n","Usage: trace [on [<entries>] | off | dump <file>]");
+	}
+}
+
+void configureTopTalkers(struct switch_dev * device, char * args) {
+	if (device == NULL || device->started == 0 || device->top_talkers == NULL) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	char * savePtr;
+	char * action, * arg, * end;
+	unsigned long value = 0;
+
+	action = args == NULL ? NULL : strtok_r(args, " ", &savePtr);
+	arg = action == NULL ? NULL : strtok_r(NULL, " ", &savePtr);
+	if (arg != NULL)
+		value = strtoul(arg, &end, 10);
+
+	if (action == NULL) {
+		printTopTalkers(device->top_talkers, device->ifs, NULL);
+	} else if (strcmp(action, "on") == 0) {
+		setTopTalkersEnabled(device->top_talkers, 1);
+	} else if (strcmp(action, "off") == 0) {
+		setTopTalkersEnabled(device->top_talkers, 0);
+	} else if (strcmp(action, "window") == 0 && arg != NULL) {
+		if (*end != '\0' || value == 0 || value > 3600)
+			error_print("Invalid window: %s\n", arg);
+		else
+			setTopTalkersWindow(device->top_talkers, value);
+	} else if (strcmp(action, "sample") == 0 && arg != NULL) {
+		if (*end != '\0' || value == 0 || value > 65536)
+			error_print("Invalid sampling rate: %s\n", arg);
+		else
+			setTopTalkersSampling(device->top_talkers, value);
+	} else {
+		struct switch_if * iface = getSwitchIfByName(device, action);
+		if (iface == NULL) {
+			error_print("%s\n","Usage: top [<iface> | window <seconds> | sample <n> | on | off]");
+			return;
+		}
+		printTopTalkers(device->top_talkers, device->ifs, iface);
+	}
+}
+
+void configureSFlow(struct switch_dev * device, char * args) {
+	if (device == NULL || device->started == 0) {
+		user_print("%s\n","Switch is not running");
+		return;
+	}
+
+	char * savePtr;
+	char * action, * arg, * end;
+	unsigned long value;
+
+	action = args == NULL ? NULL : strtok_r(args, " ", &savePtr);
+	arg = action == NULL ? NULL : strtok_r(NULL, " ", &savePtr);
+
+	if (action == NULL || device->sflow == NULL) {
+		printSFlow(device->sflow);
+		return;
+	}
+
+	if (arg == NULL) {
+		error_print("%s\n","Usage: sflow [rate <n> | interval <seconds>]");
+		return;
+	}
+	value = strtoul(arg, &end, 10);
+
+	if (strcmp(action, "rate") == 0) {
+		if (*end != '\0' || value > (1UL << 24))
+			error_print("Invalid sampling rate: %s\n", arg);
+		else
+			setSFlowRate(device->sflow, value);
+	} else if (strcmp(action, "interval") == 0) {
+		if (*end != '\0' || value > 3600)
+			error_print("Invalid counter interval: %s\n", arg);
+		else
+			setSFlowCounterInterval(device->sflow, value);
+	} else {
+		error_print("%s\n","Usage: sflow [rate <n> | interval <seconds>]");
+	}
+}
+
 enum e_switchCommand getSwitchCommand(char * command) {
 
 	if (command == NULL || strcmp(command, "") == 0)
@@ -150,6 +868,14 @@ enum e_switchCommand getSwitchCommand(char * command) {
 
 int fireSwitchCommand(struct switch_dev * device, char * command) {
 
+	// Split command & its arguments
+	char * args = strchr(command, ' ');
+	if (args != NULL) {
+		*args++ = '\0';
+		while (*args == ' ')
+			args++;
+	}
+
 	switch(getSwitchCommand(command)) {
 		case E_SWITCH_COMMAND_START:
 			switchStartup(device);
@@ -163,16 +889,55 @@ int fireSwitchCommand(struct switch_dev * device, char * command) {
 			return 0; // Exit program
 			break;
 		case E_SWITCH_COMMAND_MAC:
-			printCAM(device);
+			printCAM(device, args);
 			break;
 		case E_SWITCH_COMMAND_STATS:
-			printStats(device);
+			printStats(device, args);
 			break;
 		case E_SWITCH_COMMAND_HELP:
 			printHelp();
 			break;
 		case E_SWITCH_COMMAND_CONST:
-			printConstants();
+			printConstants(device);
+			break;
+		case E_SWITCH_COMMAND_MCAST:
+			printMcast(device);
+			break;
+		case E_SWITCH_COMMAND_VLAN:
+			configureVlan(device, args);
+			break;
+		case E_SWITCH_COMMAND_LAG:
+			configureLag(device, args);
+			break;
+		case E_SWITCH_COMMAND_MIRROR:
+			configureMirror(device, args);
+			break;
+		case E_SWITCH_COMMAND_AGING:
+			configureAging(device, args);
+			break;
+		case E_SWITCH_COMMAND_LIMIT:
+			configureLimit(device, args);
+			break;
+		case E_SWITCH_COMMAND_STATIC:
+			configureStatic(device, args);
+			break;
+		case E_SWITCH_COMMAND_SNAPSHOT:
+			saveSnapshot(device, args);
+			break;
+		case E_SWITCH_COMMAND_RATE:
+			printRates(device, args);
+			break;
+		case E_SWITCH_COMMAND_LATENCY:
+			printLatency(device, args);
+			break;
+		case E_SWITCH_COMMAND_TRACE:
+			configureTrace(device, args);
+			break;
+		case E_SWITCH_COMMAND_TOP:
+			configureTopTalkers(device, args);
+			break;
+		case E_SWITCH_COMMAND_SFLOW:
+			configureSFlow(device, args);
 			break;
 		case E_SWITCH_COMMAND_INVALID:
 			error_print("%s\n","Invalid command! Try 'help'");
@@ -226,6 +991,20 @@ int switchStartup(struct switch_dev * swtch) {
 		wasError = 1;
 	} 
 
+	// 0. Keep switch memory resident, if requested
+	if (wasError == 0)
+		lockSwitchMemory(&swtch->config.affinity);
+
+	// 0b. Clock read by data path
+	if (wasError == 0) {
+		if (startSwitchClock() == 0) {
+			error_message(errorMsg, "Unable to start clock thread");
+			wasError = 1;
+		} else {
+			applySwitchAffinity(&swtch->config.affinity, E_AFFINITY_ROLE_MAINTAIN, NULL, getSwitchClockThread());
+		}
+	}
+
 	// 1. Load interfaces
 	if (wasError == 0) {
 		swtch->if_count = loadSwitchIfs(&swtch->ifs, errorMsg);
@@ -238,16 +1017,75 @@ int switchStartup(struct switch_dev * swtch) {
 
 	// 2. Init MAC Table
 	if (wasError == 0) {
-		swtch->mac_table = initMACTable(SWITCH_MACTABLE_TIMEOUT);
+		swtch->mac_table = initMACTable(swtch->config.macTableTimeout, swtch->config.macTableCapacity);
 		if (swtch->mac_table == NULL) {
 			debug_print("%s: %s\n", "InitMACTable", errorMsg);
 			wasError = 1;	
+		} else {
+			setMACTableLimit(swtch->mac_table, swtch->config.macTableLimit);
+			setMACTableLimitAction(swtch->mac_table, swtch->config.macLimitAction);
+			for (struct switch_if * iface = swtch->ifs; iface != NULL; iface = iface->next)
+				setMACTablePortLimit(swtch->mac_table, iface, swtch->config.macPortLimit);
+			// Warm restart, no flooding until relearned
+			if (swtch->config.macSnapshotFile != NULL)
+				loadMACSnapshot(swtch, swtch->config.macSnapshotFile);
+		}
+	}
+
+	// 2b. Init multicast group table
+	if (wasError == 0) {
+		swtch->mcast_table = initMcastTable();
+		if (swtch->mcast_table == NULL) {
+			error_message(errorMsg, "Unable to init multicast table");
+			wasError = 1;
+		}
+	}
+
+	// 2c. Top talkers, fixed size sketches
+	if (wasError == 0) {
+		swtch->top_talkers = initTopTalkers();
+		if (swtch->top_talkers == NULL) {
+			error_message(errorMsg, "Unable to init top talkers");
+			wasError = 1;
 		}
 	}
 
 	// 3. Open interfaces & start listening / sending threads
 	if (wasError == 0) {
-		openSwitchIfs(swtch->ifs, errorMsg);
+		openSwitchIfs(swtch->ifs, &swtch->config.affinity, errorMsg);
+	}
+
+	// 3b. Port mirroring, starts writer thread
+	if (wasError == 0) {
+		swtch->mirror = initMirror(swtch->ifs);
+		if (swtch->mirror == NULL) {
+			error_message(errorMsg, "Unable to init port mirroring");
+			wasError = 1;
+		} else {
+			applySwitchAffinity(&swtch->config.affinity, E_AFFINITY_ROLE_MAINTAIN, swtch->ifs == NULL ? NULL : swtch->ifs->name, swtch->mirror->writer_thread);
+		}
+	}
+
+	// 3c. Metrics endpoint, snapshots are rendered by maintain thread
+	if (wasError == 0 && (swtch->config.metricsSocket != NULL || swtch->config.metricsPort != 0)) {
+		swtch->metrics = initSwitchMetrics(swtch->config.metricsSocket, swtch->config.metricsPort);
+		if (swtch->metrics == NULL) {
+			error_message(errorMsg, "Unable to start metrics server");
+			wasError = 1;
+		} else {
+			applySwitchAffinity(&swtch->config.affinity, E_AFFINITY_ROLE_MAINTAIN, NULL, swtch->metrics->server_thread);
+		}
+	}
+
+	// 3d. sFlow agent, starts export thread
+	if (wasError == 0 && swtch->config.sflowCollector != NULL) {
+		swtch->sflow = initSFlow(swtch->config.sflowCollector, swtch->config.sflowRate, swtch->ifs);
+		if (swtch->sflow == NULL) {
+			error_message(errorMsg, "Unable to start sFlow agent");
+			wasError = 1;
+		} else {
+			applySwitchAffinity(&swtch->config.affinity, E_AFFINITY_ROLE_MAINTAIN, NULL, swtch->sflow->export_thread);
+		}
 	}
 
 	// 4. Start switching
@@ -291,9 +1129,30 @@ void switchShutdown(struct switch_dev * swtch) {
 			debug_print("Error joining MAC table maintain thread%s\n", "");
 		}
 	}
-	
 
-	// 2. Close & dealloc all ifs
+
+	// 1b. Save MAC table while port names are known
+	if (swtch->mac_table != NULL && swtch->config.macSnapshotFile != NULL)
+		saveMACSnapshot(swtch, swtch->config.macSnapshotFile);
+
+	// 1c. Nothing renders metrics any more
+	destroySwitchMetrics(swtch->metrics);
+	swtch->metrics = NULL;
+
+	// 1d. Nothing samples frames any more
+	destroySFlow(swtch->sflow);
+	swtch->sflow = NULL;
+
+	// 2. Stop mirroring, it may still send to mirror port
+	destroyMirror(swtch->mirror);
+	swtch->mirror = NULL;
+
+	// 2b. Dissolve LAGs, members are deallocated one by one
+	for (struct switch_if * iface = swtch->ifs; iface != NULL; iface = iface->next)
+		iface->lag = NULL;
+	destroySwitchLags(swtch);
+
+	// 3. Close & dealloc all ifs
 	struct switch_if * shutIf;
 	char errorMsg[255];
 	while (swtch->ifs != NULL) {
@@ -309,17 +1168,24 @@ void switchShutdown(struct switch_dev * swtch) {
 
 		// Destroy mutexes
 		pthread_mutex_destroy(&shutIf->mutex);
-		pthread_mutex_destroy(&shutIf->stats.mutex);
+		destroySwitchStats(&shutIf->stats);
 
 		// Dealloc ifs
 		free((void *) shutIf);
 	}
 
-	// 3. Dealoc MAC TABLE
+	// 4. Dealoc MAC TABLE
 	destroyMACTable(swtch->mac_table);
+	destroyMcastTable(swtch->mcast_table);
+	swtch->mcast_table = NULL;
+	destroyTopTalkers(swtch->top_talkers);
+	swtch->top_talkers = NULL;
 	
-	// 4. Reset counters
+	// 5. Reset counters
 	swtch->if_count &= 0;
+
+	// 6. Nothing reads clock any more
+	stopSwitchClock();
 	
 	user_print("%s\n", "Switch stoped, interfaces closed");
 	debug_print("%s\n","END");
@@ -351,6 +1217,12 @@ int loadSwitchIfs(struct switch_if ** interface, char * errorMsg) {
 		if (strcmp(dev->name,"any") == 0)
 			continue;
 
+		// Ports are addressed by index in port masks
+		if (ifsCount >= SWITCH_MAX_IFS) {
+			debug_print("Too many interfaces, skipping %s\n", dev->name);
+			continue;
+		}
+
 		// Skip non ethernet devices
 		handler = pcap_open_live(dev->name, BUFSIZ, 1, -1, errBuff);
 		if (pcap_datalink(handler) != DLT_EN10MB) {
@@ -363,22 +1235,26 @@ int loadSwitchIfs(struct switch_if ** interface, char * errorMsg) {
 		debug_print("%s: %s\n","Device found", dev->name);
 
 		// Malloc 
-		struct switch_if * newIf = (struct switch_if *) malloc(sizeof(struct switch_if));
-		if (newIf == NULL) {
+		struct switch_if * newIf = NULL;
+		if (posix_memalign((void **) &newIf, 64, sizeof(struct switch_if)) != 0) {
+			newIf = NULL;
 			wasError = 1; // Error
 			debug_print("%s\n", "newIf malloc error!");
 		} else {
 			// Set values
 			newIf->handler = NULL;
+			newIf->index = ifsCount;
 			newIf->next = NULL;
+			newIf->lag = NULL;
+			newIf->linkUp = 1;
+			initSwitchIfVlan(&newIf->vlan);
 			newIf->receiveBuffer = NULL;
 			newIf->sendBuffer = NULL;
 			newIf->listening_thread = 0;
 			newIf->sending_thread = 0;
 			// Init MUTEXes
 			pthread_mutex_init(&newIf->mutex,NULL);
-			pthread_mutex_init(&newIf->stats.mutex,NULL);
-			resetSwitchIfStats(newIf);
+			initSwitchStats(&newIf->stats);
 			newIf->name = (char *) malloc(sizeof(char) * (strlen(dev->name) + 1));
 			if (newIf->name == NULL) {
 				wasError = 1; // Error
@@ -446,23 +1322,27 @@ int getSwitchOpenedIfsCount(struct switch_dev * device) {
 	return count;
 }
 
+struct switch_if * getSwitchIfByName(struct switch_dev * device, const char * name) {
+	if (device == NULL || name == NULL)
+		return NULL;
+
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		if (strcmp(iface->name, name) == 0)
+			return iface;
+	}
+	return NULL;
+}
+
 void resetSwitchIfStats(struct switch_if * ifs) {
 	if (ifs == NULL) {
 		debug_print("%s\n", "Param 'ifs' IS NULL");
 		return;
 	}
 
-	pthread_mutex_lock(&ifs->stats.mutex);
-	(ifs->stats).receivedFrames = 0;
-	(ifs->stats).receivedBytes = 0;
-	(ifs->stats).sentFrames = 0;
-	(ifs->stats).sentBytes = 0;
-	(ifs->stats).droppedFrames = 0;
-	(ifs->stats).droppedBytes = 0;
-	pthread_mutex_unlock(&ifs->stats.mutex);
+	resetSwitchStats(&ifs->stats);
 }
 
-void openSwitchIf(struct switch_if * iface, char * errorMsg) {
+void openSwitchIf(struct switch_if * iface, struct switch_affinity * affinity, char * errorMsg) {
 
 	debug_print("%s\n","START");
 	
@@ -479,7 +1359,7 @@ void openSwitchIf(struct switch_if * iface, char * errorMsg) {
 	}
 
 	char error[PCAP_ERRBUF_SIZE];	
-	iface->handler = pcap_open_live(iface->name, BUFSIZ, 1, -1, error);
+	iface->handler = openSwitchIfCapture(iface->name, error);
 	if (iface->handler == NULL) {
 		debug_print("Unable to open: %s: %s\n",iface->name, error);
 		sprintf(errorMsg, "Unable to open: %s\n", iface->name);
@@ -506,6 +1386,7 @@ void openSwitchIf(struct switch_if * iface, char * errorMsg) {
 		return;
 	 } else {
 		debug_print("Listening thread for iface: %s started\n",iface->name); 
+		applySwitchAffinity(affinity, E_AFFINITY_ROLE_LISTEN, iface->name, iface->listening_thread);
 	 }
 
 	resCode = pthread_create(&iface->sending_thread, PTHREAD_CREATE_JOINABLE, switchIfSendingThread, (void *) iface);
@@ -516,6 +1397,7 @@ void openSwitchIf(struct switch_if * iface, char * errorMsg) {
 		return;
 	} else {
 		debug_print("Sending thread for iface: %s started\n", iface->name);		
+		applySwitchAffinity(affinity, E_AFFINITY_ROLE_SEND, iface->name, iface->sending_thread);
 	}
 	if (isSwitchIfOpened(iface) == 0 && iface->handler != NULL) {
 		pcap_close(iface->handler);
@@ -527,7 +1409,7 @@ void openSwitchIf(struct switch_if * iface, char * errorMsg) {
 	debug_print("%s\n","END");
 }
 
-int openSwitchIfs(struct switch_if * ifaces, char * errorMsg) {
+int openSwitchIfs(struct switch_if * ifaces, struct switch_affinity * affinity, char * errorMsg) {
 	debug_print("%s\n","START");
 
 	if (ifaces == NULL) {
@@ -538,7 +1420,7 @@ int openSwitchIfs(struct switch_if * ifaces, char * errorMsg) {
 
 	int ifsOpened = 0;
 	for(struct switch_if * openIf = ifaces; openIf != NULL; openIf = openIf->next) {
-		openSwitchIf(openIf, errorMsg);
+		openSwitchIf(openIf, affinity, errorMsg);
 		if (isSwitchIfOpened(openIf) == 1)
 				ifsOpened++;
 	}	
@@ -598,6 +1480,10 @@ void * switchIfListeningThread(void * iface) {
 	int packetLength;
 	struct ether_header * frameHdr;
 	char addr1[20], addr2[20];
+	char traceName[SWITCHTRACE_NAME_LENGTH];
+
+	snprintf(traceName, sizeof(traceName), "rx-%s", ifc->name);
+	setSwitchTraceThread(traceName);
 
 	while (isSwitchIfOpened(ifc) == 1) {
 		// Read packet
@@ -609,20 +1495,23 @@ void * switchIfListeningThread(void * iface) {
 		frameHdr = (struct ether_header *) packet;
 		formatMACAddress(frameHdr->ether_dhost, addr1);
 		formatMACAddress(ifc->macAddress, addr2);
-		if (strcmp(addr1, addr2) == 0)
+		if (strcmp(addr1, addr2) == 0) {
+			dropSwitchStats(&ifc->stats.drops[E_STATS_OWNER_LISTEN], E_STATS_DROP_OWN_MAC, header.caplen);
+			SWITCH_TRACE(drop, E_TRACE_DROP, ifc->index, E_STATS_DROP_OWN_MAC, 0);
 			continue;
+		}
 
 		packetLength = header.caplen; //TODO: What to use caplen or cap?
 
 		//Add packet to receive buffer
-		if (switchBufferQueue(ifc->receiveBuffer, ifc, packet, packetLength) == 0) { // Not Added
+		if (switchBufferQueue(ifc->receiveBuffer, ifc, packet, packetLength, 0, &header.ts) == 0) { // Not Added
 			// Increment dropped counters
-			incSwitchIfStats(ifc, &ifc->stats.droppedFrames, 1);
-			incSwitchIfStats(ifc, &ifc->stats.droppedBytes, packetLength);
+			dropSwitchStats(&ifc->stats.drops[E_STATS_OWNER_LISTEN], E_STATS_DROP_RX_RING_FULL, packetLength);
+			SWITCH_TRACE(drop, E_TRACE_DROP, ifc->index, E_STATS_DROP_RX_RING_FULL, 0);
 		} else { // Added
 			// Increment receive counters
-			incSwitchIfStats(ifc, &ifc->stats.receivedFrames, 1);
-			incSwitchIfStats(ifc, &ifc->stats.receivedBytes, packetLength);
+			countSwitchStats(&ifc->stats.received, packetLength);
+			SWITCH_TRACE(rx, E_TRACE_RX, ifc->index, packetLength, 0);
 		}
 	}
 
@@ -637,6 +1526,10 @@ void * switchIfSendingThread(void * iface) {
 	
 	//Reading Loop from iface send buffer	
 	struct switch_if * ifc = (struct switch_if *) iface;
+	char traceName[SWITCHTRACE_NAME_LENGTH];
+
+	snprintf(traceName, sizeof(traceName), "tx-%s", ifc->name);
+	setSwitchTraceThread(traceName);
 
        	while (isSwitchIfOpened(ifc) == 1) {	
 		while (1) {
@@ -644,13 +1537,32 @@ void * switchIfSendingThread(void * iface) {
 			if (item == NULL) 
 				break; // Nothing to send
 
+			// Push / pop VLAN tag
+			unsigned int size = item->size;
+			u_char * frame = vlanEgressFrame(ifc, item->vlan, item->packetData, &size);
+			if (frame == NULL) {
+				dropSwitchStats(&ifc->stats.drops[E_STATS_OWNER_SEND], E_STATS_DROP_TAG, item->size);
+				SWITCH_TRACE(drop, E_TRACE_DROP, ifc->index, E_STATS_DROP_TAG, 0);
+				continue; // No room for tag
+			}
+
 			// Send	 
 			// TODO: Examine packetData, whether it contains also ether hdr
-			 if (pcap_sendpacket(ifc->handler, item->packetData, item->size) == 0) {
+			 if (pcap_sendpacket(ifc->handler, frame, size) == 0) {
 				// Increment counters
-				incSwitchIfStats(ifc, &ifc->stats.sentFrames, 1);
-				incSwitchIfStats(ifc, &ifc->stats.sentBytes, item->size);
-			} 
+				countSwitchStats(&ifc->stats.sent, size);
+				SWITCH_TRACE(tx, E_TRACE_TX, ifc->index, size, 0);
+				recordSwitchIfLatency(ifc, item);
+			} else {
+				dropSwitchStats(&ifc->stats.drops[E_STATS_OWNER_SEND], E_STATS_DROP_SEND_ERROR, size);
+				SWITCH_TRACE(drop, E_TRACE_DROP, ifc->index, E_STATS_DROP_SEND_ERROR, 0);
+				if (ifc->lag != NULL && ifc->linkUp == 1) {
+					// Redistribute LAG traffic at once, link state is polled back by maintain thread
+					debug_print("Sending on LAG member %s failed, taking it down\n", ifc->name);
+					ifc->linkUp = 0;
+					updateSwitchLagActive(ifc->lag);
+				}
+			}
 		}
 
 	}
@@ -663,6 +1575,40 @@ void * switchIfSendingThread(void * iface) {
 	pthread_exit(NULL);
 }
 
+/**
+ * Same as pcap_open_live, but frames are stamped by adapter if it can keep
+ * its clock synchronized with system one. Otherwise kernel stamps them.
+ */
+pcap_t * openSwitchIfCapture(const char * name, char * error) {
+
+	pcap_t * handler = pcap_create(name, error);
+	if (handler == NULL)
+		return NULL;
+
+	pcap_set_snaplen(handler, BUFSIZ);
+	pcap_set_promisc(handler, 1);
+	pcap_set_timeout(handler, -1);
+
+	int * types;
+	int typesCount = pcap_list_tstamp_types(handler, &types);
+	for (int i = 0; i < typesCount; i++) {
+		if (types[i] == PCAP_TSTAMP_ADAPTER) {
+			pcap_set_tstamp_type(handler, PCAP_TSTAMP_ADAPTER);
+			debug_print("Iface %s frames are stamped by adapter\n", name);
+			break;
+		}
+	}
+	if (typesCount > 0)
+		pcap_free_tstamp_types(types);
+
+	if (pcap_activate(handler) < 0) {
+		snprintf(error, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(handler));
+		pcap_close(handler);
+		return NULL;
+	}
+	return handler;
+}
+
 unsigned int isSwitchIfOpened(struct switch_if * iface) {
 	int isOpened;
 
@@ -682,15 +1628,26 @@ void setSwitchIfState(struct switch_if * iface, int isOpened) {
 	pthread_mutex_lock(&iface->mutex);
 	iface->opened = isOpened > 0 ? 1 : 0;
 	pthread_mutex_unlock(&iface->mutex);
+
+	// Redistribute LAG traffic
+	if (iface->lag != NULL)
+		updateSwitchLagActive(iface->lag);
 }
 
-void incSwitchIfStats(struct switch_if * iface, long * counter, const int amount) {
-	if (amount == 0 || iface == NULL || counter == NULL)
-		return;
+// Ingress stamp is system time of kernel or adapter
+void recordSwitchIfLatency(struct switch_if * iface, const struct switch_buffer_item * item) {
+	if (!timerisset(&item->timestamp))
+		return; // Not received frame
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	int64_t nanos = (int64_t) (now.tv_sec - item->timestamp.tv_sec) * 1000000000
+					+ now.tv_nsec - (int64_t) item->timestamp.tv_usec * 1000;
+	if (nanos < 0)
+		return; // Clock stepped back
 
-	pthread_mutex_lock(&iface->stats.mutex);
-	*counter += amount;
-	pthread_mutex_unlock(&iface->stats.mutex);
+	recordSwitchStatsLatency(&iface->stats.latency, nanos);
 }
 
 int startSwitching(struct switch_dev * dev, char * errorMsg) {
@@ -709,6 +1666,7 @@ int startSwitching(struct switch_dev * dev, char * errorMsg) {
 		return 0;
 	 } else {
 		debug_print("Switching thread started%s\n",""); 
+		applySwitchAffinity(&dev->config.affinity, E_AFFINITY_ROLE_SWITCH, dev->ifs == NULL ? NULL : dev->ifs->name, dev->swtch_thread);
 	 }
 
 	// Start MAC Table maintain thread
@@ -718,6 +1676,7 @@ int startSwitching(struct switch_dev * dev, char * errorMsg) {
 		return 0;
 	} else {
 		debug_print("MAC table maintain thread started %s\n", "");
+		applySwitchAffinity(&dev->config.affinity, E_AFFINITY_ROLE_MAINTAIN, dev->ifs == NULL ? NULL : dev->ifs->name, dev->swtch_mactable_maintain_thread);
 	}
 	
 	debug_print("%s\n","END");
@@ -727,11 +1686,27 @@ int startSwitching(struct switch_dev * dev, char * errorMsg) {
 void * switchMACTableMaintainThread(void * dev) {
 
 	struct switch_dev * device = (struct switch_dev *) dev;
+	uint32_t snapshotTime = getSwitchClockSeconds();
+
+	setSwitchTraceThread("maintain");
 
 	// While is switch running
 	while (getSwitchState(device) == 1) {
 		// Maintain
 		maintainMACTable(device->mac_table);
+		if (device->config.macSnapshotFile != NULL && device->config.macSnapshotInterval > 0
+						&& getSwitchClockSeconds() - snapshotTime >= device->config.macSnapshotInterval) {
+			saveMACSnapshot(device, device->config.macSnapshotFile);
+			snapshotTime = getSwitchClockSeconds();
+		}
+		maintainMcastTable(device->mcast_table);
+		maintainSwitchLags(device);
+		maintainTopTalkers(device->top_talkers);
+		// Rate history
+		uint64_t now = getSwitchClockMillis();
+		for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next)
+			sampleSwitchStats(&iface->stats, now);
+		renderSwitchMetrics(device->metrics, device);
 		sleep(1);
 	}
 
@@ -742,71 +1717,261 @@ void * switchMACTableMaintainThread(void * dev) {
 void * switchSwitchingThread(void * dev) {
 
 	struct switch_dev * device = (struct switch_dev *) dev;
-	struct ether_header * frameHdr;
-	struct switch_if * outIf = NULL;
+	struct switch_flowcache * cache = initFlowCache();
+	struct switch_mactable_reader * reader = registerMACTableReader(device->mac_table);
+	const struct switch_buffer_item * items[SWITCH_BURST_SIZE];
+
+	device->flow_cache = cache;
+	setSwitchTraceThread("switch");
 
 	// Read ifaces receive buffers, while switch is running
 	while (getSwitchState(device) == 1) {
+		// No MAC table slots are held between rounds
+		quiesceMACTableReader(device->mac_table, reader);
 		// Loop over all available ifaces
 		for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
 			if (isSwitchIfOpened(iface) == 1) { // Only opened
-				const struct switch_buffer_item * item = switchBufferDequeue(iface->receiveBuffer);
-				if (item != NULL) { // There is an item to send
-					frameHdr = (struct ether_header *) item->packetData;
-					if (isBroadcast(frameHdr->ether_dhost) == 1) {
-						/* Send broadcast */
-						sendBroadcast(device, item);
-					} else {
-						/* 1. Check for port change */
-						outIf = getMACTableRecord(device->mac_table, frameHdr->ether_shost);
-						if (outIf != NULL && outIf != item->receiverIf) {
-							// Delete old record & insert new
-							deleteMACTableRecord(device->mac_table, frameHdr->ether_shost);
-				 			insertMACTableRecord(device->mac_table, frameHdr->ether_shost, item->receiverIf);		
-							debug_print("%s\n", "Port change");
-						} else {
-							// Insert new record
-				 			insertMACTableRecord(device->mac_table, frameHdr->ether_shost, item->receiverIf);		
-						}
-						/* 2. Find out iface */
-						outIf = getMACTableRecord(device->mac_table, frameHdr->ether_dhost);
-						if (outIf == NULL) {
-							// Not known yet, send broadcast
-							sendBroadcast(device, item);
-						} else {
-							// Send unicast
-							sendUnicast(outIf, item);
-						}
-					}
+				// Frames stay queued until switched, so listener cannot overwrite them
+				unsigned int count = switchBufferPeek(iface->receiveBuffer, items, SWITCH_BURST_SIZE);
+				if (count > 0) { // There are items to send
+					switchFrames(device, cache, items, count);
+					switchBufferRelease(iface->receiveBuffer, count);
 				}
 			}
 		}	
 	}
 
+	device->flow_cache = NULL;
+	destroyFlowCache(cache);
+	unregisterMACTableReader(device->mac_table, reader);
+
 	debug_print("%s\n", "Thread :: Stopping switch switching thread");
 	pthread_exit(NULL);
 }
 
-void sendBroadcast(struct switch_dev * dev, const struct switch_buffer_item * item) {
+/**
+ * Frames are classified first, then source & destination addresses of whole
+ * burst are looked up at once, so MAC table cache misses overlap. Sources
+ * new, moved or not refreshed for a while are learned in one batch, others
+ * cause no MAC table write at all.
+ */
+void switchFrames(struct switch_dev * device, struct switch_flowcache * cache, const struct switch_buffer_item ** items, const unsigned int count) {
+
+	struct switch_burst_frame frames[SWITCH_BURST_SIZE];
+	uint64_t keys[SWITCH_BURST_SIZE * 2];
+	struct switch_mactable_result results[SWITCH_BURST_SIZE * 2];
+	struct switch_mactable_learn learns[SWITCH_BURST_SIZE];
+	int learnIndex[SWITCH_BURST_SIZE];
+	unsigned int lookups = 0;
+	unsigned int learnsCount = 0;
+	unsigned long generation;
+	uint32_t currTime;
+	unsigned int refresh;
+
+	for (unsigned int i = 0; i < count && i < SWITCH_BURST_SIZE; i++) {
+		struct switch_burst_frame * frame = frames + i;
+		struct ether_header * frameHdr = (struct ether_header * ) items[i]->packetData;
+
+		frame->item = items[i];
+		frame->inPort = getSwitchLagPort(items[i]->receiverIf);
+		frame->outIf = NULL;
+		frame->source = -1;
+		frame->destination = -1;
+		frame->learned = 1;
+		learnIndex[i] = -1;
+
+		/* SPAN, before anything can drop the frame */
+		mirrorFrame(device->mirror, items[i]);
+		sampleSFlow(device->sflow, items[i]);
+
+		/* Classify into VLAN, drop if not accepted by port */
+		frame->vlan = getFrameVlan(items[i]->receiverIf, items[i]->packetData, items[i]->size);
+		if (frame->vlan >= 0)
+			updateTopTalkers(device->top_talkers, items[i], frame->vlan);
+		if (frame->vlan < 0 || isBroadcast(frameHdr->ether_dhost) == 1)
+			continue;
+
+		/* 0. Known flow, skip MAC table */
+		if (isMulticast(frameHdr->ether_dhost) == 0) {
+			frame->outIf = getFlowCacheRecord(cache, device->mac_table, frameHdr, frame->vlan, frame->inPort);
+			if (frame->outIf != NULL)
+				continue;
+			frame->destination = lookups;
+			keys[lookups++] = getMACTableLookupKey(frameHdr->ether_dhost, frame->vlan);
+		}
+		frame->source = lookups;
+		keys[lookups++] = getMACTableLookupKey(frameHdr->ether_shost, frame->vlan);
+	}
+
+	generation = getMACTableGeneration(device->mac_table);
+	getMACTableRecords(device->mac_table, keys, results, lookups);
+
+	/* Learn sources, same one just once per burst */
+	currTime = getSwitchClockSeconds();
+	refresh = getMACTableRefresh(device->mac_table);
+	for (unsigned int i = 0; i < count && i < SWITCH_BURST_SIZE; i++) {
+		struct switch_burst_frame * frame = frames + i;
+		struct switch_mactable_result * source;
+		if (frame->source < 0)
+			continue;
+		source = results + frame->source;
+		if (source->iface == frame->inPort && currTime - source->lastSeen < refresh)
+			continue;
+		for (unsigned int j = 0; j < learnsCount && learnIndex[i] < 0; j++) {
+			if (learns[j].key == keys[frame->source] && learns[j].iface == frame->inPort)
+				learnIndex[i] = j;
+		}
+		if (learnIndex[i] < 0) {
+			learns[learnsCount].key = keys[frame->source];
+			learns[learnsCount].iface = frame->inPort;
+			learnIndex[i] = learnsCount++;
+		}
+	}
+	learnMACTableRecords(device->mac_table, learns, learnsCount);
+
+	for (unsigned int i = 0; i < count && i < SWITCH_BURST_SIZE; i++) {
+		if (learnIndex[i] >= 0)
+			frames[i].learned = learns[learnIndex[i]].result;
+		switchFrame(device, cache, frames + i, generation, results);
+	}
+}
+
+void switchFrame(struct switch_dev * device, struct switch_flowcache * cache, const struct switch_burst_frame * frame, const unsigned long generation, const struct switch_mactable_result * results) {
+
+	const struct switch_buffer_item * item = frame->item;
+	struct ether_header * frameHdr = (struct ether_header * ) item->packetData;
+	struct switch_if * inPort = frame->inPort;
+	struct switch_if * outIf = NULL;
+	int learned = frame->learned;
+	int vlan = frame->vlan;
+
+	if (vlan < 0) {
+		dropSwitchFrame(item->receiverIf, E_STATS_DROP_VLAN_INGRESS, item);
+		return;
+	}
+
+	if (isBroadcast(frameHdr->ether_dhost) == 1) {
+		/* Send broadcast */
+		sendBroadcast(device, item, vlan);
+		return;
+	}
+
+	if (frame->outIf != NULL) {
+		sendUnicast(frame->outIf, item, vlan);
+		return;
+	}
+
+	/* 1. Source learned by whole burst already */
+	if (learned == MACTABLE_INSERT_DROP) {
+		dropSwitchFrame(item->receiverIf, E_STATS_DROP_MAC_LIMIT, item);
+		return; // Unknown source over MAC table limit
+	}
+
+	/* 2. Find out iface */
+	if (isMulticast(frameHdr->ether_dhost) == 1) {
+		// Multicast, only to member & router ports
+		sendMulticast(device, item, vlan, snoopMcastFrame(device->mcast_table, inPort, vlan, item->packetData, item->size));
+	} else {
+		outIf = results[frame->destination].iface;
+		if (outIf == NULL) {
+			// Not known yet, send broadcast
+			sendBroadcast(device, item, vlan);
+		} else {
+			// Send unicast
+			sendUnicast(outIf, item, vlan);
+			// Unlearned source has to go through limits again
+			if (learned == 1)
+				insertFlowCacheRecord(cache, generation, frameHdr, vlan, inPort, outIf);
+		}
+	}
+}
+
+void sendBroadcast(struct switch_dev * dev, const struct switch_buffer_item * item, const unsigned int vlan) {
+	SWITCH_TRACE(flood, E_TRACE_FLOOD, item->receiverIf->index, vlan, 0);
+	// Flood within VLAN only
+	sendMulticast(dev, item, vlan, ~0ULL);
+}
+
+/**
+ * Sends frame to logical port, LAG member is picked by frame hash.
+ */
+void sendUnicast(struct switch_if * port, const struct switch_buffer_item * item, const unsigned int vlan) {
+	if (port == NULL || item == NULL)
+		return;
+
+	if (port == getSwitchLagPort(item->receiverIf)) {
+		dropSwitchFrame(item->receiverIf, E_STATS_DROP_HAIRPIN, item);
+		return;
+	}
+
+	struct switch_if * iface = port;
+	if (port->lag != NULL) {
+		iface = selectSwitchLagMember(port, getLagFrameHash(item->packetData, item->size));
+		if (iface == NULL) {
+			dropSwitchFrame(port, E_STATS_DROP_LAG_DOWN, item);
+			return; // No member up
+		}
+	}
+
+	// Port could leave VLAN since record was learned
+	if (isSwitchIfVlanMember(iface, vlan) == 0) {
+		dropSwitchFrame(iface, E_STATS_DROP_VLAN_EGRESS, item);
+		return;
+	}
+
+	if (isSwitchIfOpened(iface) == 0)
+		dropSwitchFrame(iface, E_STATS_DROP_PORT_DOWN, item);
+	else if (switchBufferQueue(iface->sendBuffer, NULL, item->packetData, item->size, vlan, &item->timestamp) == 0)
+		dropSwitchFrame(iface, E_STATS_DROP_TX_RING_FULL, item);
+}
+
+/**
+ * Floods frame to given logical ports within VLAN, each LAG gets exactly one
+ * copy on member picked by frame hash.
+ */
+void sendMulticast(struct switch_dev * dev, const struct switch_buffer_item * item, const unsigned int vlan, const unsigned long long ports) {
 	if (dev == NULL || item == NULL)
 		return;
- 
+
+	struct switch_if * inPort = getSwitchLagPort(item->receiverIf);
+	unsigned int hash = 0;
+	int hashed = 0;
+	unsigned int copies = 0;
+
 	for (struct switch_if * iface = dev->ifs; iface != NULL; iface = iface->next) {
-		if (iface == item->receiverIf) // Skip 
+		struct switch_if * port = getSwitchLagPort(iface);
+		if (port == inPort || (ports & SWITCH_IF_MASK(port)) == 0) // Skip
+			continue;
+		if (iface->lag != NULL) {
+			if (hashed == 0) {
+				hash = getLagFrameHash(item->packetData, item->size);
+				hashed = 1;
+			}
+			if (selectSwitchLagMember(iface, hash) != iface)
+				continue;
+		}
+		if (isSwitchIfVlanMember(iface, vlan) == 0)
 			continue;
 		if (isSwitchIfOpened(iface) == 1) { // If Opened
 			// Add to sending buffer
-			switchBufferQueue(iface->sendBuffer, NULL, item->packetData, item->size);
+			if (switchBufferQueue(iface->sendBuffer, NULL, item->packetData, item->size, vlan, &item->timestamp) == 0)
+				dropSwitchFrame(iface, E_STATS_DROP_TX_RING_FULL, item);
+			copies++;
 		}
 	}
+
+	if (copies == 0)
+		dropSwitchFrame(item->receiverIf, E_STATS_DROP_NO_DESTINATION, item);
 }
 
-void sendUnicast(struct switch_if * iface, const struct switch_buffer_item * item) {
-	if (iface == NULL || item == NULL || iface == item->receiverIf)
+/**
+ * Counts frame dropped by switching thread, which owns its own drops block
+ * of each port.
+ */
+void dropSwitchFrame(struct switch_if * iface, const enum e_statsDrop reason, const struct switch_buffer_item * item) {
+	if (iface == NULL)
 		return;
 
-	if (isSwitchIfOpened(iface) == 1) {
-		switchBufferQueue(iface->sendBuffer, NULL, item->packetData, item->size);
-	}
+	dropSwitchStats(&iface->stats.drops[E_STATS_OWNER_SWITCH], reason, item->size);
+	SWITCH_TRACE(drop, E_TRACE_DROP, iface->index, reason, 0);
 }
-
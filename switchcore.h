@@ -27,53 +27,96 @@
 #ifndef _SWITCHCORE_
 #define _SWITCHCORE_
 
+#define SWITCH_MAX_IFS 64 // Ports are kept in 64 bit masks, needed by included headers
+
 #include "switchbuffer.h"
 #include "mactable.h"
+#include "vlan.h"
+#include "lag.h"
+#include "affinity.h"
+#include "machash.h"
+#include "switchstats.h"
 
 #include <pcap.h>
 #include <pthread.h>
 #include <net/ethernet.h>
 
-#define SWITCH_COMMAND_MAX_LENGTH 10
+#define SWITCH_COMMAND_MAX_LENGTH 128
 #define SWITCH_MACTABLE_TIMEOUT 180
+#define SWITCH_BURST_SIZE 32 // Received frames switched together
+#define SWITCH_CAM_PAGE 40 // MAC table lines per page
 
-#define SWITCH_PROMPT "switch> "
+#define SWITCH_IF_MASK(iface) (1ULL << (iface)->index)
 
-struct switch_if_stats { // Switch interface stats
-	long receivedFrames;
-	long receivedBytes;
-	long sentFrames;
-	long sentBytes;
-	long droppedFrames;
-	long droppedBytes;
-	pthread_mutex_t mutex;
-};
+#define SWITCH_PROMPT "switch> "
 
-struct switch_if { // Switch interface
+struct switch_if { // Switch interface, cache line aligned for its stats
 	unsigned int opened:1;
+	unsigned int index;
 	char * name;
 	pcap_t * handler;
 	u_char macAddress[ETHER_ADDR_LEN];
 	pthread_t listening_thread;
 	pthread_t sending_thread;
 	struct switch_if_stats stats;
+	struct switch_if_vlan vlan;
+	struct switch_lag * lag;
+	unsigned int linkUp;
 	struct switch_buffer * receiveBuffer;
 	struct switch_buffer * sendBuffer;
 	pthread_mutex_t mutex;
 	struct switch_if * next;
 };
 
+struct switch_burst_frame { // Frame being switched within burst
+	const struct switch_buffer_item * item;
+	struct switch_if * inPort; // Logical port
+	struct switch_if * outIf; // Of known flow
+	int vlan; // -1 if dropped
+	int source; // Index of lookup result, -1 if none
+	int destination;
+	int learned; // Source learning result, see insertMACTableRecord
+};
+
+struct switch_config { // Command line configuration
+	struct switch_affinity affinity;
+	unsigned int macTableCapacity; // Initial slots
+	unsigned int macTableTimeout; // Aging, seconds
+	enum e_macHash macHash;
+	unsigned int macTableLimit; // Entries, 0 - no limit
+	unsigned int macPortLimit; // Entries per port, 0 - no limit
+	enum e_macLimitAction macLimitAction;
+	char * macSnapshotFile; // NULL - no warm restart
+	unsigned int macSnapshotInterval; // Seconds
+	unsigned int statsWindows[SWITCHSTATS_WINDOWS]; // Rate windows, seconds, 0 - unused
+	char * metricsSocket; // Unix socket path, NULL - none
+	unsigned int metricsPort; // Localhost TCP port, 0 - none
+	char * traceFile; // Trace crash dump, NULL - default
+	char * sflowCollector; // <IPv4>[:<port>], NULL - no sFlow
+	unsigned int sflowRate; // 1 in N frames sampled
+};
+
 struct switch_dev { // Switch device
 	unsigned int started:1;
 	unsigned int if_count;
 	struct switch_if * ifs;
+	struct switch_lag * lags;
 	pthread_mutex_t mutex;
 	pthread_t swtch_thread;
 	pthread_t swtch_mactable_maintain_thread;
 	struct switch_mactable * mac_table;
+	struct switch_mcast_table * mcast_table;
+	struct switch_flowcache * flow_cache; // Of switching thread
+	struct switch_mirror * mirror;
+	struct switch_metrics * metrics; // NULL if not enabled
+	struct switch_toptalkers * top_talkers;
+	struct switch_sflow * sflow; // NULL if not enabled
+	struct switch_config config;
 };
 
 int fireSwitchCommand(struct switch_dev * device, char * command);
+unsigned int isSwitchIfOpened(struct switch_if * iface);
+struct switch_if * getSwitchIfByName(struct switch_dev * dev, const char * name);
 
 #endif
 
@@ -0,0 +1,409 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchmetrics.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Metrics endpoint in Prometheus text format
+ */
+
+
+#include "switchmetrics.h"
+#include "switchcore.h"
+#include "switchstats.h"
+#include "switchbuffer.h"
+#include "mactable.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/********************************************************************/
+
+struct switch_metrics * initSwitchMetrics(const char * socketPath, const unsigned int tcpPort);
+void destroySwitchMetrics(struct switch_metrics * metrics);
+int openSwitchMetricsUnix(const char * socketPath);
+int openSwitchMetricsTcp(const unsigned int tcpPort);
+void renderSwitchMetrics(struct switch_metrics * metrics, struct switch_dev * device);
+void writeSwitchMetricsHeader(FILE * file, const char * name, const char * type, const char * help);
+void writeSwitchMetricsPorts(FILE * file, struct switch_dev * device, const struct switch_stats_sample * samples, const char * name, const char * help, const unsigned int field);
+void writeSwitchMetricsRing(FILE * file, const char * port, const char * ring, struct switch_buffer * buffer, const unsigned int field);
+void writeSwitchMetricsLatency(FILE * file, const char * port, struct switch_if_stats * stats);
+void * switchMetricsServerThread(void * metrics);
+void serveSwitchMetrics(struct switch_metrics * metrics, const int client);
+
+/*******************************************************************/
+
+/**
+ * Listens on Unix socket, localhost TCP port or both. Either speaks
+ * HTTP/1.0, so Unix one can be scraped through a proxy or curl --unix-socket.
+ */
+struct switch_metrics * initSwitchMetrics(const char * socketPath, const unsigned int tcpPort) {
+	debug_print("%s\n", "START");
+
+	struct switch_metrics * metrics = (struct switch_metrics *) malloc(sizeof(struct switch_metrics));
+	if (metrics == NULL) {
+		debug_print("%s\n", "Error initializing metrics");
+		return NULL;
+	}
+
+	memset(metrics, 0, sizeof(struct switch_metrics));
+	metrics->unixSocket = -1;
+	metrics->tcpSocket = -1;
+	pthread_mutex_init(&metrics->mutex, NULL);
+
+	if (socketPath != NULL) {
+		metrics->socketPath = strdup(socketPath);
+		metrics->unixSocket = openSwitchMetricsUnix(socketPath);
+	}
+	if (tcpPort != 0)
+		metrics->tcpSocket = openSwitchMetricsTcp(tcpPort);
+
+	if ((socketPath != NULL && metrics->unixSocket == -1) || (tcpPort != 0 && metrics->tcpSocket == -1)) {
+		destroySwitchMetrics(metrics);
+		return NULL;
+	}
+
+	metrics->running = 1;
+	if (pthread_create(&metrics->server_thread, NULL, switchMetricsServerThread, (void *) metrics) != 0) {
+		debug_print("%s\n", "Unable to start metrics server thread");
+		metrics->running = 0;
+		destroySwitchMetrics(metrics);
+		return NULL;
+	}
+
+	debug_print("%s\n", "END");
+	return metrics;
+}
+
+void destroySwitchMetrics(struct switch_metrics * metrics) {
+	if (metrics == NULL)
+		return;
+
+	if (metrics->running == 1) {
+		metrics->running = 0;
+		pthread_join(metrics->server_thread, NULL);
+	}
+
+	if (metrics->unixSocket != -1) {
+		close(metrics->unixSocket);
+		unlink(metrics->socketPath);
+	}
+	if (metrics->tcpSocket != -1)
+		close(metrics->tcpSocket);
+
+	free((void *) metrics->socketPath);
+	free((void *) metrics->snapshot);
+	pthread_mutex_destroy(&metrics->mutex);
+	free((void *) metrics);
+}
+
+int openSwitchMetricsUnix(const char * socketPath) {
+
+	struct sockaddr_un address;
+
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		error_print("Metrics socket path too long: %s\n", socketPath);
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		error_print("Unable to create metrics socket: %s\n", socketPath);
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	unlink(socketPath); // Left by previous run
+	if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(fd, 8) == -1) {
+		error_print("Unable to listen on metrics socket: %s\n", socketPath);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int openSwitchMetricsTcp(const unsigned int tcpPort) {
+
+	struct sockaddr_in address;
+	int reuse = 1;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) {
+		error_print("Unable to create metrics socket on port %u\n", tcpPort);
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(tcpPort);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Never exposed outside host
+
+	if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1 || listen(fd, 8) == -1) {
+		error_print("Unable to listen on metrics port %u\n", tcpPort);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Called by maintain thread. Port counters & latency histograms are read
+ * without locks, rings are locked once per second regardless of how often
+ * metrics are scraped. Scrapes only copy the rendered text.
+ */
+void renderSwitchMetrics(struct switch_metrics * metrics, struct switch_dev * device) {
+	if (metrics == NULL || device == NULL)
+		return;
+
+	char * text = NULL;
+	size_t length = 0;
+	FILE * file = open_memstream(&text, &length);
+	if (file == NULL)
+		return;
+
+	// Counters of all ports read at once
+	struct switch_stats_sample samples[SWITCH_MAX_IFS];
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		if (iface->index < SWITCH_MAX_IFS)
+			readSwitchStats(&iface->stats, &samples[iface->index]);
+	}
+
+	writeSwitchMetricsPorts(file, device, samples, "softswitch_port_received_frames_total", "Frames received on port", 0);
+	writeSwitchMetricsPorts(file, device, samples, "softswitch_port_received_bytes_total", "Bytes received on port", 1);
+	writeSwitchMetricsPorts(file, device, samples, "softswitch_port_sent_frames_total", "Frames sent on port", 2);
+	writeSwitchMetricsPorts(file, device, samples, "softswitch_port_sent_bytes_total", "Bytes sent on port", 3);
+	writeSwitchMetricsPorts(file, device, samples, "softswitch_port_dropped_frames_total", "Frames dropped on port", 4);
+	writeSwitchMetricsPorts(file, device, samples, "softswitch_port_dropped_bytes_total", "Bytes dropped on port", 5);
+
+	unsigned long drops[E_STATS_DROP_COUNT];
+	writeSwitchMetricsHeader(file, "softswitch_port_drops_total", "counter", "Frames dropped on port by reason");
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		readSwitchStatsDrops(&iface->stats, drops);
+		for (int reason = 0; reason < E_STATS_DROP_COUNT; reason++)
+			fprintf(file, "softswitch_port_drops_total{port=\"%s\",reason=\"%s\"} %lu\n", iface->name, getSwitchStatsDropName(reason), drops[reason]);
+	}
+
+	const char * ringNames[] = {"softswitch_ring_depth", "softswitch_ring_high_watermark", "softswitch_ring_average_depth", "softswitch_ring_full_total"};
+	const char * ringTypes[] = {"gauge", "gauge", "gauge", "counter"};
+	const char * ringHelps[] = {"Frames queued in ring", "Highest ring depth since reset", "Time weighted ring depth since reset", "Frames refused by full ring"};
+	for (unsigned int field = 0; field < 4; field++) {
+		writeSwitchMetricsHeader(file, ringNames[field], ringTypes[field], ringHelps[field]);
+		for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+			writeSwitchMetricsRing(file, iface->name, "recv", iface->receiveBuffer, field);
+			writeSwitchMetricsRing(file, iface->name, "send", iface->sendBuffer, field);
+		}
+	}
+
+	writeSwitchMetricsHeader(file, "softswitch_mactable_entries", "gauge", "Entries in MAC table");
+	fprintf(file, "softswitch_mactable_entries %u\n", getMACTableCount(device->mac_table));
+
+	writeSwitchMetricsHeader(file, "softswitch_forwarding_latency_seconds", "histogram", "Ingress to transmit latency of egress port");
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next)
+		writeSwitchMetricsLatency(file, iface->name, &iface->stats);
+
+	fclose(file);
+
+	// Swap snapshot
+	pthread_mutex_lock(&metrics->mutex);
+	char * old = metrics->snapshot;
+	metrics->snapshot = text;
+	metrics->snapshotLength = length;
+	pthread_mutex_unlock(&metrics->mutex);
+	free((void *) old);
+}
+
+void writeSwitchMetricsHeader(FILE * file, const char * name, const char * type, const char * help) {
+	fprintf(file, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Field in order of switch_stats_sample counters
+void writeSwitchMetricsPorts(FILE * file, struct switch_dev * device, const struct switch_stats_sample * samples, const char * name, const char * help, const unsigned int field) {
+
+	writeSwitchMetricsHeader(file, name, "counter", help);
+	for (struct switch_if * iface = device->ifs; iface != NULL; iface = iface->next) {
+		if (iface->index >= SWITCH_MAX_IFS)
+			continue;
+
+		const struct switch_stats_sample * sample = &samples[iface->index];
+		const unsigned long values[] = {sample->receivedFrames, sample->receivedBytes,
+								sample->sentFrames, sample->sentBytes,
+								sample->droppedFrames, sample->droppedBytes};
+		fprintf(file, "%s{port=\"%s\"} %lu\n", name, iface->name, values[field]);
+	}
+}
+
+// Field 0 - depth, 1 - high watermark, 2 - average depth, 3 - full events
+void writeSwitchMetricsRing(FILE * file, const char * port, const char * ring, struct switch_buffer * buffer, const unsigned int field) {
+
+	struct switch_buffer_telemetry telemetry;
+
+	if (buffer == NULL)
+		return; // Iface not opened
+
+	getSwitchBufferTelemetry(buffer, &telemetry);
+	switch (field) {
+		case 0:
+			fprintf(file, "softswitch_ring_depth{port=\"%s\",ring=\"%s\"} %u\n", port, ring, telemetry.depth);
+			break;
+		case 1:
+			fprintf(file, "softswitch_ring_high_watermark{port=\"%s\",ring=\"%s\"} %u\n", port, ring, telemetry.highWatermark);
+			break;
+		case 2:
+			fprintf(file, "softswitch_ring_average_depth{port=\"%s\",ring=\"%s\"} %.3f\n", port, ring, telemetry.averageDepth);
+			break;
+		default:
+			fprintf(file, "softswitch_ring_full_total{port=\"%s\",ring=\"%s\"} %lu\n", port, ring, telemetry.fullEvents);
+	}
+}
+
+/**
+ * Log buckets are folded into power of 2 microsecond bounds. Each log bucket
+ * counts to bound its highest value fits in, so bounds are ~3% precise.
+ */
+void writeSwitchMetricsLatency(FILE * file, const char * port, struct switch_if_stats * stats) {
+
+	struct switch_stats_latency * latency = (struct switch_stats_latency *) malloc(sizeof(struct switch_stats_latency));
+	unsigned long cumulative[SWITCHMETRICS_LATENCY_BUCKETS + 1] = {0};
+
+	if (latency == NULL)
+		return;
+
+	readSwitchStatsLatency(stats, latency);
+	for (int i = 0; i < SWITCHSTATS_LATENCY_BUCKETS; i++) {
+		if (latency->counts[i] == 0)
+			continue;
+		uint64_t value = getSwitchStatsLatencyValue(i);
+		int bound = 0;
+		while (bound < SWITCHMETRICS_LATENCY_BUCKETS && value > (1000ULL << bound))
+			bound++;
+		cumulative[bound] += latency->counts[i]; // Last one is +Inf only
+	}
+
+	unsigned long count = 0;
+	for (int bound = 0; bound < SWITCHMETRICS_LATENCY_BUCKETS; bound++) {
+		count += cumulative[bound];
+		fprintf(file, "softswitch_forwarding_latency_seconds_bucket{port=\"%s\",le=\"%.6f\"} %lu\n", port, (1ULL << bound) / 1000000.0, count);
+	}
+	count += cumulative[SWITCHMETRICS_LATENCY_BUCKETS];
+	fprintf(file, "softswitch_forwarding_latency_seconds_bucket{port=\"%s\",le=\"+Inf\"} %lu\n", port, count);
+	fprintf(file, "softswitch_forwarding_latency_seconds_sum{port=\"%s\"} %.9f\n", port, latency->total / 1000000000.0);
+	fprintf(file, "softswitch_forwarding_latency_seconds_count{port=\"%s\"} %lu\n", port, count);
+
+	free((void *) latency);
+}
+
+void * switchMetricsServerThread(void * metrics) {
+
+	struct switch_metrics * mtrcs = (struct switch_metrics *) metrics;
+	struct pollfd fds[2];
+	int fdsCount = 0;
+
+	if (mtrcs->unixSocket != -1) {
+		fds[fdsCount].fd = mtrcs->unixSocket;
+		fds[fdsCount++].events = POLLIN;
+	}
+	if (mtrcs->tcpSocket != -1) {
+		fds[fdsCount].fd = mtrcs->tcpSocket;
+		fds[fdsCount++].events = POLLIN;
+	}
+
+	while (mtrcs->running == 1) {
+		if (poll(fds, fdsCount, SWITCHMETRICS_POLL_TIMEOUT) <= 0)
+			continue;
+
+		for (int i = 0; i < fdsCount; i++) {
+			if ((fds[i].revents & POLLIN) == 0)
+				continue;
+			int client = accept(fds[i].fd, NULL, NULL);
+			if (client == -1)
+				continue;
+			serveSwitchMetrics(mtrcs, client);
+			close(client);
+		}
+	}
+
+	debug_print("%s\n", "Thread :: Stopping metrics server thread");
+	pthread_exit(NULL);
+}
+
+void serveSwitchMetrics(struct switch_metrics * metrics, const int client) {
+
+	char request[SWITCHMETRICS_REQUEST_SIZE];
+	size_t requestLength = 0;
+	struct timeval timeout = {SWITCHMETRICS_CLIENT_TIMEOUT, 0};
+
+	// Slow client cannot stall server for long
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// Request itself does not matter, read till its end
+	while (requestLength < sizeof(request) - 1) {
+		ssize_t received = recv(client, request + requestLength, sizeof(request) - 1 - requestLength, 0);
+		if (received <= 0)
+			break;
+		requestLength += received;
+		request[requestLength] = '\0';
+		if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+			break;
+	}
+
+	// Copy, so maintain thread is not held by slow client
+	char * body = NULL;
+	size_t bodyLength = 0;
+	pthread_mutex_lock(&metrics->mutex);
+	if (metrics->snapshot != NULL) {
+		body = (char *) malloc(metrics->snapshotLength);
+		if (body != NULL) {
+			memcpy(body, metrics->snapshot, metrics->snapshotLength);
+			bodyLength = metrics->snapshotLength;
+		}
+	}
+	pthread_mutex_unlock(&metrics->mutex);
+
+	char header[128];
+	int headerLength = snprintf(header, sizeof(header),
+					"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+					bodyLength);
+	send(client, header, headerLength, MSG_NOSIGNAL);
+
+	size_t sent = 0;
+	while (sent < bodyLength) {
+		ssize_t written = send(client, body + sent, bodyLength - sent, MSG_NOSIGNAL);
+		if (written <= 0)
+			break;
+		sent += written;
+	}
+	free((void *) body);
+}
+
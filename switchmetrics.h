@@ -0,0 +1,57 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchmetrics.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Metrics endpoint in Prometheus text format
+ */
+
+
+#ifndef _SWITCHMETRICS_
+#define _SWITCHMETRICS_
+
+#include "switchcore.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define SWITCHMETRICS_POLL_TIMEOUT 1000 // Milliseconds, running flag checked
+#define SWITCHMETRICS_CLIENT_TIMEOUT 1 // Seconds to read request / write response
+#define SWITCHMETRICS_REQUEST_SIZE 1024
+#define SWITCHMETRICS_LATENCY_BUCKETS 21 // Histogram bounds 1 us .. 2^20 us
+
+struct switch_metrics { // Metrics server
+	int unixSocket; // -1 - not listening
+	int tcpSocket;
+	char * socketPath;
+	char * snapshot; // Rendered by maintain thread
+	size_t snapshotLength;
+	unsigned int running:1;
+	pthread_t server_thread;
+	pthread_mutex_t mutex; // Snapshot swap only
+};
+
+struct switch_metrics * initSwitchMetrics(const char * socketPath, const unsigned int tcpPort);
+void destroySwitchMetrics(struct switch_metrics * metrics);
+void renderSwitchMetrics(struct switch_metrics * metrics, struct switch_dev * device);
+
+#endif
+
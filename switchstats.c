@@ -0,0 +1,356 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchstats.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Per interface counters & rates
+ */
+
+
+#include "switchstats.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+const char * statsDropNames[] = {"rx-ring-full", "own-mac", "vlan-ingress", "mac-limit", "hairpin", "no-destination",
+				"lag-down", "vlan-egress", "port-down", "tx-ring-full", "tag", "send-error"};
+
+/********************************************************************/
+
+void initSwitchStats(struct switch_if_stats * stats);
+void destroySwitchStats(struct switch_if_stats * stats);
+void countSwitchStats(struct switch_stats_counters * counters, const unsigned int bytes);
+void dropSwitchStats(struct switch_stats_drops * drops, const enum e_statsDrop reason, const unsigned int bytes);
+void readSwitchStatsDrops(struct switch_if_stats * stats, unsigned long * frames);
+void getSwitchStatsDrops(struct switch_if_stats * stats, unsigned long * frames);
+const char * getSwitchStatsDropName(const enum e_statsDrop reason);
+void readSwitchStats(struct switch_if_stats * stats, struct switch_stats_sample * sample);
+void getSwitchStats(struct switch_if_stats * stats, struct switch_stats_sample * sample);
+void resetSwitchStats(struct switch_if_stats * stats);
+unsigned int getSwitchStatsLatencyBucket(uint64_t nanos);
+uint64_t getSwitchStatsLatencyValue(const unsigned int bucket);
+void recordSwitchStatsLatency(struct switch_stats_latency * latency, const uint64_t nanos);
+void readSwitchStatsLatency(struct switch_if_stats * stats, struct switch_stats_latency * latency);
+void getSwitchStatsLatency(struct switch_if_stats * stats, struct switch_stats_percentiles * percentiles);
+void resetSwitchStatsLatency(struct switch_if_stats * stats);
+void sampleSwitchStats(struct switch_if_stats * stats, const uint64_t time);
+int getSwitchStatsRate(struct switch_if_stats * stats, const unsigned int window, struct switch_stats_rate * rate);
+int parseSwitchStatsWindows(const char * input, unsigned int * windows);
+
+/*******************************************************************/
+
+void initSwitchStats(struct switch_if_stats * stats) {
+	if (stats == NULL)
+		return;
+
+	memset(&stats->received, 0, sizeof(struct switch_stats_counters));
+	memset(&stats->sent, 0, sizeof(struct switch_stats_counters));
+	memset(stats->drops, 0, sizeof(stats->drops));
+	memset(stats->dropsBase, 0, sizeof(stats->dropsBase));
+	memset(&stats->latency, 0, sizeof(struct switch_stats_latency));
+	memset(&stats->base, 0, sizeof(struct switch_stats_sample));
+	memset(&stats->latencyBase, 0, sizeof(struct switch_stats_latency));
+	stats->next = 0;
+	stats->count = 0;
+	pthread_mutex_init(&stats->mutex, NULL);
+}
+
+void destroySwitchStats(struct switch_if_stats * stats) {
+	if (stats == NULL)
+		return;
+
+	pthread_mutex_destroy(&stats->mutex);
+}
+
+/**
+ * Counters have single writer, so no lock nor atomic add is needed. Store
+ * is atomic only to keep it untorn for readers.
+ */
+void countSwitchStats(struct switch_stats_counters * counters, const unsigned int bytes) {
+	__atomic_store_n(&counters->frames, counters->frames + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&counters->bytes, counters->bytes + bytes, __ATOMIC_RELAXED);
+}
+
+// Each thread has own drops block of port, so single writer again
+void dropSwitchStats(struct switch_stats_drops * drops, const enum e_statsDrop reason, const unsigned int bytes) {
+	__atomic_store_n(&drops->frames[reason], drops->frames[reason] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&drops->bytes, drops->bytes + bytes, __ATOMIC_RELAXED);
+}
+
+// Drops by reason summed over threads, since interface was loaded
+void readSwitchStatsDrops(struct switch_if_stats * stats, unsigned long * frames) {
+	for (int reason = 0; reason < E_STATS_DROP_COUNT; reason++) {
+		frames[reason] = 0;
+		for (int owner = 0; owner < E_STATS_OWNER_COUNT; owner++)
+			frames[reason] += __atomic_load_n(&stats->drops[owner].frames[reason], __ATOMIC_RELAXED);
+	}
+}
+
+// Drops by reason since last reset
+void getSwitchStatsDrops(struct switch_if_stats * stats, unsigned long * frames) {
+	if (stats == NULL || frames == NULL)
+		return;
+
+	readSwitchStatsDrops(stats, frames);
+
+	pthread_mutex_lock(&stats->mutex);
+	for (int reason = 0; reason < E_STATS_DROP_COUNT; reason++)
+		frames[reason] -= stats->dropsBase[reason];
+	pthread_mutex_unlock(&stats->mutex);
+}
+
+const char * getSwitchStatsDropName(const enum e_statsDrop reason) {
+	if (reason < 0 || reason >= E_STATS_DROP_COUNT)
+		return "unknown";
+	return statsDropNames[reason];
+}
+
+// Sums counters of all owner threads, since interface was loaded
+void readSwitchStats(struct switch_if_stats * stats, struct switch_stats_sample * sample) {
+	sample->receivedFrames = __atomic_load_n(&stats->received.frames, __ATOMIC_RELAXED);
+	sample->receivedBytes = __atomic_load_n(&stats->received.bytes, __ATOMIC_RELAXED);
+	sample->sentFrames = __atomic_load_n(&stats->sent.frames, __ATOMIC_RELAXED);
+	sample->sentBytes = __atomic_load_n(&stats->sent.bytes, __ATOMIC_RELAXED);
+	sample->droppedFrames = 0;
+	sample->droppedBytes = 0;
+	for (int owner = 0; owner < E_STATS_OWNER_COUNT; owner++) {
+		for (int reason = 0; reason < E_STATS_DROP_COUNT; reason++)
+			sample->droppedFrames += __atomic_load_n(&stats->drops[owner].frames[reason], __ATOMIC_RELAXED);
+		sample->droppedBytes += __atomic_load_n(&stats->drops[owner].bytes, __ATOMIC_RELAXED);
+	}
+}
+
+// Counters since last reset
+void getSwitchStats(struct switch_if_stats * stats, struct switch_stats_sample * sample) {
+	if (stats == NULL || sample == NULL)
+		return;
+
+	readSwitchStats(stats, sample);
+
+	pthread_mutex_lock(&stats->mutex);
+	sample->receivedFrames -= stats->base.receivedFrames;
+	sample->receivedBytes -= stats->base.receivedBytes;
+	sample->sentFrames -= stats->base.sentFrames;
+	sample->sentBytes -= stats->base.sentBytes;
+	sample->droppedFrames -= stats->base.droppedFrames;
+	sample->droppedBytes -= stats->base.droppedBytes;
+	pthread_mutex_unlock(&stats->mutex);
+}
+
+// Owner threads keep counting, reset only moves base
+void resetSwitchStats(struct switch_if_stats * stats) {
+	if (stats == NULL)
+		return;
+
+	struct switch_stats_sample sample;
+	unsigned long drops[E_STATS_DROP_COUNT];
+	readSwitchStats(stats, &sample);
+	readSwitchStatsDrops(stats, drops);
+
+	pthread_mutex_lock(&stats->mutex);
+	stats->base = sample;
+	memcpy(stats->dropsBase, drops, sizeof(drops));
+	pthread_mutex_unlock(&stats->mutex);
+}
+
+/**
+ * Values below 2^SUB_BITS have own bucket, each higher power of 2 is split
+ * into 2^SUB_BITS linear buckets, so relative error is kept the same.
+ */
+unsigned int getSwitchStatsLatencyBucket(uint64_t nanos) {
+	if (nanos >> SWITCHSTATS_LATENCY_MAX_BITS)
+		nanos = (1ULL << SWITCHSTATS_LATENCY_MAX_BITS) - 1;
+	if (nanos < (1U << SWITCHSTATS_LATENCY_SUB_BITS))
+		return nanos;
+
+	unsigned int magnitude = 63 - __builtin_clzll(nanos) - SWITCHSTATS_LATENCY_SUB_BITS;
+	return ((magnitude + 1) << SWITCHSTATS_LATENCY_SUB_BITS)
+					| ((nanos >> magnitude) & ((1U << SWITCHSTATS_LATENCY_SUB_BITS) - 1));
+}
+
+// Highest value counted in bucket
+uint64_t getSwitchStatsLatencyValue(const unsigned int bucket) {
+	unsigned int group = bucket >> SWITCHSTATS_LATENCY_SUB_BITS;
+	uint64_t sub = bucket & ((1U << SWITCHSTATS_LATENCY_SUB_BITS) - 1);
+
+	if (group == 0)
+		return sub;
+	return (((1ULL << SWITCHSTATS_LATENCY_SUB_BITS) + sub + 1) << (group - 1)) - 1;
+}
+
+// Single writer, as counters
+void recordSwitchStatsLatency(struct switch_stats_latency * latency, const uint64_t nanos) {
+	unsigned int bucket = getSwitchStatsLatencyBucket(nanos);
+
+	__atomic_store_n(&latency->counts[bucket], latency->counts[bucket] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&latency->total, latency->total + nanos, __ATOMIC_RELAXED);
+}
+
+// Histogram since interface was loaded, without locking
+void readSwitchStatsLatency(struct switch_if_stats * stats, struct switch_stats_latency * latency) {
+	for (int i = 0; i < SWITCHSTATS_LATENCY_BUCKETS; i++)
+		latency->counts[i] = __atomic_load_n(&stats->latency.counts[i], __ATOMIC_RELAXED);
+	latency->total = __atomic_load_n(&stats->latency.total, __ATOMIC_RELAXED);
+}
+
+// Percentiles since last reset
+void getSwitchStatsLatency(struct switch_if_stats * stats, struct switch_stats_percentiles * percentiles) {
+	if (stats == NULL || percentiles == NULL)
+		return;
+
+	unsigned long counts[SWITCHSTATS_LATENCY_BUCKETS];
+	unsigned long frames = 0, total, seen = 0;
+
+	memset(percentiles, 0, sizeof(struct switch_stats_percentiles));
+
+	pthread_mutex_lock(&stats->mutex);
+	for (int i = 0; i < SWITCHSTATS_LATENCY_BUCKETS; i++) {
+		counts[i] = __atomic_load_n(&stats->latency.counts[i], __ATOMIC_RELAXED) - stats->latencyBase.counts[i];
+		frames += counts[i];
+	}
+	total = __atomic_load_n(&stats->latency.total, __ATOMIC_RELAXED) - stats->latencyBase.total;
+	pthread_mutex_unlock(&stats->mutex);
+
+	if (frames == 0)
+		return;
+
+	percentiles->frames = frames;
+	percentiles->mean = total / frames;
+
+	// Ranks of percentiles, rounded up
+	unsigned long p50 = (frames * 500 + 999) / 1000;
+	unsigned long p99 = (frames * 990 + 999) / 1000;
+	unsigned long p999 = (frames * 999 + 999) / 1000;
+
+	for (int i = 0; i < SWITCHSTATS_LATENCY_BUCKETS; i++) {
+		if (counts[i] == 0)
+			continue;
+		unsigned long before = seen;
+		uint64_t value = getSwitchStatsLatencyValue(i);
+		seen += counts[i];
+		if (before < p50 && seen >= p50)
+			percentiles->p50 = value;
+		if (before < p99 && seen >= p99)
+			percentiles->p99 = value;
+		if (before < p999 && seen >= p999)
+			percentiles->p999 = value;
+		percentiles->max = value;
+	}
+}
+
+// Sending thread keeps recording, reset only copies base
+void resetSwitchStatsLatency(struct switch_if_stats * stats) {
+	if (stats == NULL)
+		return;
+
+	pthread_mutex_lock(&stats->mutex);
+	for (int i = 0; i < SWITCHSTATS_LATENCY_BUCKETS; i++)
+		stats->latencyBase.counts[i] = __atomic_load_n(&stats->latency.counts[i], __ATOMIC_RELAXED);
+	stats->latencyBase.total = __atomic_load_n(&stats->latency.total, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&stats->mutex);
+}
+
+void sampleSwitchStats(struct switch_if_stats * stats, const uint64_t time) {
+	if (stats == NULL)
+		return;
+
+	struct switch_stats_sample sample;
+	readSwitchStats(stats, &sample);
+	sample.time = time;
+
+	pthread_mutex_lock(&stats->mutex);
+	stats->history[stats->next] = sample;
+	stats->next = (stats->next + 1) % SWITCHSTATS_HISTORY;
+	if (stats->count < SWITCHSTATS_HISTORY)
+		stats->count++;
+	pthread_mutex_unlock(&stats->mutex);
+}
+
+/**
+ * Rate between newest sample and the one window seconds older, or the oldest
+ * one kept if interface was sampled for shorter time.
+ * Returns 0 if there are not two samples yet.
+ */
+int getSwitchStatsRate(struct switch_if_stats * stats, const unsigned int window, struct switch_stats_rate * rate) {
+	if (stats == NULL || rate == NULL || window == 0)
+		return 0;
+
+	struct switch_stats_sample newest, oldest;
+	unsigned int back;
+
+	pthread_mutex_lock(&stats->mutex);
+	if (stats->count < 2) {
+		pthread_mutex_unlock(&stats->mutex);
+		return 0;
+	}
+	back = window < stats->count - 1 ? window : stats->count - 1;
+	newest = stats->history[(stats->next + SWITCHSTATS_HISTORY - 1) % SWITCHSTATS_HISTORY];
+	oldest = stats->history[(stats->next + SWITCHSTATS_HISTORY - 1 - back) % SWITCHSTATS_HISTORY];
+	pthread_mutex_unlock(&stats->mutex);
+
+	if (newest.time <= oldest.time)
+		return 0;
+
+	double seconds = (newest.time - oldest.time) / 1000.0;
+	rate->receivedFrames = (newest.receivedFrames - oldest.receivedFrames) / seconds;
+	rate->receivedBits = (newest.receivedBytes - oldest.receivedBytes) * 8.0 / seconds;
+	rate->sentFrames = (newest.sentFrames - oldest.sentFrames) / seconds;
+	rate->sentBits = (newest.sentBytes - oldest.sentBytes) * 8.0 / seconds;
+	rate->droppedFrames = (newest.droppedFrames - oldest.droppedFrames) / seconds;
+	rate->window = back;
+	return 1;
+}
+
+/**
+ * Parses comma separated list of up to SWITCHSTATS_WINDOWS windows in seconds,
+ * unused windows are set to 0.
+ * Returns 0 on invalid list.
+ */
+int parseSwitchStatsWindows(const char * input, unsigned int * windows) {
+	if (input == NULL || windows == NULL)
+		return 0;
+
+	unsigned int parsed[SWITCHSTATS_WINDOWS] = {0};
+	unsigned int count = 0;
+	const char * position = input;
+	char * end;
+
+	while (*position != '\0') {
+		unsigned long window = strtoul(position, &end, 10);
+		if (end == position || window == 0 || window > SWITCHSTATS_MAX_WINDOW || count == SWITCHSTATS_WINDOWS)
+			return 0;
+		parsed[count++] = window;
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return 0;
+		position = end;
+	}
+
+	if (count == 0)
+		return 0;
+
+	memcpy(windows, parsed, sizeof(parsed));
+	return 1;
+}
+
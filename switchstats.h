@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchstats.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Per interface counters & rates
+ */
+
+
+#ifndef _SWITCHSTATS_
+#define _SWITCHSTATS_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define SWITCHSTATS_WINDOWS 3 // Rate windows shown
+#define SWITCHSTATS_MAX_WINDOW 300 // Seconds
+#define SWITCHSTATS_HISTORY (SWITCHSTATS_MAX_WINDOW + 1) // One sample per second
+#define SWITCHSTATS_LATENCY_SUB_BITS 5 // 32 linear buckets per power of 2, ~3% precision
+#define SWITCHSTATS_LATENCY_MAX_BITS 40 // Nanoseconds, ~18 minutes
+#define SWITCHSTATS_LATENCY_BUCKETS ((SWITCHSTATS_LATENCY_MAX_BITS - SWITCHSTATS_LATENCY_SUB_BITS + 1) << SWITCHSTATS_LATENCY_SUB_BITS)
+
+enum e_statsDrop {E_STATS_DROP_RX_RING_FULL = 0, // Listening thread
+				E_STATS_DROP_OWN_MAC, // Sent to switch port itself
+				E_STATS_DROP_VLAN_INGRESS, // Switching thread, charged to ingress port
+				E_STATS_DROP_MAC_LIMIT,
+				E_STATS_DROP_HAIRPIN, // Destination behind ingress port
+				E_STATS_DROP_NO_DESTINATION, // Flood or multicast reached no port
+				E_STATS_DROP_LAG_DOWN, // Switching thread, charged to egress port
+				E_STATS_DROP_VLAN_EGRESS,
+				E_STATS_DROP_PORT_DOWN,
+				E_STATS_DROP_TX_RING_FULL,
+				E_STATS_DROP_TAG, // Sending thread, no room for tag
+				E_STATS_DROP_SEND_ERROR,
+				E_STATS_DROP_COUNT};
+
+enum e_statsOwner {E_STATS_OWNER_LISTEN = 0, // Threads counting drops of port
+				E_STATS_OWNER_SWITCH,
+				E_STATS_OWNER_SEND,
+				E_STATS_OWNER_COUNT};
+
+struct switch_stats_counters { // Written by its owner thread only, on own cache line
+	unsigned long frames;
+	unsigned long bytes;
+} __attribute__((aligned(64)));
+
+struct switch_stats_drops { // Drops counted by one thread, by reason
+	unsigned long frames[E_STATS_DROP_COUNT];
+	unsigned long bytes;
+} __attribute__((aligned(64)));
+
+struct switch_stats_sample { // Counters of interface at one moment
+	uint64_t time; // Switch clock, milliseconds
+	unsigned long receivedFrames;
+	unsigned long receivedBytes;
+	unsigned long sentFrames;
+	unsigned long sentBytes;
+	unsigned long droppedFrames;
+	unsigned long droppedBytes;
+};
+
+struct switch_stats_rate { // Per second over window
+	double receivedFrames;
+	double receivedBits;
+	double sentFrames;
+	double sentBits;
+	double droppedFrames;
+	unsigned int window; // Seconds actually covered
+};
+
+struct switch_stats_latency { // Log bucketed histogram of ingress to transmit latency
+	unsigned long counts[SWITCHSTATS_LATENCY_BUCKETS];
+	unsigned long total; // Nanoseconds
+} __attribute__((aligned(64)));
+
+struct switch_stats_percentiles { // Nanoseconds, highest value equivalent to bucket
+	unsigned long frames;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+};
+
+struct switch_if_stats { // Switch interface stats
+	struct switch_stats_counters received; // Listening thread, ingress drops
+	struct switch_stats_counters sent; // Sending thread
+	struct switch_stats_drops drops[E_STATS_OWNER_COUNT];
+	struct switch_stats_latency latency; // Sending thread
+	struct switch_stats_sample base; // Counters at last reset
+	unsigned long dropsBase[E_STATS_DROP_COUNT];
+	struct switch_stats_latency latencyBase; // Histogram at last reset
+	struct switch_stats_sample history[SWITCHSTATS_HISTORY]; // Ring of maintain thread samples
+	unsigned int next; // Next history sample
+	unsigned int count;
+	pthread_mutex_t mutex; // Readers & maintain thread, never data path
+};
+
+void initSwitchStats(struct switch_if_stats * stats);
+void destroySwitchStats(struct switch_if_stats * stats);
+void countSwitchStats(struct switch_stats_counters * counters, const unsigned int bytes);
+void dropSwitchStats(struct switch_stats_drops * drops, const enum e_statsDrop reason, const unsigned int bytes);
+void readSwitchStatsDrops(struct switch_if_stats * stats, unsigned long * frames);
+void getSwitchStatsDrops(struct switch_if_stats * stats, unsigned long * frames);
+const char * getSwitchStatsDropName(const enum e_statsDrop reason);
+void readSwitchStats(struct switch_if_stats * stats, struct switch_stats_sample * sample);
+void getSwitchStats(struct switch_if_stats * stats, struct switch_stats_sample * sample);
+void resetSwitchStats(struct switch_if_stats * stats);
+uint64_t getSwitchStatsLatencyValue(const unsigned int bucket);
+void recordSwitchStatsLatency(struct switch_stats_latency * latency, const uint64_t nanos);
+void readSwitchStatsLatency(struct switch_if_stats * stats, struct switch_stats_latency * latency);
+void getSwitchStatsLatency(struct switch_if_stats * stats, struct switch_stats_percentiles * percentiles);
+void resetSwitchStatsLatency(struct switch_if_stats * stats);
+void sampleSwitchStats(struct switch_if_stats * stats, const uint64_t time);
+int getSwitchStatsRate(struct switch_if_stats * stats, const unsigned int window, struct switch_stats_rate * rate);
+int parseSwitchStatsWindows(const char * input, unsigned int * windows);
+
+#endif
+
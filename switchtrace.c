@@ -0,0 +1,275 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchtrace.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * USDT probes & per thread binary trace rings
+ */
+
+
+#include "switchtrace.h"
+#include "switchclock.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+
+/********************************************************************/
+
+unsigned int switchTraceEnabled = 0;
+
+struct switch_trace_ring * traceRings[SWITCHTRACE_MAX_RINGS]; // Append only, published by count
+unsigned int traceRingsCount = 0;
+unsigned int traceEntries = SWITCHTRACE_ENTRIES; // Of rings created from now on
+char traceCrashFile[256] = SWITCHTRACE_CRASH_FILE;
+unsigned int traceCrashHandler = 0;
+pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER; // Ring creation only
+
+__thread struct switch_trace_ring * traceRing = NULL; // Ring of calling thread
+__thread unsigned int traceRingFailed = 0;
+__thread char traceThread[SWITCHTRACE_NAME_LENGTH] = "thread";
+
+void setSwitchTraceThread(const char * name);
+int enableSwitchTrace(const unsigned int entries, const char * crashFile);
+void disableSwitchTrace();
+struct switch_trace_ring * createSwitchTraceRing();
+void recordSwitchTrace(const unsigned int event, const unsigned int port, const uint32_t arg1, const uint64_t arg2);
+int writeSwitchTraceData(const int fd, const void * data, size_t length);
+int writeSwitchTrace(const int fd);
+int dumpSwitchTrace(const char * fileName);
+void switchTraceCrashHandler(int signal);
+void destroySwitchTrace();
+void printSwitchTrace();
+
+/*******************************************************************/
+
+// Names ring of calling thread, ring itself is created by first record
+void setSwitchTraceThread(const char * name) {
+	if (name == NULL)
+		return;
+
+	strncpy(traceThread, name, SWITCHTRACE_NAME_LENGTH - 1);
+	traceThread[SWITCHTRACE_NAME_LENGTH - 1] = '\0';
+}
+
+/**
+ * Entries are rounded down to power of 2 and apply to rings not created yet.
+ * Rings are dumped to crash file on fatal signal.
+ */
+int enableSwitchTrace(const unsigned int entries, const char * crashFile) {
+
+	if (entries < 2) {
+		error_print("Invalid trace ring size: %u\n", entries);
+		return 0;
+	}
+
+	pthread_mutex_lock(&traceMutex);
+	traceEntries = 1U << (31 - __builtin_clz(entries));
+	if (crashFile != NULL) {
+		strncpy(traceCrashFile, crashFile, sizeof(traceCrashFile) - 1);
+		traceCrashFile[sizeof(traceCrashFile) - 1] = '\0';
+	}
+
+	if (traceCrashHandler == 0) {
+		struct sigaction action;
+		int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = switchTraceCrashHandler;
+		action.sa_flags = SA_RESETHAND; // Default action once dumped
+		sigemptyset(&action.sa_mask);
+		for (int i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+			sigaction(signals[i], &action, NULL);
+		traceCrashHandler = 1;
+	}
+	pthread_mutex_unlock(&traceMutex);
+
+	__atomic_store_n(&switchTraceEnabled, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+// Rings are kept for dump
+void disableSwitchTrace() {
+	__atomic_store_n(&switchTraceEnabled, 0, __ATOMIC_RELAXED);
+}
+
+struct switch_trace_ring * createSwitchTraceRing() {
+
+	struct switch_trace_ring * ring = NULL;
+
+	pthread_mutex_lock(&traceMutex);
+	if (traceRingsCount < SWITCHTRACE_MAX_RINGS)
+		ring = (struct switch_trace_ring *) malloc(sizeof(struct switch_trace_ring));
+	if (ring != NULL) {
+		ring->capacity = traceEntries;
+		ring->head = 0;
+		memcpy(ring->thread, traceThread, SWITCHTRACE_NAME_LENGTH);
+		ring->entries = (struct switch_trace_entry *) calloc(ring->capacity, sizeof(struct switch_trace_entry));
+		if (ring->entries == NULL) {
+			free((void *) ring);
+			ring = NULL;
+		}
+	}
+	if (ring != NULL) {
+		traceRings[traceRingsCount] = ring;
+		__atomic_store_n(&traceRingsCount, traceRingsCount + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&traceMutex);
+
+	if (ring == NULL) {
+		debug_print("Unable to create trace ring of thread %s\n", traceThread);
+		traceRingFailed = 1; // Thread does not trace
+	}
+	traceRing = ring;
+	return ring;
+}
+
+/**
+ * Lock-free, each thread writes its own ring. Oldest records are overwritten.
+ */
+void recordSwitchTrace(const unsigned int event, const unsigned int port, const uint32_t arg1, const uint64_t arg2) {
+
+	struct switch_trace_ring * ring = traceRing;
+
+	if (ring == NULL) {
+		if (traceRingFailed == 1 || (ring = createSwitchTraceRing()) == NULL)
+			return;
+	}
+
+	struct switch_trace_entry * entry = ring->entries + (ring->head & (ring->capacity - 1));
+	entry->time = getSwitchClockNanos();
+	entry->event = event;
+	entry->port = port;
+	entry->arg1 = arg1;
+	entry->arg2 = arg2;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+int writeSwitchTraceData(const int fd, const void * data, size_t length) {
+
+	const char * position = (const char *) data;
+
+	while (length > 0) {
+		ssize_t written = write(fd, position, length);
+		if (written <= 0)
+			return 0;
+		position += written;
+		length -= written;
+	}
+	return 1;
+}
+
+/**
+ * Uses async-signal-safe calls only, so it serves crash handler too. Rings
+ * are copied while being written, newest records of running threads may be
+ * torn.
+ */
+int writeSwitchTrace(const int fd) {
+
+	struct switch_trace_file_header header;
+	unsigned int count = __atomic_load_n(&traceRingsCount, __ATOMIC_ACQUIRE);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SWITCHTRACE_MAGIC, sizeof(header.magic));
+	header.rings = count;
+	header.entrySize = sizeof(struct switch_trace_entry);
+	header.time = getSwitchClockNanos();
+	if (writeSwitchTraceData(fd, &header, sizeof(header)) == 0)
+		return 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		struct switch_trace_ring * ring = traceRings[i];
+		struct switch_trace_ring_header ringHeader;
+
+		memset(&ringHeader, 0, sizeof(ringHeader));
+		memcpy(ringHeader.thread, ring->thread, SWITCHTRACE_NAME_LENGTH);
+		ringHeader.capacity = ring->capacity;
+		ringHeader.head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (writeSwitchTraceData(fd, &ringHeader, sizeof(ringHeader)) == 0
+						|| writeSwitchTraceData(fd, ring->entries, sizeof(struct switch_trace_entry) * ring->capacity) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+int dumpSwitchTrace(const char * fileName) {
+
+	int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		error_print("Unable to open trace file %s\n", fileName);
+		return 0;
+	}
+
+	int written = writeSwitchTrace(fd);
+	if (close(fd) == -1 || written == 0) {
+		error_print("Unable to write trace file %s\n", fileName);
+		return 0;
+	}
+	return 1;
+}
+
+void switchTraceCrashHandler(int signal) {
+
+	int fd = open(traceCrashFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		writeSwitchTrace(fd);
+		close(fd);
+	}
+	raise(signal); // Handler was reset, so default action follows
+}
+
+// No thread may trace any more
+void destroySwitchTrace() {
+
+	disableSwitchTrace();
+
+	pthread_mutex_lock(&traceMutex);
+	for (unsigned int i = 0; i < traceRingsCount; i++) {
+		free((void *) traceRings[i]->entries);
+		free((void *) traceRings[i]);
+	}
+	traceRingsCount = 0;
+	pthread_mutex_unlock(&traceMutex);
+}
+
+void printSwitchTrace() {
+
+	unsigned int count = __atomic_load_n(&traceRingsCount, __ATOMIC_ACQUIRE);
+
+	user_print("\nTracing %s, %u entries per new ring, crash dump to %s\n",
+						switchTraceEnabled == 1 ? "enabled" : "disabled",
+						traceEntries,
+						traceCrashFile);
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned long head = __atomic_load_n(&traceRings[i]->head, __ATOMIC_RELAXED);
+		user_print("%-16s %lu records, %u kept\n",
+						traceRings[i]->thread,
+						head,
+						head < traceRings[i]->capacity ? (unsigned int) head : traceRings[i]->capacity);
+	}
+	user_print("%s\n","");
+}
+
@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     switchtrace.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * USDT probes & per thread binary trace rings
+ */
+
+
+#ifndef _SWITCHTRACE_
+#define _SWITCHTRACE_
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * USDT probes, nop instructions unless attached by bpftrace / perf, e.g.
+ * bpftrace -e 'usdt:./switch:softswitch:rx { @[arg0] = count(); }'
+ * Probes take port index and two event arguments.
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SWITCH_USDT(probe, port, arg1, arg2) DTRACE_PROBE3(softswitch, probe, port, arg1, arg2)
+#endif
+#endif
+#ifndef SWITCH_USDT
+#define SWITCH_USDT(probe, port, arg1, arg2) do {} while (0)
+#endif
+
+// Probe & trace ring record, ring costs one branch when disabled
+#define SWITCH_TRACE(probe, event, port, arg1, arg2) do { \
+	SWITCH_USDT(probe, port, arg1, arg2); \
+	if (__builtin_expect(__atomic_load_n(&switchTraceEnabled, __ATOMIC_RELAXED), 0)) \
+		recordSwitchTrace(event, port, arg1, arg2); \
+} while (0)
+
+#define SWITCHTRACE_ENTRIES 65536 // Default per thread, power of 2
+#define SWITCHTRACE_MAX_RINGS 256
+#define SWITCHTRACE_NAME_LENGTH 16
+#define SWITCHTRACE_CRASH_FILE "softswitch.trace" // If none configured
+#define SWITCHTRACE_MAGIC "SWTRACE1"
+
+enum e_traceEvent {E_TRACE_RX = 0, // Port, length
+				E_TRACE_ENQUEUE, // Port (-1 if none), depth
+				E_TRACE_DEQUEUE, // -1, items, depth
+				E_TRACE_LEARN, // Port, key
+				E_TRACE_MOVE, // Port, old port, key
+				E_TRACE_HIT, // Port, key
+				E_TRACE_MISS, // -1, key
+				E_TRACE_FLOOD, // Ingress port, VLAN
+				E_TRACE_TX, // Port, length
+				E_TRACE_DROP}; // Port, reason
+
+struct switch_trace_entry { // Binary trace record, 24 B
+	uint64_t time; // Switch clock, nanoseconds
+	uint16_t event;
+	uint16_t port;
+	uint32_t arg1;
+	uint64_t arg2;
+};
+
+struct switch_trace_ring { // Written by its thread only
+	char thread[SWITCHTRACE_NAME_LENGTH];
+	unsigned int capacity; // Power of 2
+	uint64_t head; // Records written, oldest are overwritten
+	struct switch_trace_entry * entries;
+};
+
+struct switch_trace_file_header { // Dump file, followed by rings
+	char magic[8];
+	uint32_t rings;
+	uint32_t entrySize;
+	uint64_t time; // Switch clock at dump
+};
+
+struct switch_trace_ring_header { // Followed by capacity entries, head % capacity is oldest once wrapped
+	char thread[SWITCHTRACE_NAME_LENGTH];
+	uint32_t capacity;
+	uint32_t reserved;
+	uint64_t head;
+};
+
+extern unsigned int switchTraceEnabled;
+
+void setSwitchTraceThread(const char * name);
+int enableSwitchTrace(const unsigned int entries, const char * crashFile);
+void disableSwitchTrace();
+void recordSwitchTrace(const unsigned int event, const unsigned int port, const uint32_t arg1, const uint64_t arg2);
+int dumpSwitchTrace(const char * fileName);
+void destroySwitchTrace();
+void printSwitchTrace();
+
+#endif
+
@@ -0,0 +1,312 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     toptalkers.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Top talkers, count-min sketch with per port heavy hitters
+ */
+
+
+#include "toptalkers.h"
+#include "switchcore.h"
+#include "switchclock.h"
+#include "mactable.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <net/ethernet.h>
+
+#define TOPTALKERS_GOLDEN 0x9E3779B97F4A7C15ULL // Spreads port & kind over key
+
+/********************************************************************/
+
+struct switch_toptalkers * initTopTalkers();
+void destroyTopTalkers(struct switch_toptalkers * talkers);
+void updateTopTalkers(struct switch_toptalkers * talkers, const struct switch_buffer_item * item, const int vlan);
+void countTopTalker(struct switch_toptalkers_window * window, const unsigned int port, const enum e_topTalkerKind kind, const uint64_t hash, struct ether_header * frameHdr, const int vlan, const uint64_t bytes);
+uint64_t mixTopTalkerHash(uint64_t value);
+void offerTopTalker(struct switch_toptalker * top, unsigned int * count, const uint64_t key, const uint64_t bytes, const enum e_topTalkerKind kind, struct ether_header * frameHdr, const int vlan);
+void siftDownTopTalker(struct switch_toptalker * top, const unsigned int count, unsigned int index);
+void maintainTopTalkers(struct switch_toptalkers * talkers);
+void setTopTalkersWindow(struct switch_toptalkers * talkers, const unsigned int window);
+void setTopTalkersSampling(struct switch_toptalkers * talkers, const unsigned int sampling);
+void setTopTalkersEnabled(struct switch_toptalkers * talkers, const unsigned int enabled);
+void printTopTalkers(struct switch_toptalkers * talkers, struct switch_if * ifs, struct switch_if * iface);
+void printTopTalkersPort(struct switch_toptalkers_window * window, struct switch_if * iface);
+unsigned int sortTopTalkers(const struct switch_toptalker * top, const unsigned int count, struct switch_toptalker * sorted);
+
+/*******************************************************************/
+
+struct switch_toptalkers * initTopTalkers() {
+	debug_print("%s\n", "START");
+
+	struct switch_toptalkers * talkers = (struct switch_toptalkers *) malloc(sizeof(struct switch_toptalkers));
+	if (talkers == NULL) {
+		debug_print("%s\n", "Error initializing top talkers");
+		return NULL;
+	}
+
+	memset(talkers, 0, sizeof(struct switch_toptalkers));
+	talkers->enabled = 1;
+	talkers->window = TOPTALKERS_WINDOW;
+	talkers->sampling = 1;
+	talkers->windows[0].start = getSwitchClockSeconds();
+	talkers->seed = mixTopTalkerHash(getSwitchClockNanos() ^ (uintptr_t) talkers); // Differs per run
+
+	debug_print("Top talkers use %lu B\n", (unsigned long) sizeof(struct switch_toptalkers));
+	return talkers;
+}
+
+void destroyTopTalkers(struct switch_toptalkers * talkers) {
+	free((void *) talkers);
+}
+
+/**
+ * Called by switching thread for each received frame. Every sampled frame
+ * costs four hash mixes, DEPTH counters per kind and a short heap check.
+ */
+void updateTopTalkers(struct switch_toptalkers * talkers, const struct switch_buffer_item * item, const int vlan) {
+
+	if (talkers == NULL || __atomic_load_n(&talkers->enabled, __ATOMIC_RELAXED) == 0)
+		return;
+
+	unsigned int sampling = talkers->sampling;
+	if (sampling > 1 && ++talkers->sampleCounter < sampling)
+		return;
+	talkers->sampleCounter = 0;
+
+	struct switch_if * port = item->receiverIf;
+	if (port == NULL || port->index >= SWITCH_MAX_IFS)
+		return;
+
+	struct ether_header * frameHdr = (struct ether_header *) item->packetData;
+	struct switch_toptalkers_window * window = talkers->windows + __atomic_load_n(&talkers->active, __ATOMIC_ACQUIRE);
+	uint64_t bytes = (uint64_t) item->size * sampling;
+	unsigned int frameVlan = vlan < 0 ? 0 : vlan;
+	// Lookup keys hold address & VLAN, port & kind are mixed in per kind
+	uint64_t source = mixTopTalkerHash(talkers->seed ^ getMACTableLookupKey(frameHdr->ether_shost, frameVlan));
+	uint64_t flow = mixTopTalkerHash(source ^ getMACTableLookupKey(frameHdr->ether_dhost, frameVlan));
+
+	window->bytes[port->index] += bytes;
+	countTopTalker(window, port->index, E_TOPTALKER_MAC, source, frameHdr, frameVlan, bytes);
+	countTopTalker(window, port->index, E_TOPTALKER_FLOW, flow, frameHdr, frameVlan, bytes);
+}
+
+/**
+ * Conservative update, only rows below new estimate are raised. Row indexes
+ * come from two halves of one hash of the full key, h1 + i * h2.
+ */
+void countTopTalker(struct switch_toptalkers_window * window, const unsigned int port, const enum e_topTalkerKind kind, const uint64_t hash, struct ether_header * frameHdr, const int vlan, const uint64_t bytes) {
+
+	uint64_t key = mixTopTalkerHash(hash ^ ((uint64_t) ((port << 1) | kind) + 1) * TOPTALKERS_GOLDEN);
+	uint32_t h1 = (uint32_t) key;
+	uint32_t h2 = (uint32_t) (key >> 32) | 1;
+	unsigned int indexes[TOPTALKERS_DEPTH];
+	uint64_t estimate = ~0ULL;
+
+	for (unsigned int row = 0; row < TOPTALKERS_DEPTH; row++) {
+		indexes[row] = (h1 + row * h2) & (TOPTALKERS_WIDTH - 1);
+		if (window->counts[row][indexes[row]] < estimate)
+			estimate = window->counts[row][indexes[row]];
+	}
+	estimate += bytes;
+
+	for (unsigned int row = 0; row < TOPTALKERS_DEPTH; row++) {
+		if (window->counts[row][indexes[row]] < estimate)
+			window->counts[row][indexes[row]] = estimate;
+	}
+
+	offerTopTalker(window->top[port][kind], &window->topCount[port][kind], key, estimate, kind, frameHdr, vlan);
+}
+
+// MurmurHash3 finalizer, bijective, every input bit affects every output bit
+uint64_t mixTopTalkerHash(uint64_t value) {
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ULL;
+	value ^= value >> 33;
+	return value;
+}
+
+// Min heap, root is the smallest kept talker
+void offerTopTalker(struct switch_toptalker * top, unsigned int * count, const uint64_t key, const uint64_t bytes, const enum e_topTalkerKind kind, struct ether_header * frameHdr, const int vlan) {
+
+	unsigned int index;
+
+	for (index = 0; index < *count; index++) {
+		if (top[index].key == key) {
+			top[index].bytes = bytes; // Estimates only grow
+			siftDownTopTalker(top, *count, index);
+			return;
+		}
+	}
+
+	if (*count < TOPTALKERS_K) {
+		index = (*count)++;
+		// Sift up
+		while (index > 0 && top[(index - 1) / 2].bytes > bytes) {
+			top[index] = top[(index - 1) / 2];
+			index = (index - 1) / 2;
+		}
+	} else if (bytes > top[0].bytes) {
+		index = 0;
+	} else {
+		return;
+	}
+
+	top[index].key = key;
+	top[index].bytes = bytes;
+	top[index].vlan = vlan;
+	memcpy(top[index].source, frameHdr->ether_shost, ETHER_ADDR_LEN);
+	if (kind == E_TOPTALKER_FLOW)
+		memcpy(top[index].destination, frameHdr->ether_dhost, ETHER_ADDR_LEN);
+	else
+		memset(top[index].destination, 0, ETHER_ADDR_LEN);
+	if (index == 0)
+		siftDownTopTalker(top, *count, 0);
+}
+
+void siftDownTopTalker(struct switch_toptalker * top, const unsigned int count, unsigned int index) {
+
+	struct switch_toptalker talker = top[index];
+
+	while (2 * index + 1 < count) {
+		unsigned int child = 2 * index + 1;
+		if (child + 1 < count && top[child + 1].bytes < top[child].bytes)
+			child++;
+		if (talker.bytes <= top[child].bytes)
+			break;
+		top[index] = top[child];
+		index = child;
+	}
+	top[index] = talker;
+}
+
+/**
+ * Called by maintain thread. Idle window is cleared before switching thread
+ * is moved onto it, so data path never pays for clearing.
+ */
+void maintainTopTalkers(struct switch_toptalkers * talkers) {
+	if (talkers == NULL)
+		return;
+
+	uint32_t now = getSwitchClockSeconds();
+	unsigned int active = talkers->active;
+	struct switch_toptalkers_window * current = talkers->windows + active;
+	struct switch_toptalkers_window * next = talkers->windows + (active ^ 1);
+
+	if (now - current->start < talkers->window)
+		return;
+
+	memset(next, 0, sizeof(struct switch_toptalkers_window));
+	next->start = now;
+	current->end = now;
+	__atomic_store_n(&talkers->active, active ^ 1, __ATOMIC_RELEASE);
+}
+
+void setTopTalkersWindow(struct switch_toptalkers * talkers, const unsigned int window) {
+	if (talkers != NULL && window > 0)
+		talkers->window = window;
+}
+
+void setTopTalkersSampling(struct switch_toptalkers * talkers, const unsigned int sampling) {
+	if (talkers != NULL && sampling > 0)
+		talkers->sampling = sampling;
+}
+
+void setTopTalkersEnabled(struct switch_toptalkers * talkers, const unsigned int enabled) {
+	if (talkers != NULL)
+		__atomic_store_n(&talkers->enabled, enabled > 0 ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Shows last complete window, or the running one if none completed yet.
+ * Single port if iface is given.
+ */
+void printTopTalkers(struct switch_toptalkers * talkers, struct switch_if * ifs, struct switch_if * iface) {
+	if (talkers == NULL)
+		return;
+
+	unsigned int active = __atomic_load_n(&talkers->active, __ATOMIC_ACQUIRE);
+	struct switch_toptalkers_window * window = talkers->windows + (active ^ 1);
+
+	if (window->end == 0) {
+		window = talkers->windows + active;
+		user_print("\nTop talkers of running window, %u s so far", getSwitchClockSeconds() - window->start);
+	} else {
+		user_print("\nTop talkers of last %u s window, ended %u s ago", window->end - window->start, getSwitchClockSeconds() - window->end);
+	}
+	user_print(" (%s, 1 in %u frames sampled)\n", talkers->enabled == 1 ? "enabled" : "disabled", talkers->sampling);
+
+	for (struct switch_if * port = ifs; port != NULL; port = port->next) {
+		if ((iface == NULL || iface == port) && port->index < SWITCH_MAX_IFS)
+			printTopTalkersPort(window, port);
+	}
+	user_print("%s\n","");
+}
+
+void printTopTalkersPort(struct switch_toptalkers_window * window, struct switch_if * iface) {
+
+	struct switch_toptalker sorted[TOPTALKERS_K];
+	char source[20], destination[20];
+	uint64_t portBytes = window->bytes[iface->index];
+	unsigned int count;
+
+	if (portBytes == 0)
+		return;
+
+	user_print("\n%s: %lu B received\n", iface->name, (unsigned long) portBytes);
+	user_print("%s\n", "  Source          VLAN  Bytes         Share");
+	count = sortTopTalkers(window->top[iface->index][E_TOPTALKER_MAC], window->topCount[iface->index][E_TOPTALKER_MAC], sorted);
+	for (unsigned int i = 0; i < count; i++) {
+		formatMACAddress(sorted[i].source, source);
+		user_print("  %-15s %-5u %-13lu %5.1f%%\n", source, sorted[i].vlan, (unsigned long) sorted[i].bytes, 100.0 * sorted[i].bytes / portBytes);
+	}
+
+	user_print("%s\n", "  Flow                               VLAN  Bytes         Share");
+	count = sortTopTalkers(window->top[iface->index][E_TOPTALKER_FLOW], window->topCount[iface->index][E_TOPTALKER_FLOW], sorted);
+	for (unsigned int i = 0; i < count; i++) {
+		formatMACAddress(sorted[i].source, source);
+		formatMACAddress(sorted[i].destination, destination);
+		user_print("  %-15s > %-15s  %-5u %-13lu %5.1f%%\n", source, destination, sorted[i].vlan, (unsigned long) sorted[i].bytes, 100.0 * sorted[i].bytes / portBytes);
+	}
+}
+
+// Descending by bytes, heap may be written meanwhile so it is copied first
+unsigned int sortTopTalkers(const struct switch_toptalker * top, const unsigned int count, struct switch_toptalker * sorted) {
+
+	unsigned int sortedCount = count < TOPTALKERS_K ? count : TOPTALKERS_K;
+
+	for (unsigned int i = 0; i < sortedCount; i++) {
+		struct switch_toptalker talker = top[i];
+		unsigned int j = i;
+		while (j > 0 && sorted[j - 1].bytes < talker.bytes) {
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = talker;
+	}
+	return sortedCount;
+}
+
@@ -0,0 +1,83 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     toptalkers.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * Top talkers, count-min sketch with per port heavy hitters
+ */
+
+
+#ifndef _TOPTALKERS_
+#define _TOPTALKERS_
+
+#include "switchcore.h"
+#include "switchbuffer.h"
+
+#include <stdint.h>
+#include <net/ethernet.h>
+
+#define TOPTALKERS_DEPTH 4 // Sketch rows
+#define TOPTALKERS_WIDTH 8192 // Counters per row, power of 2
+#define TOPTALKERS_K 8 // Heavy hitters kept per port & kind
+#define TOPTALKERS_WINDOW 10 // Seconds
+
+enum e_topTalkerKind {E_TOPTALKER_MAC = 0, // Source address
+				E_TOPTALKER_FLOW, // Source & destination address
+				E_TOPTALKER_KINDS};
+
+struct switch_toptalker { // Heavy hitter candidate
+	uint64_t key; // Port, kind & addresses hash
+	uint64_t bytes; // Sketch estimate, never lower than real count
+	u_char source[ETHER_ADDR_LEN];
+	u_char destination[ETHER_ADDR_LEN]; // Flows only
+	unsigned short vlan;
+};
+
+struct switch_toptalkers_window { // Written by switching thread while active
+	uint64_t counts[TOPTALKERS_DEPTH][TOPTALKERS_WIDTH];
+	struct switch_toptalker top[SWITCH_MAX_IFS][E_TOPTALKER_KINDS][TOPTALKERS_K]; // Min heaps by bytes
+	unsigned int topCount[SWITCH_MAX_IFS][E_TOPTALKER_KINDS];
+	uint64_t bytes[SWITCH_MAX_IFS]; // Exact per port, sampled
+	uint32_t start; // Switch clock seconds
+	uint32_t end; // 0 while active
+};
+
+struct switch_toptalkers { // Fixed size, two windows swapped periodically
+	struct switch_toptalkers_window windows[2];
+	unsigned int active; // Window being written
+	unsigned int enabled;
+	unsigned int window; // Seconds
+	unsigned int sampling; // Every n-th frame, counted n times
+	unsigned int sampleCounter; // Switching thread only
+	uint64_t seed; // Keys sketch hashes
+};
+
+struct switch_toptalkers * initTopTalkers();
+void destroyTopTalkers(struct switch_toptalkers * talkers);
+void updateTopTalkers(struct switch_toptalkers * talkers, const struct switch_buffer_item * item, const int vlan);
+void maintainTopTalkers(struct switch_toptalkers * talkers);
+void setTopTalkersWindow(struct switch_toptalkers * talkers, const unsigned int window);
+void setTopTalkersSampling(struct switch_toptalkers * talkers, const unsigned int sampling);
+void setTopTalkersEnabled(struct switch_toptalkers * talkers, const unsigned int enabled);
+void printTopTalkers(struct switch_toptalkers * talkers, struct switch_if * ifs, struct switch_if * iface);
+
+#endif
+
@@ -27,6 +27,7 @@
 #include "utils.h"
 
 #include <stdio.h>
+#include <ctype.h>
 #include <pcap.h>
 #include <net/ethernet.h>
 
@@ -73,6 +74,51 @@ void formatMACAddress(u_char * address,  char * output) {
 
 }
 
+int parseMACAddress(const char * input, u_char * address) {
+
+	unsigned int octets[ETHER_ADDR_LEN];
+	char tail;
+
+	if (input == NULL || address == NULL)
+		return 0;
+
+	// Either aabb.ccdd.eeff (as printed) or aa:bb:cc:dd:ee:ff
+	if (sscanf(input, "%2x%2x.%2x%2x.%2x%2x%c", &octets[0], &octets[1], &octets[2], &octets[3], &octets[4], &octets[5], &tail) != ETHER_ADDR_LEN
+			&& sscanf(input, "%2x:%2x:%2x:%2x:%2x:%2x%c", &octets[0], &octets[1], &octets[2], &octets[3], &octets[4], &octets[5], &tail) != ETHER_ADDR_LEN)
+		return 0;
+
+	for (int i = 0; i < ETHER_ADDR_LEN; i++)
+		address[i] = (u_char) octets[i];
+
+	return 1;
+}
+
+/**
+ * Leading hex digits of address, separators are ignored. Returns count of
+ * digits, 0 if invalid.
+ */
+int parseMACPrefix(const char * input, u_char * prefix) {
+
+	int digits = 0;
+
+	if (input == NULL || prefix == NULL)
+		return 0;
+
+	memset(prefix, 0, ETHER_ADDR_LEN);
+	for (; *input != '\0'; input++) {
+		unsigned int value;
+		if (*input == '.' || *input == ':' || *input == '-')
+			continue;
+		if (digits == ETHER_ADDR_LEN * 2 || isxdigit((unsigned char) *input) == 0)
+			return 0;
+		value = isdigit((unsigned char) *input) ? *input - '0' : tolower((unsigned char) *input) - 'a' + 10;
+		prefix[digits / 2] |= (digits % 2) == 0 ? value << 4 : value;
+		digits++;
+	}
+
+	return digits;
+}
+
 int isBroadcast(u_char * address) {
 
 	char frmt[20];
@@ -87,3 +133,11 @@ int isBroadcast(u_char * address) {
 	return 0;
 }
 
+int isMulticast(u_char * address) {
+
+	if (address == NULL)
+		return 0;
+
+	// I/G bit of the first octet
+	return (address[0] & 0x01) ? 1 : 0;
+}
@@ -53,7 +53,10 @@
 void flushStream(FILE * stream);
 int readCommand(char * command, unsigned int length);
 void formatMACAddress(u_char * address, char * output);
+int parseMACAddress(const char * input, u_char * address);
+int parseMACPrefix(const char * input, u_char * prefix);
 int isBroadcast(u_char * address);
+int isMulticast(u_char * address);
 
 #endif
 
@@ -0,0 +1,247 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     vlan.c
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * 802.1Q VLAN implementation
+ */
+
+#include "vlan.h"
+#include "switchcore.h"
+#include "switchbuffer.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <net/ethernet.h>
+
+#define VLAN_ALLOWED(vlanConf, vid) (((vlanConf)->allowed[(vid) >> 3] >> ((vid) & 0x07)) & 0x01)
+
+/********************************************************************/
+
+void initSwitchIfVlan(struct switch_if_vlan * vlan);
+int setSwitchIfVlan(struct switch_if * iface, enum e_vlanMode mode, const unsigned int pvid, char * allowed);
+int isSwitchIfVlanMember(struct switch_if * iface, const unsigned int vlan);
+int getFrameVlan(struct switch_if * iface, const u_char * frame, const unsigned int length);
+unsigned int getFrameEtherType(const u_char * frame, const unsigned int length, unsigned int * headerLength);
+u_char * vlanEgressFrame(struct switch_if * iface, const unsigned int vlan, u_char * frame, unsigned int * length);
+void printSwitchIfVlans(struct switch_if * ifs);
+int parseVlanList(char * list, u_char * allowed);
+
+/*******************************************************************/
+
+void initSwitchIfVlan(struct switch_if_vlan * vlan) {
+
+	if (vlan == NULL)
+		return;
+
+	// Access port in default VLAN
+	vlan->mode = E_VLAN_MODE_ACCESS;
+	vlan->pvid = VLAN_DEFAULT;
+	memset(vlan->allowed, 0, sizeof(vlan->allowed));
+}
+
+/**
+ * Configures port VLANs. Allowed is list of trunk VLANs ("1-10,20" or "all").
+ * Config is read without locking by the data path, so port may use partially
+ * updated config for few frames.
+ */
+int setSwitchIfVlan(struct switch_if * iface, enum e_vlanMode mode, const unsigned int pvid, char * allowed) {
+
+	u_char allowedVlans[VLAN_COUNT / 8];
+
+	if (iface == NULL || pvid == 0 || pvid >= VLAN_COUNT - 1) {
+		debug_print("%s\n", "Invalid params");
+		return 0;
+	}
+
+	memset(allowedVlans, 0, sizeof(allowedVlans));
+	if (mode == E_VLAN_MODE_TRUNK && allowed != NULL && parseVlanList(allowed, allowedVlans) == 0)
+		return 0;
+
+	pthread_mutex_lock(&iface->mutex);
+	iface->vlan.mode = mode;
+	iface->vlan.pvid = pvid;
+	memcpy(iface->vlan.allowed, allowedVlans, sizeof(allowedVlans));
+	// Native VLAN is always allowed
+	iface->vlan.allowed[pvid >> 3] |= 1 << (pvid & 0x07);
+	pthread_mutex_unlock(&iface->mutex);
+
+	return 1;
+}
+
+int parseVlanList(char * list, u_char * allowed) {
+
+	char * token;
+	char * savePtr;
+	char * end;
+	long from, to;
+
+	if (strcmp(list, "all") == 0) {
+		memset(allowed, 0xff, VLAN_COUNT / 8);
+		// VLAN 0 & 4095 are reserved
+		allowed[0] &= ~0x01;
+		allowed[(VLAN_COUNT - 1) >> 3] &= ~(1 << ((VLAN_COUNT - 1) & 0x07));
+		return 1;
+	}
+
+	for (token = strtok_r(list, ",", &savePtr); token != NULL; token = strtok_r(NULL, ",", &savePtr)) {
+		from = strtol(token, &end, 10);
+		to = from;
+		if (*end == '-')
+			to = strtol(end + 1, &end, 10);
+		if (*end != '\0' || from <= 0 || to >= VLAN_COUNT - 1 || from > to) {
+			error_print("Invalid VLAN range: %s\n", token);
+			return 0;
+		}
+		for (long vid = from; vid <= to; vid++)
+			allowed[vid >> 3] |= 1 << (vid & 0x07);
+	}
+
+	return 1;
+}
+
+int isSwitchIfVlanMember(struct switch_if * iface, const unsigned int vlan) {
+
+	if (iface->vlan.mode == E_VLAN_MODE_ACCESS)
+		return iface->vlan.pvid == vlan;
+
+	return VLAN_ALLOWED(&iface->vlan, vlan);
+}
+
+/**
+ * Classifies received frame into VLAN. Returns -1 if the frame is not
+ * accepted by ingress filtering of the port.
+ */
+int getFrameVlan(struct switch_if * iface, const u_char * frame, const unsigned int length) {
+
+	unsigned int vid;
+
+	if (iface == NULL || frame == NULL || length < ETHER_HDR_LEN)
+		return -1;
+
+	// Untagged & priority tagged frames belong to port VLAN
+	vid = iface->vlan.pvid;
+	if (length >= ETHER_HDR_LEN + VLAN_TAG_LEN && ((frame[12] << 8) | frame[13]) == VLAN_ETHERTYPE) {
+		unsigned int tagged = ((frame[14] & 0x0f) << 8) | frame[15];
+		if (tagged != 0)
+			vid = tagged;
+	}
+
+	if (isSwitchIfVlanMember(iface, vid) == 0)
+		return -1;
+
+	return vid;
+}
+
+/**
+ * Returns ethertype of frame and length of its ethernet header, VLAN tag
+ * included.
+ */
+unsigned int getFrameEtherType(const u_char * frame, const unsigned int length, unsigned int * headerLength) {
+
+	unsigned int etherType;
+
+	*headerLength = ETHER_HDR_LEN;
+	if (frame == NULL || length < ETHER_HDR_LEN)
+		return 0;
+
+	etherType = (frame[12] << 8) | frame[13];
+	if (etherType == VLAN_ETHERTYPE) {
+		if (length < ETHER_HDR_LEN + VLAN_TAG_LEN)
+			return 0;
+		*headerLength += VLAN_TAG_LEN;
+		etherType = (frame[16] << 8) | frame[17];
+	}
+
+	return etherType;
+}
+
+/**
+ * Pushes, pops or rewrites VLAN tag of frame in place, as egress port
+ * requires. Returns start of the frame to send, or NULL if there is no room
+ * for the tag.
+ */
+u_char * vlanEgressFrame(struct switch_if * iface, const unsigned int vlan, u_char * frame, unsigned int * length) {
+
+	int isTagged;
+	int wantTag;
+
+	if (iface == NULL || frame == NULL || *length < ETHER_HDR_LEN)
+		return frame;
+
+	isTagged = *length >= ETHER_HDR_LEN + VLAN_TAG_LEN && ((frame[12] << 8) | frame[13]) == VLAN_ETHERTYPE;
+	wantTag = iface->vlan.mode == E_VLAN_MODE_TRUNK && vlan != iface->vlan.pvid;
+
+	if (wantTag && isTagged) {
+		// Rewrite VID, keep priority
+		frame[14] = (frame[14] & 0xf0) | ((vlan >> 8) & 0x0f);
+		frame[15] = vlan & 0xff;
+	} else if (wantTag) {
+		// Push
+		if (*length + VLAN_TAG_LEN > SWITCH_BUFFER_PACKET_DATA_SIZE)
+			return NULL;
+		memmove(frame + 2 * ETHER_ADDR_LEN + VLAN_TAG_LEN, frame + 2 * ETHER_ADDR_LEN, *length - 2 * ETHER_ADDR_LEN);
+		frame[12] = VLAN_ETHERTYPE >> 8;
+		frame[13] = VLAN_ETHERTYPE & 0xff;
+		frame[14] = (vlan >> 8) & 0x0f;
+		frame[15] = vlan & 0xff;
+		*length += VLAN_TAG_LEN;
+	} else if (isTagged) {
+		// Pop
+		memmove(frame + VLAN_TAG_LEN, frame, 2 * ETHER_ADDR_LEN);
+		frame += VLAN_TAG_LEN;
+		*length -= VLAN_TAG_LEN;
+	}
+
+	return frame;
+}
+
+void printSwitchIfVlans(struct switch_if * ifs) {
+
+	user_print("\nIface\tMode\tVLAN\tAllowed%s","\n");
+	for (struct switch_if * iface = ifs; iface != NULL; iface = iface->next) {
+		if (iface->vlan.mode == E_VLAN_MODE_ACCESS) {
+			user_print("%-6s\taccess\t%u\t-\n", iface->name, iface->vlan.pvid);
+			continue;
+		}
+
+		user_print("%-6s\ttrunk\t%u\t", iface->name, iface->vlan.pvid);
+		// Print allowed VLANs as ranges
+		int first = 1;
+		for (unsigned int vid = 1; vid < VLAN_COUNT; vid++) {
+			if (VLAN_ALLOWED(&iface->vlan, vid) == 0)
+				continue;
+			unsigned int last = vid;
+			while (last + 1 < VLAN_COUNT && VLAN_ALLOWED(&iface->vlan, last + 1))
+				last++;
+			if (last == vid)
+				user_print("%s%u", first ? "" : ",", vid);
+			else
+				user_print("%s%u-%u", first ? "" : ",", vid, last);
+			first = 0;
+			vid = last;
+		}
+		user_print("%s\n", "");
+	}
+	user_print("%s\n", "");
+}
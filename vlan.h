@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2011, Jozef Lang
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ *
+ * File:     vlan.h
+ * Revision: $Rev$
+ * Author:   $Author$
+ * Date:     $Date$
+ *
+ * 802.1Q VLAN implementation
+ */
+
+#ifndef _VLAN_
+#define _VLAN_
+
+#include <pcap.h>
+
+#define VLAN_DEFAULT 1
+#define VLAN_COUNT 4096
+#define VLAN_TAG_LEN 4
+#define VLAN_ETHERTYPE 0x8100
+
+enum e_vlanMode {
+				E_VLAN_MODE_ACCESS = 0,
+				E_VLAN_MODE_TRUNK};
+
+struct switch_if_vlan { // Switch interface VLAN config
+	enum e_vlanMode mode;
+	unsigned int pvid; // Access VLAN or trunk native VLAN
+	u_char allowed[VLAN_COUNT / 8]; // Trunk allowed VLANs
+};
+
+struct switch_if;
+
+void initSwitchIfVlan(struct switch_if_vlan * vlan);
+int setSwitchIfVlan(struct switch_if * iface, enum e_vlanMode mode, const unsigned int pvid, char * allowed);
+int isSwitchIfVlanMember(struct switch_if * iface, const unsigned int vlan);
+int getFrameVlan(struct switch_if * iface, const u_char * frame, const unsigned int length);
+unsigned int getFrameEtherType(const u_char * frame, const unsigned int length, unsigned int * headerLength);
+u_char * vlanEgressFrame(struct switch_if * iface, const unsigned int vlan, u_char * frame, unsigned int * length);
+void printSwitchIfVlans(struct switch_if * ifs);
+
+#endif
+